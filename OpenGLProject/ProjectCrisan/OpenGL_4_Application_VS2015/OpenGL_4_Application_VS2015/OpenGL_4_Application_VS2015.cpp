@@ -9,14 +9,25 @@
 #include "stb_image.h"
 
 #include "model.h"
+#include "collision_world.h"
+#include "dynamics.h"
+#include "frame_uniforms.h"
+#include "gpu_driven.h"
+#include "hlod.h"
+#include "loose_octree.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "static_batch.h"
+#include <cfloat>
 #include <iostream>
+#include <random>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
-unsigned int loadCubemap(vector<std::string> faces);
+TextureHandle loadTexture(const char *path);
+TextureHandle loadCubemap(vector<std::string> faces);
 
 // settings
 const unsigned int SCR_WIDTH = 1920;
@@ -32,16 +43,20 @@ bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-//cube movement
-float forwardCube = 0.0f;
-float leftCube = 0.0f;
+//cube movement, in units per second
+const float CRATE_SPEED = 3.0f;
+glm::vec3 crateVelocity(0.0f);
+
+// boxes dropped into the scene by each press of B, to load the dynamics
+const unsigned int STRESS_BOXES = 1000;
 
 int main()
 {
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	// 4.3 for the GPU driven path where the driver has it, the rest only needs 3.3
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -53,6 +68,12 @@ int main()
 														 // --------------------
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "GPS", glfwGetPrimaryMonitor(), NULL);
 	if (window == NULL)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "GPS", glfwGetPrimaryMonitor(), NULL);
+	}
+	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
 		glfwTerminate();
@@ -74,6 +95,38 @@ int main()
 		return -1;
 	}
 
+	// load the scene and start loading its models
+	// --------------------------------------------
+	// the imports and texture decodes all run on the worker pool while the shaders compile,
+	// only the GL uploads happen on this thread
+	Scene scene;
+	if (!scene.Load("scenes/demo.scene"))
+	{
+		glfwTerminate();
+		return -1;
+	}
+	// models of collision nodes are imported with their triangle BVH
+	vector<unsigned int> modelUsage(scene.modelPaths.size(), MESH_USAGE_DRAW);
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+		if (scene.models[i] >= 0 && (scene.flags[i] & SCENE_NODE_COLLISION))
+			modelUsage[scene.models[i]] |= MESH_USAGE_COLLISION;
+	vector<future<ModelData>> modelData;
+	for (unsigned int i = 0; i < scene.modelPaths.size(); i++)
+		modelData.push_back(Model::LoadAsync(scene.modelPaths[i], modelUsage[i]));
+
+	// the nodes the program moves
+	int lampNode = scene.find("lamp");
+	int falconOrbitNode = scene.find("falconOrbit");
+	int cubeNode = scene.find("cube");
+	int cube2Node = scene.find("cube2");
+	int cube3Node = scene.find("cube3");
+	if (lampNode < 0 || falconOrbitNode < 0 || cubeNode < 0 || cube2Node < 0 || cube3Node < 0)
+	{
+		std::cout << "ERROR::SCENE::MISSING_NODE the scene needs lamp, falconOrbit, cube, cube2 and cube3" << std::endl;
+		glfwTerminate();
+		return -1;
+	}
+
 	// configure global opengl state
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
@@ -81,22 +134,111 @@ int main()
 	// build and compile shaders
 	// -------------------------
 	Shader ourShader("shaders/model.vert", "shaders/model.frag");
+	Shader ourShaderInstanced("shaders/model.vert", "shaders/model.frag", "#define INSTANCED\n");
 	Shader cubeShader("shaders/cube.vert", "shaders/cube.frag");
+	Shader cubeShaderInstanced("shaders/cube.vert", "shaders/cube.frag", "#define INSTANCED\n");
 	Shader cubeShader2("shaders/cube2.vert", "shaders/cube2.frag");
 	Shader skyboxShader("shaders/skybox.vert", "shaders/skybox.frag");
 	Shader lamp("shaders/lamp.vert", "shaders/lamp.frag");
+	Shader ourShaderIndirect("shaders/model.vert", "shaders/model.frag", "#define INSTANCED\n#define INDIRECT\n");
+	Material::BindSamplers(ourShader);
+	Material::BindSamplers(ourShaderInstanced);
+	Material::BindSamplers(ourShaderIndirect);
+
+	// the shaders scene nodes ask for by name; instanced nodes always use ourShaderInstanced
+	vector<const Shader*> sceneShaders;
+	for (unsigned int i = 0; i < scene.shaderNames.size(); i++)
+		sceneShaders.push_back(scene.shaderNames[i] == "lamp" ? &lamp : &ourShader);
+
+	// camera and lights, shared by all the shaders above through their uniform blocks
+	FrameUniforms frameUniforms;
+	FrameData frame;
+	LightData lights = LightData();
+	lights.light.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
+	lights.light.diffuse = glm::vec3(0.5f, 0.5f, 0.5f);
+	lights.light.specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	lights.light.constant = 1.0f;
+	lights.light.linear = 0.09f;
+	lights.light.quadratic = 0.032f;
+	lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.dirLight.ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+	lights.dirLight.diffuse = glm::vec3(0.6f, 0.6f, 0.6f);
+	lights.dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+
+	// beyond their switch distance the static cells baked by tools/hlod_build are drawn as one
+	// proxy each instead of their nodes, which leave the octree, the GPU driven renderer and
+	// the instances meanwhile; H switches the proxies off and on
+	HlodSet hlod;
+	hlod.Load("scenes/demo.scene", scene);
+	bool hlodKeyDown = false;
+
+	// small static nodes drawn with the model shader are merged into world space batches by
+	// material while the imported vertices are still at hand, then the models take them over
+	// and create their GL objects
+	vector<ModelData> imported;
+	for (unsigned int i = 0; i < modelData.size(); i++)
+		imported.push_back(modelData[i].get());
+	vector<uint8_t> batchable(scene.nodeCount(), 0);
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+		batchable[i] = scene.models[i] >= 0 && !(scene.flags[i] & (SCENE_NODE_DYNAMIC | SCENE_NODE_WIREFRAME)) && sceneShaders[scene.shaders[i]] == &ourShader;
+	StaticBatches staticBatches;
+	staticBatches.build(scene, imported, batchable, hlod);
+	const vector<uint8_t> &batched = staticBatches.batched();
+	vector<Model> models;
+	models.reserve(imported.size());
+	for (unsigned int i = 0; i < imported.size(); i++)
+		models.emplace_back(std::move(imported[i]), false, VERTEX_LAYOUT_COMPACT, modelUsage[i]);
+
+	// by node, left out of the octree, the GPU driven renderer and the instances: batched for
+	// good, or proxied while its cell is
+	vector<uint8_t> hiddenNodes(batched), hiddenModels(models.size(), 0);
+
+	// instanced nodes are uploaded once here, and again only when one of them moves
+	vector<glm::mat4> instanceTransforms;
+	for (unsigned int i = 0; i < models.size(); i++)
+	{
+		scene.instanceTransforms(i, instanceTransforms, &hiddenNodes);
+		if (!instanceTransforms.empty())
+			models[i].SetInstances(instanceTransforms);
+	}
 
-	// load models
-	// -----------
-	Model ourModel("objects/nanosuit/nanosuit.obj");
-	Model ground("objects/ground/ground.obj");
-	Model tree("objects/Tree 02/Tree.obj");
-	Model sphere("objects/sphere/webtrcc.obj");
-	Model fence("objects/fence/fenceFinal.obj");
-	Model illidan("objects/Illidan Legion/IllidanLegion.obj");
-	Model falcon("objects/falcon/Halcon_Milenario.obj");
-	Model star("objects/star/Death_Star.obj");
-	Model castle("objects/hogwarts/great_hall.obj");
+	// with OpenGL 4.3 the opaque model nodes, instanced or not, are also placed in the GPU
+	// driven renderer, which culls and draws them on the GPU while G leaves it switched on
+	GpuDrivenRenderer gpuDriven((GLADloadproc)glfwGetProcAddress, "shaders/cull.comp");
+	vector<int> gpuObjects(scene.nodeCount(), -1), gpuNodes;
+	if (gpuDriven.available())
+	{
+		for (unsigned int i = 0; i < scene.nodeCount(); i++)
+		{
+			if (scene.models[i] < 0 || batched[i])
+				continue;
+			bool instanced = (scene.flags[i] & SCENE_NODE_INSTANCED) != 0;
+			if (!instanced && ((scene.flags[i] & SCENE_NODE_WIREFRAME) || sceneShaders[scene.shaders[i]] != &ourShader))
+				continue;
+			gpuObjects[i] = gpuDriven.add(models[scene.models[i]], scene.worlds[i]);
+			gpuNodes.push_back(i);
+		}
+	}
+	else
+		std::cout << "GPU_DRIVEN:: needs OpenGL 4.3, drawing through the render queue" << std::endl;
+	bool gpuDrivenOn = gpuDriven.available();
+	bool gpuKeyDown = false;
+
+	// the other nodes with a model go into the spatial index, by node index; only the dynamic
+	// ones are looked at again when they move
+	LooseOctree octree(glm::vec3(0.0f), 64.0f);
+	vector<int> dynamicNodes, visibleNodes;
+	// by node, the level of detail each mesh of its model was drawn at last
+	vector<vector<uint8_t> > nodeLevels(scene.nodeCount());
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+	{
+		if (scene.models[i] < 0 || (scene.flags[i] & SCENE_NODE_INSTANCED) || batched[i])
+			continue;
+		nodeLevels[i].assign(models[scene.models[i]].meshes.size(), 0xff);
+		octree.insert(i, models[scene.models[i]].bounds(scene.worlds[i]));
+		if (scene.flags[i] & SCENE_NODE_DYNAMIC)
+			dynamicNodes.push_back(i);
+	}
 
 	float vertices[] = {
 		// positions          // normals           // texture coords
@@ -187,6 +329,37 @@ int main()
 		-1.0f, -1.0f,  1.0f,
 		1.0f, -1.0f,  1.0f
 	};
+	// the crates collide as what they are, twelve triangles
+	TriangleBvh crateBvh;
+	for (int i = 0; i < 36; i += 3)
+		crateBvh.addTriangle(glm::make_vec3(&vertices[i * 8]), glm::make_vec3(&vertices[(i + 1) * 8]), glm::make_vec3(&vertices[(i + 2) * 8]));
+	crateBvh.build();
+
+	// everything the camera, the player's crate and picking rays run into; collision nodes
+	// without a model are the crates
+	CollisionWorld collisionWorld;
+	vector<int> dynamicColliders;
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+	{
+		if (!(scene.flags[i] & SCENE_NODE_COLLISION))
+			continue;
+		collisionWorld.add(i, scene.models[i] >= 0 ? models[scene.models[i]].collision() : &crateBvh, scene.worlds[i]);
+		if (scene.flags[i] & SCENE_NODE_DYNAMIC)
+			dynamicColliders.push_back(i);
+	}
+	bool pickButtonDown = false;
+
+	// the player's crate and the stress boxes move on the simulation's fixed step, which runs
+	// on the worker pool; the crates stand on the ground
+	Dynamics dynamics(scene.positions[cube3Node].y - 0.5f);
+	dynamics.setStaticWorld(collisionWorld);
+	int crateBody = dynamics.addBody(scene.positions[cube3Node], glm::vec3(0.5f), 0.0f);
+	vector<int> boxBodies;
+	vector<glm::mat4> boxTransforms;
+	bool spawnKeyDown = false;
+	std::mt19937 spawnRandom(1);
+	std::uniform_real_distribution<float> spawnOffset(-1.0f, 1.0f);
+
 	//cubes VAO
 	unsigned int VBO, cubeVAO;
 	glGenVertexArrays(1, &cubeVAO);
@@ -203,6 +376,20 @@ int main()
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
 	glEnableVertexAttribArray(2);
 
+	// the stress boxes: the cube's vertices and a model matrix per box, rewritten every frame
+	unsigned int boxesVAO, boxesInstanceVBO;
+	glGenVertexArrays(1, &boxesVAO);
+	glGenBuffers(1, &boxesInstanceVBO);
+	glBindVertexArray(boxesVAO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+	glEnableVertexAttribArray(2);
+	SetInstanceAttributes(boxesInstanceVBO);
+
 	//skybox VAO
 	unsigned int skyboxVAO, skyboxVBO;
 	glGenVertexArrays(1, &skyboxVAO);
@@ -222,25 +409,39 @@ int main()
 		"textures/skybox/front.jpg"
 	};
 
-	unsigned int cubemapTexture = loadCubemap(faces);
+	TextureHandle cubemapTexture = loadCubemap(faces);
 
 	skyboxShader.use();
 	skyboxShader.setInt("skybox", 0);
 
 	//cubes 
-	unsigned int cubeDiffuse = loadTexture("textures/container2.png");
-	unsigned int cubeSpecular = loadTexture("textures/container2_specular.png");
-	unsigned int cubeDiffuse2 = loadTexture("textures/wood_box.jpg");
-	unsigned int cubeDiffuse3 = loadTexture("textures/metal_box.jpg");
+	TextureHandle cubeDiffuse = loadTexture("textures/container2.png");
+	TextureHandle cubeSpecular = loadTexture("textures/container2_specular.png");
+	TextureHandle cubeDiffuse2 = loadTexture("textures/wood_box.jpg");
+	TextureHandle cubeDiffuse3 = loadTexture("textures/metal_box.jpg");
 	
 	cubeShader.use();
 	cubeShader.setInt("material.diffuse", 0);
 	cubeShader.setInt("material.specular", 1);
+	cubeShaderInstanced.use();
+	cubeShaderInstanced.setInt("material.diffuse", 0);
+	cubeShaderInstanced.setInt("material.specular", 1);
 
 	cubeShader2.use();
 	cubeShader2.setInt("material.diffuse", 0);
 	cubeShader2.setVec3("material.specular", glm::vec3(0.4f, 0.5f, 0.4f));
 
+	// the textures of the cubes and the sky, bound to the units their samplers read
+	Material cubeMaterial(vector<Texture>{ { cubeDiffuse, "texture_diffuse", "textures/container2.png" }, { cubeSpecular, "texture_specular", "textures/container2_specular.png" } });
+	Material cubeMaterial2(vector<Texture>{ { cubeDiffuse2, "texture_diffuse", "textures/wood_box.jpg" } });
+	cubeMaterial2.shininess = 16.0f;
+	Material cubeMaterial3(vector<Texture>{ { cubeDiffuse3, "texture_diffuse", "textures/metal_box.jpg" } });
+	Material skyboxMaterial(vector<Texture>{ { cubemapTexture, "texture_diffuse", "textures/skybox" } }, GL_TEXTURE_CUBE_MAP);
+
+	// every draw of a frame goes through the queue, which culls them and orders them by state
+	RenderQueue queue;
+	bool statsKeyDown = false;
+
 	// draw in wireframe
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	// render loop
@@ -255,382 +456,253 @@ int main()
 
 		// input
 		// -----
+		glm::vec3 cameraFrom = camera.Position;
 		processInput(window);
+		// the camera slides along whatever it walks into
+		camera.Position = collisionWorld.moveSphere(cameraFrom, 0.2f, camera.Position - cameraFrom);
+
+		// hand finished texture reads to the streamer, then move finished decodes to the GL within a fixed per-frame budget
+		Textures().update();
+		TextureStream().update();
 
 		// render
 		// ------
 		glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		// move the dynamic nodes, then update the world matrices of whatever moved
 		glm::vec3 lightPos(2*sin(glfwGetTime()), 1.5f, 2*cos(glfwGetTime()));
-
-		ourShader.use();
-		ourShader.setVec3("light.position", lightPos);
-		ourShader.setVec3("viewPos", camera.Position);
-
-		ourShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-		ourShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-		ourShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-		ourShader.setFloat("light.constant", 1.0f);
-		ourShader.setFloat("light.linear", 0.09f);
-		ourShader.setFloat("light.quadratic", 0.032f);
-		ourShader.setFloat("shininess", 32.0f);
-
-		//directional light
-		ourShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		ourShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-		ourShader.setVec3("dirLight.diffuse", 0.6f, 0.6f, 0.6f);
-		ourShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-
-		// don't forget to enable shader before setting uniforms
-		ourShader.use();
-		
-		// view/projection transformations
-		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 view = camera.GetViewMatrix();
-		ourShader.setMat4("projection", projection);
-		ourShader.setMat4("view", view);
-
-		// render the loaded model
-		glm::mat4 model;
-		model = glm::translate(model, glm::vec3(0.0f, -1.75f, 0.0f)); // translate it down so it's at the center of the scene
-		model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));	// it's a bit too big for our scene, so scale it down
-		model = glm::rotate(model, 0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		
-		ourModel.Draw(ourShader);
-
-		//tree
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-5.0f, -1.75f, 0.0f)); 
-		ourShader.setMat4("model", model);
-		tree.Draw(ourShader);
-
-		//hogwarts
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(5.0f, -2.6f, -5.0f));
-		model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(-30.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-		ourShader.setMat4("model", model);
-		castle.Draw(ourShader);
-		
-
-		//illidan
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(0.0f, -1.75f, 5.0f));
-		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-		ourShader.setMat4("model", model);
-		illidan.Draw(ourShader);
-
-		//illidan wireframe
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(5.0f, -1.75f, 5.0f));
-		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-		ourShader.setMat4("model", model);
-		illidan.Draw(ourShader);
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-
-		//ground
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(0.0f, -1.75f, 0.0f));
-		ourShader.setMat4("model", model);
-		ground.Draw(ourShader);
-
-		//falcon
-		model = glm::mat4();
-		model = glm::rotate(model, -1.5f * (float)(glfwGetTime()), glm::vec3(0.0f, 1.0f, 0.0f));
-		model = glm::translate(model, glm::vec3(20.0f, 3.75f, 0.0f));
-		model = glm::scale(model, glm::vec3(0.008f, 0.008f, 0.008f));
-		ourShader.setMat4("model", model);
-		falcon.Draw(ourShader);
-
-		//death star
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(40.0f, 5.75f, -30.0f));
-		model = glm::rotate(model, glm::radians(60.0f), glm::vec3(-0.5f, 0.0f, 1.0f));
-		model = glm::scale(model, glm::vec3(3.0f, 3.0f, 3.0f));
-		ourShader.setMat4("model", model);
-		star.Draw(ourShader);
-
-		//fences
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(10.5f, -1.25f, 6.5f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(10.5f, -1.25f, 2.75f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(10.5f, -1.25f, -1.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(10.5f, -1.25f, -4.75f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(10.5f, -1.25f, -8.5f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(9.0f, -1.25f, -9.0f));
-		model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(5.25f, -1.25f, -9.0f));
-		model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(1.5f, -1.25f, -9.0f));
-		model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-2.25f, -1.25f, -9.0f));
-		model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-6.0f, -1.25f, -9.0f));
-		model = glm::rotate(model, (float)glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-10.5f, -1.25f, -6.5f));
-		model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-10.5f, -1.25f, -2.75f));
-		model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-10.5f, -1.25f, 1.0f));
-		model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-10.5f, -1.25f, 4.75f));
-		model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-10.5f, -1.25f, 8.5f));
-		model = glm::rotate(model, (float)glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-9.5f, -1.25f, 9.0f));
-		model = glm::rotate(model, (float)glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-5.75f, -1.25f, 9.0f));
-		model = glm::rotate(model, (float)glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(-2.0f, -1.25f, 9.0f));
-		model = glm::rotate(model, (float)glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(1.75f, -1.25f, 9.0f));
-		model = glm::rotate(model, (float)glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
-
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(5.5f, -1.25f, 9.0f));
-		model = glm::rotate(model, (float)glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-		ourShader.setMat4("model", model);
-		fence.Draw(ourShader);
+		scene.setPosition(lampNode, lightPos);
+		scene.setRotation(falconOrbitNode, glm::angleAxis(-1.5f * (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f)));
+		scene.setRotation(cube2Node, glm::angleAxis((float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f)));
+		// B drops more boxes over the scene
+		bool spawnKey = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+		if (spawnKey && !spawnKeyDown)
+		{
+			for (unsigned int i = 0; i < STRESS_BOXES; i++)
+			{
+				glm::vec3 position(spawnOffset(spawnRandom) * 9.0f, 4.0f + (spawnOffset(spawnRandom) + 1.0f) * 8.0f, spawnOffset(spawnRandom) * 8.0f);
+				glm::vec3 velocity(spawnOffset(spawnRandom), 0.0f, spawnOffset(spawnRandom));
+				boxBodies.push_back(dynamics.addBody(position, glm::vec3(0.2f), 1.0f, velocity));
+			}
+			std::cout << "DYNAMICS:: " << dynamics.bodyCount() << " bodies" << std::endl;
+		}
+		spawnKeyDown = spawnKey;
+		// G switches between the GPU driven path and the render queue
+		bool gpuKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+		if (gpuKey && !gpuKeyDown && gpuDriven.available())
+		{
+			gpuDrivenOn = !gpuDrivenOn;
+			std::cout << "GPU_DRIVEN:: " << (gpuDrivenOn ? "on" : "off") << std::endl;
+		}
+		gpuKeyDown = gpuKey;
+		// H switches the proxies off and on
+		bool hlodKey = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+		if (hlodKey && !hlodKeyDown && hlod.cellCount())
+		{
+			hlod.setEnabled(!hlod.isEnabled());
+			std::cout << "HLOD:: " << (hlod.isEnabled() ? "on" : "off") << std::endl;
+		}
+		hlodKeyDown = hlodKey;
+
+		// the simulation moves the player's crate by the keys' speed, sliding along what it hits,
+		// and is drawn where it was between two of its steps
+		dynamics.setVelocity(crateBody, crateVelocity);
+		dynamics.update(deltaTime);
+		scene.setPosition(cube3Node, dynamics.position(crateBody));
+		scene.updateTransforms();
+		bool collidersMoved = false;
+		for (unsigned int i = 0; i < dynamicColliders.size(); i++)
+		{
+			if (scene.moved(dynamicColliders[i]))
+			{
+				collisionWorld.setTransform(dynamicColliders[i], scene.worlds[dynamicColliders[i]]);
+				collidersMoved = true;
+			}
+		}
+		if (collidersMoved)
+			dynamics.setStaticWorld(collisionWorld);
+		// the nodes of cells that switched between their nodes and their proxy
+		if (hlod.update(camera.Position))
+		{
+			const vector<uint8_t> &proxied = hlod.proxiedNodes();
+			for (unsigned int i = 0; i < scene.nodeCount(); i++)
+			{
+				// the batches follow their cell by themselves
+				if (batched[i] || hiddenNodes[i] == proxied[i])
+					continue;
+				hiddenNodes[i] = proxied[i];
+				if (scene.flags[i] & SCENE_NODE_INSTANCED)
+					hiddenModels[scene.models[i]] = 1;
+				else if (proxied[i])
+					octree.remove(i);
+				else
+				{
+					nodeLevels[i].assign(nodeLevels[i].size(), 0xff);
+					octree.insert(i, models[scene.models[i]].bounds(scene.worlds[i]));
+				}
+				if (gpuObjects[i] >= 0)
+					gpuDriven.setHidden(gpuObjects[i], proxied[i] != 0);
+			}
+		}
+		for (unsigned int i = 0; i < models.size(); i++)
+		{
+			if (scene.instancesMoved(i) || hiddenModels[i])
+			{
+				scene.instanceTransforms(i, instanceTransforms, &hiddenNodes);
+				models[i].SetInstances(instanceTransforms);
+				hiddenModels[i] = 0;
+			}
+		}
+		for (unsigned int i = 0; i < dynamicNodes.size(); i++)
+		{
+			int node = dynamicNodes[i];
+			if (scene.moved(node))
+				octree.update(node, models[scene.models[node]].bounds(scene.worlds[node]));
+		}
+		for (unsigned int i = 0; i < gpuNodes.size(); i++)
+			if (scene.moved(gpuNodes[i]))
+				gpuDriven.setTransform(gpuObjects[gpuNodes[i]], scene.worlds[gpuNodes[i]]);
+
+		// view/projection transformations and the lights, uploaded once for every shader
+		frame.projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		frame.view = camera.GetViewMatrix();
+		frame.viewPos = camera.Position;
+		lights.light.position = lightPos;
+		frameUniforms.update(frame, lights);
+		queue.setView(camera.Position, 100.0f);
+		float projectionScale = SCR_HEIGHT / (2.0f * tan(glm::radians(camera.Zoom) / 2.0f));
+		queue.setProjectionScale(projectionScale);
+		Frustum frustum = Frustum::FromMatrix(frame.projection * frame.view);
+		queue.setFrustum(frustum);
+
+		// the models of the scene that are in view
+		octree.cull(frustum, visibleNodes);
+		for (unsigned int n = 0; n < visibleNodes.size(); n++)
+		{
+			int i = visibleNodes[n];
+			if (gpuDrivenOn && gpuObjects[i] >= 0)
+				continue;
+			int model = scene.models[i];
+			RenderPass pass = (scene.flags[i] & SCENE_NODE_WIREFRAME) ? RENDER_PASS_WIREFRAME : RENDER_PASS_OPAQUE;
+			models[model].Submit(queue, *sceneShaders[scene.shaders[i]], scene.worlds[i], pass, nodeLevels[i].data());
+		}
+		if (gpuDrivenOn)
+			gpuDriven.render(ourShaderIndirect, frustum, camera.Position, projectionScale);
+		else
+		{
+			for (unsigned int i = 0; i < models.size(); i++)
+				models[i].SubmitInstances(queue, ourShaderInstanced);
+		}
+		staticBatches.Submit(queue, ourShader, hlod);
+		hlod.Submit(queue, ourShader);
 
 		//cubes
-		cubeShader.use();
-		cubeShader.setVec3("light.position", lightPos);
-		cubeShader.setVec3("viewPos", camera.Position);
-		cubeShader.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-		cubeShader.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-		cubeShader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-		cubeShader.setFloat("light.constant", 1.0f);
-		cubeShader.setFloat("light.linear", 0.09f);
-		cubeShader.setFloat("light.quadratic", 0.032f);
-
-		cubeShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		cubeShader.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-		cubeShader.setVec3("dirLight.diffuse", 0.6f, 0.6f, 0.6f);
-		cubeShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-
-		// material properties
-		cubeShader.setFloat("material.shininess", 32.0f);
-
-		glm::mat4 projectionCube = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 viewCube = camera.GetViewMatrix();
-		cubeShader.setMat4("projection", projectionCube);
-		cubeShader.setMat4("view", viewCube);
-
-		// world transformation
-		glm::mat4 modelCube;
-		modelCube = glm::translate(modelCube, glm::vec3(2.0f, -1.25f, 0.0f));
-		cubeShader.setMat4("model", modelCube);
-
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, cubeDiffuse);
-		// bind specular map
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, cubeSpecular);
-
-		glBindVertexArray(cubeVAO);
-
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		DrawItem cube;
+		cube.shader = &cubeShader;
+		cube.material = &cubeMaterial;
+		cube.format = NULL;
+		cube.vao = cubeVAO;
+		cube.indexType = 0;
+		cube.count = 36;
+		cube.instanceCount = 0;
+
+		// world transformation; the crates are unit cubes, 0.87 is the radius of the sphere around one
+		cube.model = scene.worlds[cubeNode];
+		queue.submit(RENDER_PASS_OPAQUE, cube, TransformBounds(cube.model, glm::vec3(-0.5f), glm::vec3(0.5f), 0.87f));
+
 		//cube 2
-		
-		cubeShader2.use();
-		cubeShader2.setVec3("light.position", lightPos);
-		cubeShader2.setVec3("viewPos", camera.Position);
-		cubeShader2.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-		cubeShader2.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-		cubeShader2.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-		cubeShader2.setFloat("light.constant", 1.0f);
-		cubeShader2.setFloat("light.linear", 0.09f);
-		cubeShader2.setFloat("light.quadratic", 0.032f);
-
-		cubeShader2.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		cubeShader2.setVec3("dirLight.ambient", 0.05f, 0.05f, 0.05f);
-		cubeShader2.setVec3("dirLight.diffuse", 0.6f, 0.6f, 0.6f);
-		cubeShader2.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-		// material properties
-		cubeShader2.setFloat("material.shininess", 16.0f);
-
-		glm::mat4 projectionCube2 = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 viewCube2 = camera.GetViewMatrix();
-		cubeShader2.setMat4("projection", projectionCube2);
-		cubeShader2.setMat4("view", viewCube2);
-
-		// world transformation
-		glm::mat4 modelCube2;
-		modelCube2 = glm::translate(modelCube2, glm::vec3(2.0f, -1.25f, 2.0f));
-		modelCube2 = glm::rotate(modelCube2, (float)(glfwGetTime()), glm::vec3(0.0f,1.0f,0.0f));
-		cubeShader2.setMat4("model", modelCube2);
-
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, cubeDiffuse2);
-
-		glBindVertexArray(cubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		cube.shader = &cubeShader2;
+		cube.material = &cubeMaterial2;
+		cube.model = scene.worlds[cube2Node];
+		queue.submit(RENDER_PASS_OPAQUE, cube, TransformBounds(cube.model, glm::vec3(-0.5f), glm::vec3(0.5f), 0.87f));
 
 		//cube 3
+		cube.material = &cubeMaterial3;
+		cube.model = scene.worlds[cube3Node];
+		queue.submit(RENDER_PASS_OPAQUE, cube, TransformBounds(cube.model, glm::vec3(-0.5f), glm::vec3(0.5f), 0.87f));
 
-		cubeShader2.use();
-		cubeShader2.setVec3("light.position", lightPos);
-		cubeShader2.setVec3("viewPos", camera.Position);
-		cubeShader2.setVec3("light.ambient", 0.2f, 0.2f, 0.2f);
-		cubeShader2.setVec3("light.diffuse", 0.5f, 0.5f, 0.5f);
-		cubeShader2.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-		cubeShader2.setFloat("light.constant", 1.0f);
-		cubeShader2.setFloat("light.linear", 0.09f);
-		cubeShader2.setFloat("light.quadratic", 0.032f);
-
-		// material properties
-		cubeShader2.setFloat("material.shininess", 32.0f);
-
-		glm::mat4 projectionCube3 = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 viewCube3 = camera.GetViewMatrix();
-		cubeShader2.setMat4("projection", projectionCube3);
-		cubeShader2.setMat4("view", viewCube3);
-
-		// world transformation
-		glm::mat4 modelCube3;
-		modelCube3 = glm::translate(modelCube3, glm::vec3(leftCube, -1.25f, forwardCube));
-
-		//collision detection
-		if (leftCube > 1.0f  &&
-			leftCube < 3.0f &&
-			forwardCube > 1.0f &&
-			forwardCube < 3.0f) {
-			leftCube = -2.0f;
-			forwardCube = 0.0;
-		}
-		if (leftCube > 1.0f  &&
-			leftCube < 3.0f &&
-			forwardCube > -1.0f &&
-			forwardCube < 1.0f) {
-			leftCube = -2.0f;
-			forwardCube = 0.0;
+		// the stress boxes, one instanced draw
+		if (!boxBodies.empty())
+		{
+			boxTransforms.resize(boxBodies.size());
+			glm::vec3 boxesMin(FLT_MAX), boxesMax(-FLT_MAX);
+			for (unsigned int i = 0; i < boxBodies.size(); i++)
+			{
+				glm::vec3 position = dynamics.position(boxBodies[i]), extents = dynamics.halfExtents(boxBodies[i]);
+				boxTransforms[i] = glm::scale(glm::translate(glm::mat4(), position), extents * 2.0f);
+				boxesMin = glm::min(boxesMin, position - extents);
+				boxesMax = glm::max(boxesMax, position + extents);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, boxesInstanceVBO);
+			glBufferData(GL_ARRAY_BUFFER, boxTransforms.size() * sizeof(glm::mat4), boxTransforms.data(), GL_STREAM_DRAW);
+			cube.shader = &cubeShaderInstanced;
+			cube.material = &cubeMaterial;
+			cube.vao = boxesVAO;
+			cube.instanceCount = (GLsizei)boxTransforms.size();
+			cube.model = glm::mat4();
+			queue.submit(RENDER_PASS_OPAQUE, cube, TransformBounds(cube.model, boxesMin, boxesMax, glm::length(boxesMax - boxesMin) * 0.5f));
 		}
-		if (leftCube > -0.5f  &&
-			leftCube < 0.5f &&
-			forwardCube > -0.5f &&
-			forwardCube < 0.5f) {
-			leftCube = -2.0f;
-			forwardCube = 0.0;
+
+		//skybox
+		DrawItem sky;
+		sky.shader = &skyboxShader;
+		sky.material = &skyboxMaterial;
+		sky.format = NULL;
+		sky.vao = skyboxVAO;
+		sky.indexType = 0;
+		sky.count = 36;
+		sky.instanceCount = 0;
+		sky.model = glm::mat4();
+		queue.submit(RENDER_PASS_SKY, sky, camera.Position);
+
+		queue.execute();
+
+		// F1 prints what the frame drew and what it culled
+		bool statsKey = glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS;
+		if (statsKey && !statsKeyDown)
+		{
+			const OctreeCullStats &octreeStats = octree.lastCullStats();
+			std::cout << "OCTREE:: " << octreeStats.visible << " nodes in view, " << octreeStats.nodesVisited << " octree nodes visited, "
+				<< octreeStats.itemsTested << " nodes tested" << std::endl;
+			const RenderQueueStats &stats = queue.lastStats();
+			std::cout << "RENDER_QUEUE:: " << stats.submitted << " draws submitted, " << stats.culled << " culled, " << stats.draws << " drawn; "
+				<< stats.instances << " instances in view, " << stats.culledInstances << " culled, " << stats.triangles << " triangles" << std::endl;
+			const DynamicsStats &dynamicsStats = dynamics.lastStats();
+			std::cout << "DYNAMICS:: " << dynamicsStats.bodies << " bodies, " << dynamicsStats.steps << " steps in " << dynamicsStats.milliseconds << " ms, "
+				<< dynamicsStats.pairs << " pairs, " << dynamicsStats.contacts << " contacts, " << dynamicsStats.swaps << " sort swaps, "
+				<< dynamicsStats.busyFrames << " frames without waiting for a step" << std::endl;
+			GeometryPoolStats geometryStats = Geometry().stats();
+			std::cout << "GEOMETRY:: " << geometryStats.pools << " pools, vertices " << geometryStats.vertexBytes / 1024 << " of " << geometryStats.vertexCapacity / 1024
+				<< " KB, indices " << geometryStats.indexBytes / 1024 << " of " << geometryStats.indexCapacity / 1024 << " KB, " << geometryStats.freeRanges << " free ranges" << std::endl;
+			if (gpuDrivenOn)
+			{
+				const GpuDrivenStats &gpuStats = gpuDriven.lastStats();
+				unsigned int gpuVisible, gpuTriangles;
+				gpuDriven.countVisible(gpuVisible, gpuTriangles);
+				std::cout << "GPU_DRIVEN:: " << gpuStats.objects << " objects, " << gpuStats.records << " meshes placed, " << gpuVisible << " in view, "
+					<< gpuTriangles << " triangles, " << gpuStats.commands << " commands in " << gpuStats.multiDraws << " multi draws" << std::endl;
+			}
+			const StaticBatchStats &batchStats = staticBatches.lastStats();
+			if (batchStats.batches)
+				std::cout << "STATIC_BATCH:: " << batchStats.batches << " batches for " << batchStats.meshes << " meshes of " << batchStats.nodes << " nodes" << std::endl;
+			if (hlod.cellCount())
+			{
+				const HlodStats &hlodStats = hlod.lastStats();
+				std::cout << "HLOD:: " << hlodStats.proxies << " of " << hlodStats.cells << " cells drawn as proxies, standing in for " << hlodStats.nodes << " nodes" << std::endl;
+			}
 		}
-		if (leftCube > -4.5f  &&
-			leftCube < -3.5f &&
-			forwardCube > -0.3f &&
-			forwardCube < 0.3f) {
-			leftCube = -2.0f;
-			forwardCube = 0.0;
+		statsKeyDown = statsKey;
+
+		// the left mouse button picks what is under the crosshair
+		bool pickButton = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		if (pickButton && !pickButtonDown)
+		{
+			CollisionHit hit;
+			if (collisionWorld.raycast(camera.Position, camera.Front, 100.0f, hit))
+				std::cout << "PICK:: " << scene.names[hit.id] << " at " << hit.t << std::endl;
 		}
-		cubeShader2.setMat4("model", modelCube3);
-		
-		// bind diffuse map
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, cubeDiffuse3);
-
-		glBindVertexArray(cubeVAO);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-
-		//sphere
-		lamp.use();
-		lamp.setMat4("projection", projection);
-		lamp.setMat4("view", view);
-		model = glm::mat4();
-		model = glm::translate(model, glm::vec3(2 * sin(glfwGetTime()), 1.5f, 2 * cos(glfwGetTime())));
-		model = glm::scale(model, glm::vec3(0.5f, 0.5f, 0.5f));
-		lamp.setMat4("model", model);
-		sphere.Draw(lamp);
-
-		//draw skybox
-		glDepthFunc(GL_LEQUAL);
-		skyboxShader.use();
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-		skyboxShader.setMat4("view", view);
-		skyboxShader.setMat4("projection", projection);
-
-		glBindVertexArray(skyboxVAO);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LESS);
+		pickButtonDown = pickButton;
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
@@ -638,10 +710,20 @@ int main()
 		glfwPollEvents();
 	}
 
+	dynamics.finish();
+	// the models delete their instance buffers, which needs the context
+	models.clear();
 	glDeleteVertexArrays(1, &cubeVAO);
+	glDeleteVertexArrays(1, &boxesVAO);
+	glDeleteBuffers(1, &boxesInstanceVBO);
 	glDeleteVertexArrays(1, &skyboxVAO);
 	glDeleteBuffers(1, &skyboxVBO);
 	glDeleteBuffers(1, &VBO);
+	frameUniforms.shutdown();
+	Textures().shutdown();
+	TextureStream().shutdown();
+	gpuDriven.shutdown();
+	Geometry().shutdown();
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
@@ -665,14 +747,15 @@ void processInput(GLFWwindow *window)
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
 		camera.ProcessKeyboard(RIGHT, 2*deltaTime);
 
+	crateVelocity = glm::vec3(0.0f);
 	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
-		forwardCube += 0.05f;
+		crateVelocity.z += CRATE_SPEED;
 	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
-		forwardCube -= 0.05f;
+		crateVelocity.z -= CRATE_SPEED;
 	if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
-		leftCube -= 0.05f;
+		crateVelocity.x -= CRATE_SPEED;
 	if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
-		leftCube += 0.05f;
+		crateVelocity.x += CRATE_SPEED;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -711,41 +794,10 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	camera.ProcessMouseScroll(yoffset);
 }
 
-unsigned int loadTexture(char const * path)
+// returns a handle from the shared texture manager immediately, the image itself is streamed in over the next frames
+TextureHandle loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return Textures().acquire(path);
 }
 
 // loads a cubemap texture from 6 individual texture faces
@@ -757,32 +809,7 @@ unsigned int loadTexture(char const * path)
 // +Z (front) 
 // -Z (back)
 // -------------------------------------------------------
-unsigned int loadCubemap(vector<std::string> faces)
+TextureHandle loadCubemap(vector<std::string> faces)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
-	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	return textureID;
+	return Textures().acquireCubemap(faces);
 }
\ No newline at end of file
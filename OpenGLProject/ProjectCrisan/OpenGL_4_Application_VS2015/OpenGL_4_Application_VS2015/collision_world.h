@@ -0,0 +1,185 @@
+#ifndef COLLISION_WORLD_H
+#define COLLISION_WORLD_H
+
+#include "glm/glm.hpp"
+
+#include "frustum.h"
+#include "triangle_bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <vector>
+using namespace std;
+
+// the first contact of a world space query
+struct CollisionHit {
+	float t;			// how far along the ray or motion, in units of its direction vector
+	glm::vec3 normal;	// world space, unit length, pointing back towards the ray origin or the sphere
+	int id;				// of the instance that was hit
+};
+
+// how far moveSphere() keeps a sphere from what it touched, so the next sweep does not start inside it
+const float COLLISION_SKIN = 0.001f;
+
+// Placed copies of triangle BVHs (e.g. Model::collision()) answering queries in world space.
+// Every query is moved into the model space of each instance whose world box it can reach and
+// answered by the instance's BVH there, so a model shares one tree among all its copies.
+// Sphere sweeps assume the instances are scaled uniformly.
+class CollisionWorld
+{
+public:
+	// adds an instance of bvh (not owned) placed by transform; id is the caller's, e.g. a scene node index
+	void add(int id, const TriangleBvh *bvh, const glm::mat4 &transform)
+	{
+		if (!bvh || bvh->empty())
+			return;
+		byId[id] = instances.size();
+		instances.push_back(Instance());
+		instances.back().id = id;
+		instances.back().bvh = bvh;
+		place(instances.back(), transform);
+	}
+
+	// moves the instance id
+	void setTransform(int id, const glm::mat4 &transform)
+	{
+		map<int, size_t>::const_iterator it = byId.find(id);
+		if (it != byId.end())
+			place(instances[it->second], transform);
+	}
+
+	// the first hit along origin + t * direction with t in [0, maxT]
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, CollisionHit &hit) const
+	{
+		return sweep(origin, 0.0f, direction, maxT, hit);
+	}
+
+	// the first hit on the segment from start to end; hit.t is the fraction of the way
+	bool segment(const glm::vec3 &start, const glm::vec3 &end, CollisionHit &hit) const
+	{
+		return sweep(start, 0.0f, end - start, 1.0f, hit);
+	}
+
+	// the first contact of a sphere moving from center to center + motion; hit.t is the fraction of the motion
+	bool sweepSphere(const glm::vec3 &center, float radius, const glm::vec3 &motion, CollisionHit &hit) const
+	{
+		return sweep(center, radius, motion, 1.0f, hit);
+	}
+
+	// the ids of the instances with a triangle inside the box
+	void overlapBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax, vector<int> &ids) const
+	{
+		ids.clear();
+		glm::vec3 center = (boxMin + boxMax) * 0.5f, extents = (boxMax - boxMin) * 0.5f;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			const Instance &instance = instances[i];
+			if (glm::any(glm::greaterThan(instance.worldMin, boxMax)) || glm::any(glm::lessThan(instance.worldMax, boxMin)))
+				continue;
+			// the box seen from the model is rotated: find candidates with its model space
+			// bounds, then test them exactly in world space
+			Bounds local = TransformBounds(instance.inverse, boxMin, boxMax, 0.0f);
+			bool overlap = false;
+			instance.bvh->forEachTriangle(local.center - local.extents, local.center + local.extents, [&](uint32_t t) {
+				if (overlap)
+					return;
+				const BvhTriangle &triangle = instance.bvh->triangles()[t];
+				BvhTriangle world = {
+					glm::vec3(instance.transform * glm::vec4(triangle.v0, 1.0f)),
+					glm::vec3(instance.transform * glm::vec4(triangle.v1, 1.0f)),
+					glm::vec3(instance.transform * glm::vec4(triangle.v2, 1.0f))
+				};
+				overlap = TriangleBvh::TriangleOverlapsBox(world, center, extents);
+			});
+			if (overlap)
+				ids.push_back(instance.id);
+		}
+	}
+
+	// where a sphere moving by motion from center ends up when it slides along what it runs
+	// into, at most iterations contacts deep
+	glm::vec3 moveSphere(const glm::vec3 &center, float radius, const glm::vec3 &motion, int iterations = 3) const
+	{
+		glm::vec3 position = center, remaining = motion;
+		for (int i = 0; i < iterations && glm::dot(remaining, remaining) > 1e-12f; i++)
+		{
+			CollisionHit hit;
+			if (!sweepSphere(position, radius, remaining, hit))
+				return position + remaining;
+			// up to the contact, then the rest of the way along the surface
+			position += remaining * hit.t + hit.normal * COLLISION_SKIN;
+			remaining *= 1.0f - hit.t;
+			remaining -= hit.normal * glm::dot(remaining, hit.normal);
+		}
+		return position;
+	}
+
+private:
+	struct Instance {
+		int id;
+		const TriangleBvh *bvh;
+		glm::mat4 transform, inverse;
+		glm::mat3 normalMatrix;
+		float scale;				// uniform scale of transform, for sphere radii
+		glm::vec3 worldMin, worldMax;
+	};
+
+	vector<Instance> instances;
+	map<int, size_t> byId;
+
+	static void place(Instance &instance, const glm::mat4 &transform)
+	{
+		instance.transform = transform;
+		instance.inverse = glm::inverse(transform);
+		instance.normalMatrix = glm::transpose(glm::mat3(instance.inverse));
+		instance.scale = glm::length(glm::vec3(transform[0]));
+		Bounds world = TransformBounds(transform, instance.bvh->boundsMin(), instance.bvh->boundsMax(), 0.0f);
+		instance.worldMin = world.center - world.extents;
+		instance.worldMax = world.center + world.extents;
+	}
+
+	// rays are spheres of radius 0; the motion is taken into model space as a direction, which
+	// keeps t the same in both spaces
+	bool sweep(const glm::vec3 &origin, float radius, const glm::vec3 &motion, float maxT, CollisionHit &hit) const
+	{
+		hit.t = maxT;
+		bool found = false;
+		glm::vec3 inverseMotion;
+		for (int i = 0; i < 3; i++)
+			inverseMotion[i] = motion[i] != 0.0f ? 1.0f / motion[i] : FLT_MAX;
+		for (size_t i = 0; i < instances.size(); i++)
+		{
+			const Instance &instance = instances[i];
+			// the instance's world box, grown by the radius, has to be on the way
+			glm::vec3 t0 = (instance.worldMin - radius - origin) * inverseMotion;
+			glm::vec3 t1 = (instance.worldMax + radius - origin) * inverseMotion;
+			glm::vec3 nearT = glm::min(t0, t1), farT = glm::max(t0, t1);
+			if (max(max(nearT.x, nearT.y), max(nearT.z, 0.0f)) > min(min(farT.x, farT.y), min(farT.z, hit.t)))
+				continue;
+
+			glm::vec3 localOrigin(instance.inverse * glm::vec4(origin, 1.0f));
+			glm::vec3 localMotion(instance.inverse * glm::vec4(motion, 0.0f));
+			TriangleHit local;
+			bool hitInstance;
+			if (radius > 0.0f)
+			{
+				// the tree sweeps the whole motion it is given, so give it only the part before the best hit so far
+				hitInstance = instance.bvh->sweepSphere(localOrigin, radius / instance.scale, localMotion * hit.t, local);
+				local.t *= hit.t;
+			}
+			else
+				hitInstance = instance.bvh->raycast(localOrigin, localMotion, hit.t, local);
+			if (hitInstance && local.t <= hit.t)
+			{
+				hit.t = local.t;
+				hit.normal = glm::normalize(instance.normalMatrix * local.normal);
+				hit.id = instance.id;
+				found = true;
+			}
+		}
+		return found;
+	}
+};
+#endif
@@ -0,0 +1,445 @@
+#ifndef DYNAMICS_H
+#define DYNAMICS_H
+
+#include "glm/glm.hpp"
+
+#include "collision_world.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// what the last finished simulation job did
+struct DynamicsStats {
+	unsigned int bodies;
+	unsigned int steps;			// fixed steps the job took
+	unsigned int pairs;			// overlapping boxes the broadphase found in the job's last step
+	unsigned int contacts;		// of those, the pairs that still overlapped and were pushed apart
+	unsigned int swaps;			// moves of the insertion sort in the last step, small while the bodies move coherently
+	unsigned int busyFrames;	// update() calls so far that found a job still running and went on without it
+	float milliseconds;			// the job's time on the worker pool
+};
+
+// bodies a chunk of the parallel work gets at least, fewer are not worth a job
+const size_t DYNAMICS_MIN_CHUNK = 256;
+// of the speed along a contact normal, how much bounces back
+const float DYNAMICS_RESTITUTION = 0.2f;
+// how quickly bodies on the ground slow down, per second
+const float DYNAMICS_GROUND_FRICTION = 2.0f;
+
+// Boxes moved by a simulation that runs at a fixed step on the worker pool, apart from the
+// frame rate. update() hands the elapsed time to the simulation without ever waiting for it:
+// a job advances a private copy of the bodies by whole steps, and the first update() after
+// it finished publishes their positions. position() interpolates between the published steps
+// two steps behind the simulation clock, the lag that lets a job finish before its steps are
+// needed on screen.
+//
+// Bodies are axis aligned boxes that do not rotate. The broadphase sweeps and prunes along x:
+// the boxes stay sorted by their lower x from step to step, so the insertion sort only moves
+// the few that passed each other, and the scan for overlapping pairs is split across the
+// workers. Overlapping boxes are pushed apart along the axis they overlap least. Against the
+// static world a body is swept as the sphere inside its box, as the camera is, and a ground
+// plane catches whatever falls past everything else.
+class Dynamics
+{
+public:
+	// a simulation stepping stepTime seconds at a time; at most maxSteps are taken for one
+	// frame, the time of a longer frame is dropped rather than caught up with
+	Dynamics(float groundHeight, float stepTime = 1.0f / 60.0f, unsigned int maxSteps = 4)
+		: groundHeight(groundHeight), stepTime(stepTime), maxSteps(maxSteps), gravity(0.0f, -9.81f, 0.0f),
+		accumulator(0.0f), launchedStep(0), worldChanged(false),
+		newest(0), snapshotCount(1), from(0), to(0), alpha(0.0f), bodiesAdded(false)
+	{
+		memset(&stats, 0, sizeof(stats));
+		memset(&jobStats, 0, sizeof(jobStats));
+		snapshotSteps[0] = 0;
+	}
+
+	~Dynamics() { finish(); }
+
+	Dynamics(const Dynamics&) = delete;
+	Dynamics& operator=(const Dynamics&) = delete;
+
+	// adds a box centered at position; mass 0 makes a kinematic body, moved only by its
+	// velocity and never pushed. It takes part from the next job on; returns its index.
+	int addBody(const glm::vec3 &position, const glm::vec3 &halfExtents, float mass, const glm::vec3 &velocity = glm::vec3(0.0f))
+	{
+		Body body;
+		body.position = position;
+		body.halfExtents = halfExtents;
+		body.inverseMass = mass > 0.0f ? 1.0f / mass : 0.0f;
+		body.velocity = velocity;
+		pendingBodies.push_back(body);
+		spawnPositions.push_back(position);
+		extents.push_back(halfExtents);
+		return (int)spawnPositions.size() - 1;
+	}
+
+	// replaces the velocity of body from the next job on, e.g. with the player's input
+	void setVelocity(int body, const glm::vec3 &velocity)
+	{
+		pendingVelocities.push_back(make_pair(body, velocity));
+	}
+
+	// the static geometry the bodies run into; copied for the next job, the BVHs it refers
+	// to have to outlive the simulation
+	void setStaticWorld(const CollisionWorld &staticWorld)
+	{
+		world = staticWorld;
+		worldChanged = true;
+	}
+
+	// advances the simulation clock by frameTime: publishes the steps of a finished job and
+	// starts the steps that are due, but never waits for a job that is still running
+	void update(float frameTime)
+	{
+		accumulator += frameTime;
+		bool running = job.valid();
+		if (running && job.wait_for(chrono::seconds(0)) == future_status::ready)
+		{
+			job.get();
+			publish();
+			running = false;
+		}
+		if (running)
+			stats.busyFrames++;
+		else
+		{
+			unsigned int steps = (unsigned int)(accumulator / stepTime);
+			if (steps > maxSteps)
+			{
+				accumulator -= (steps - maxSteps) * stepTime;
+				steps = maxSteps;
+			}
+			if (steps > 0)
+			{
+				accumulator -= steps * stepTime;
+				launchedStep += steps;
+				launch(steps);
+			}
+		}
+		interpolate();
+	}
+
+	// where body is at the render time of the last update()
+	glm::vec3 position(int body) const
+	{
+		if (body >= (int)snapshots[from].size() || body >= (int)snapshots[to].size())
+			return body < (int)snapshots[to].size() ? snapshots[to][body] : spawnPositions[body];
+		return glm::mix(snapshots[from][body], snapshots[to][body], alpha);
+	}
+
+	const glm::vec3& halfExtents(int body) const { return extents[body]; }
+
+	unsigned int bodyCount() const { return (unsigned int)spawnPositions.size(); }
+
+	const DynamicsStats& lastStats() const { return stats; }
+
+	// waits for a running job and publishes it, e.g. before the world the bodies collide with goes away
+	void finish()
+	{
+		if (!job.valid())
+			return;
+		WorkerPool().wait(job);
+		job.get();
+		publish();
+	}
+
+private:
+	struct Body {
+		glm::vec3 position, halfExtents, velocity;
+		float inverseMass;
+	};
+
+	float groundHeight, stepTime;
+	unsigned int maxSteps;
+	glm::vec3 gravity;
+
+	/*  Render Thread  */
+	float accumulator;			// simulation time not yet given to a job
+	uint64_t launchedStep;		// the step the last job was started towards
+	vector<Body> pendingBodies;
+	vector<pair<int, glm::vec3> > pendingVelocities;
+	vector<glm::vec3> spawnPositions, extents;
+	CollisionWorld world;
+	bool worldChanged;
+	DynamicsStats stats;
+
+	// the last three published steps, newest at index newest, and the two position() mixes
+	vector<glm::vec3> snapshots[3];
+	uint64_t snapshotSteps[3];
+	int newest;
+	unsigned int snapshotCount;
+	int from, to;
+	float alpha;
+
+	/*  Simulation, only touched by the running job or while none is running  */
+	future<void> job;
+	vector<glm::vec3> positions, velocities, halfExtentsOf;
+	vector<float> inverseMasses;
+	vector<glm::vec3> pushes;	// how far the contacts of the last step move each body apart
+	CollisionWorld simulationWorld;
+	bool bodiesAdded;
+	DynamicsStats jobStats;
+
+	// sweep and prune state: bodies by lower x, their boxes in that order, pairs by chunk
+	vector<int> order;
+	vector<float> lowerX;
+	vector<glm::vec3> sortedMin, sortedMax;
+	vector<vector<pair<int, int> > > chunkPairs;
+
+	// hands the render thread's changes to the simulation and starts a job of steps steps
+	void launch(unsigned int steps)
+	{
+		for (size_t i = 0; i < pendingBodies.size(); i++)
+		{
+			positions.push_back(pendingBodies[i].position);
+			velocities.push_back(pendingBodies[i].velocity);
+			halfExtentsOf.push_back(pendingBodies[i].halfExtents);
+			inverseMasses.push_back(pendingBodies[i].inverseMass);
+			pushes.push_back(glm::vec3(0.0f));
+			bodiesAdded = true;
+		}
+		pendingBodies.clear();
+		for (size_t i = 0; i < pendingVelocities.size(); i++)
+			velocities[pendingVelocities[i].first] = pendingVelocities[i].second;
+		pendingVelocities.clear();
+		if (worldChanged)
+		{
+			simulationWorld = world;
+			worldChanged = false;
+		}
+		job = WorkerPool().submit([this, steps]() {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (unsigned int i = 0; i < steps; i++)
+				step();
+			jobStats.steps = steps;
+			jobStats.bodies = (unsigned int)positions.size();
+			jobStats.milliseconds = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+		});
+	}
+
+	// makes the finished job's positions the newest snapshot
+	void publish()
+	{
+		newest = (newest + 1) % 3;
+		snapshots[newest] = positions;
+		snapshotSteps[newest] = launchedStep;
+		snapshotCount = min(snapshotCount + 1, 3u);
+		unsigned int busyFrames = stats.busyFrames;
+		stats = jobStats;
+		stats.busyFrames = busyFrames;
+	}
+
+	// picks the published steps on either side of the render time, two steps behind the
+	// clock; before the oldest snapshot or after the newest it stays there
+	void interpolate()
+	{
+		double renderStep = (double)launchedStep + accumulator / stepTime - 2.0;
+		from = to = newest;
+		alpha = 0.0f;
+		int newer = newest;
+		for (unsigned int i = 1; i < snapshotCount && (double)snapshotSteps[newer] > renderStep; i++)
+		{
+			int older = (newest + 3 - (int)i) % 3;
+			if ((double)snapshotSteps[older] <= renderStep)
+			{
+				from = older;
+				to = newer;
+				alpha = (float)((renderStep - (double)snapshotSteps[older]) / (double)(snapshotSteps[newer] - snapshotSteps[older]));
+				return;
+			}
+			from = to = newer = older;
+		}
+	}
+
+	/*  One Step  */
+	void step()
+	{
+		size_t count = positions.size();
+		unsigned int chunks = chunksFor(count);
+		ParallelFor(count, chunks, [this](unsigned int, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				integrate(i);
+		});
+		findPairs();
+		resolvePairs();
+	}
+
+	// moves body i by its velocity and the push of its last contacts, sliding along the static
+	// world and stopping on the ground; bodies are independent here, so this runs for many of
+	// them at once. Sweeping the push as well keeps a pile of boxes from squeezing one through a wall.
+	void integrate(size_t i)
+	{
+		glm::vec3 &position = positions[i], &velocity = velocities[i];
+		const glm::vec3 &boxExtents = halfExtentsOf[i];
+		bool kinematic = inverseMasses[i] == 0.0f;
+		if (!kinematic)
+			velocity += gravity * stepTime;
+		glm::vec3 motion = velocity * stepTime + pushes[i];
+		pushes[i] = glm::vec3(0.0f);
+		float radius = min(boxExtents.x, min(boxExtents.y, boxExtents.z));
+		glm::vec3 moved = simulationWorld.moveSphere(position, radius, motion) - position;
+		// a blocked body loses the speed it had into what blocked it
+		glm::vec3 blocked = motion - moved;
+		if (!kinematic && glm::dot(blocked, blocked) > 1e-12f)
+		{
+			glm::vec3 normal = glm::normalize(blocked);
+			velocity -= normal * max(glm::dot(velocity, normal), 0.0f);
+		}
+		position += moved;
+		keepAboveGround(i);
+	}
+
+	void keepAboveGround(size_t i)
+	{
+		glm::vec3 &position = positions[i], &velocity = velocities[i];
+		float bottom = groundHeight + halfExtentsOf[i].y;
+		if (position.y >= bottom)
+			return;
+		position.y = bottom;
+		if (inverseMasses[i] == 0.0f)
+			return;
+		velocity.y = max(velocity.y, 0.0f);
+		float keep = max(0.0f, 1.0f - DYNAMICS_GROUND_FRICTION * stepTime);
+		velocity.x *= keep;
+		velocity.z *= keep;
+	}
+
+	// the overlapping boxes, as pairs of bodies, by sweep and prune along x
+	void findPairs()
+	{
+		size_t count = positions.size();
+		lowerX.resize(count);
+		for (size_t i = 0; i < count; i++)
+			lowerX[i] = positions[i].x - halfExtentsOf[i].x;
+
+		// new bodies can land anywhere in the order, which is sorted again from scratch; otherwise
+		// the bodies moved a little since the last step and insertion sort is close to linear
+		jobStats.swaps = 0;
+		if (bodiesAdded)
+		{
+			order.resize(count);
+			for (size_t i = 0; i < count; i++)
+				order[i] = (int)i;
+			sort(order.begin(), order.end(), [this](int a, int b) { return lowerX[a] < lowerX[b]; });
+			bodiesAdded = false;
+		}
+		else
+		{
+			for (size_t i = 1; i < count; i++)
+			{
+				int body = order[i];
+				float key = lowerX[body];
+				size_t j = i;
+				for (; j > 0 && lowerX[order[j - 1]] > key; j--)
+					order[j] = order[j - 1];
+				order[j] = body;
+				jobStats.swaps += (unsigned int)(i - j);
+			}
+		}
+		sortedMin.resize(count);
+		sortedMax.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			int body = order[i];
+			sortedMin[i] = positions[body] - halfExtentsOf[body];
+			sortedMax[i] = positions[body] + halfExtentsOf[body];
+		}
+
+		// every box is paired with the ones after it that start before it ends along x; the
+		// chunks split the boxes a pair starts from, and their pairs are joined in chunk order
+		// so a step comes out the same whatever the number of workers
+		unsigned int chunks = chunksFor(count);
+		chunkPairs.resize(max<size_t>(chunkPairs.size(), chunks));
+		ParallelFor(count, chunks, [this, count](unsigned int chunk, size_t begin, size_t end) {
+			vector<pair<int, int> > &pairs = chunkPairs[chunk];
+			pairs.clear();
+			for (size_t i = begin; i < end; i++)
+			{
+				const glm::vec3 &boxMin = sortedMin[i], &boxMax = sortedMax[i];
+				for (size_t j = i + 1; j < count && sortedMin[j].x <= boxMax.x; j++)
+				{
+					if (sortedMin[j].y > boxMax.y || sortedMax[j].y < boxMin.y || sortedMin[j].z > boxMax.z || sortedMax[j].z < boxMin.z)
+						continue;
+					int a = order[i], b = order[j];
+					// two kinematic bodies pass through each other
+					if (inverseMasses[a] == 0.0f && inverseMasses[b] == 0.0f)
+						continue;
+					pairs.push_back(make_pair(a, b));
+				}
+			}
+		});
+		jobStats.pairs = 0;
+		for (unsigned int c = 0; c < chunks; c++)
+			jobStats.pairs += (unsigned int)chunkPairs[c].size();
+	}
+
+	// pushes the boxes of each pair apart along the axis they overlap least, sharing the push by
+	// inverse mass, and takes out the speed with which they approach along it. The pushes are
+	// gathered for the next integrate(), which sweeps them through the static world.
+	void resolvePairs()
+	{
+		jobStats.contacts = 0;
+		unsigned int chunks = chunksFor(positions.size());
+		for (unsigned int c = 0; c < chunks; c++)
+		{
+			const vector<pair<int, int> > &pairs = chunkPairs[c];
+			for (size_t p = 0; p < pairs.size(); p++)
+			{
+				int a = pairs[p].first, b = pairs[p].second;
+				glm::vec3 delta = positions[b] + pushes[b] - positions[a] - pushes[a];
+				glm::vec3 overlap = halfExtentsOf[a] + halfExtentsOf[b] - glm::abs(delta);
+				// an earlier push may have separated them already
+				if (overlap.x <= 0.0f || overlap.y <= 0.0f || overlap.z <= 0.0f)
+					continue;
+				int axis = overlap.x < overlap.y ? (overlap.x < overlap.z ? 0 : 2) : (overlap.y < overlap.z ? 1 : 2);
+				float direction = delta[axis] < 0.0f ? -1.0f : 1.0f;
+				float inverseA = inverseMasses[a], inverseB = inverseMasses[b];
+				float total = inverseA + inverseB;
+				pushes[a][axis] -= direction * overlap[axis] * inverseA / total;
+				pushes[b][axis] += direction * overlap[axis] * inverseB / total;
+				float approach = (velocities[b][axis] - velocities[a][axis]) * direction;
+				if (approach < 0.0f)
+				{
+					float impulse = -(1.0f + DYNAMICS_RESTITUTION) * approach / total;
+					velocities[a][axis] -= direction * impulse * inverseA;
+					velocities[b][axis] += direction * impulse * inverseB;
+				}
+				jobStats.contacts++;
+			}
+		}
+	}
+
+	static unsigned int chunksFor(size_t count)
+	{
+		return (unsigned int)max<size_t>(1, min<size_t>(WorkerPool().size() + 1, count / DYNAMICS_MIN_CHUNK));
+	}
+
+	// runs work(chunk, begin, end) over count items split into chunks, the first chunk on the
+	// calling thread; the simulation job waits for the others through the pool
+	template <typename Work>
+	static void ParallelFor(size_t count, unsigned int chunks, const Work &work)
+	{
+		size_t chunkSize = (count + chunks - 1) / chunks;
+		vector<future<void> > jobs;
+		for (unsigned int c = 1; c < chunks; c++)
+		{
+			size_t begin = min(count, c * chunkSize), end = min(count, begin + chunkSize);
+			jobs.push_back(WorkerPool().submit([&work, c, begin, end]() { work(c, begin, end); }));
+		}
+		work(0, 0, min(count, chunkSize));
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			WorkerPool().wait(jobs[i]);
+			jobs[i].get();
+		}
+	}
+};
+#endif
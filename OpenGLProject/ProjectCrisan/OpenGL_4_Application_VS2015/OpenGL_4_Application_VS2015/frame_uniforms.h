@@ -0,0 +1,114 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "shader_s.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// C++ mirrors of the std140 uniform blocks every shader in shaders/ declares:
+//
+//   layout (std140) uniform FrameData { mat4 projection; mat4 view; vec3 viewPos; };
+//   layout (std140) uniform LightData { Light light; DirLight dirLight; };
+//
+// std140 gives a vec3 the alignment of a vec4 and lets a following scalar take its fourth
+// component, hence the padding. The blocks are declared without an instance name, so the
+// shaders read projection, light.position, ... exactly as before they were blocks.
+
+struct FrameData {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float pad0;
+};
+
+struct PointLightData {
+	glm::vec3 position;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float constant;
+	float linear;
+	float quadratic;
+	float pad3[2];
+};
+
+struct DirLightData {
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+struct LightData {
+	PointLightData light;
+	DirLightData dirLight;
+};
+
+static_assert(offsetof(FrameData, viewPos) == 128 && sizeof(FrameData) == 144, "FrameData does not match its std140 layout");
+static_assert(offsetof(PointLightData, constant) == 60 && offsetof(PointLightData, quadratic) == 68 && sizeof(PointLightData) == 80, "Light does not match its std140 layout");
+static_assert(sizeof(DirLightData) == 64, "DirLight does not match its std140 layout");
+static_assert(offsetof(LightData, dirLight) == 80 && sizeof(LightData) == 144, "LightData does not match its std140 layout");
+
+// One uniform buffer holding both blocks, bound to UNIFORM_BLOCK_FRAME and UNIFORM_BLOCK_LIGHT
+// for good. update() rewrites the whole buffer once per frame; Shader connects the blocks
+// of every program to those binding points when it links them.
+class FrameUniforms
+{
+public:
+	FrameUniforms() : buffer(0), lightOffset(0)
+	{
+		// the second range has to start on the alignment the implementation asks for
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		lightOffset = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+		contents.assign(lightOffset + sizeof(LightData), 0);
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, contents.size(), contents.data(), GL_DYNAMIC_DRAW);
+		glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_FRAME, buffer, 0, sizeof(FrameData));
+		glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_LIGHT, buffer, lightOffset, sizeof(LightData));
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	FrameUniforms(const FrameUniforms&) = delete;
+	FrameUniforms& operator=(const FrameUniforms&) = delete;
+
+	// the one buffer update of a frame; respecifying the store lets the driver hand out fresh
+	// memory instead of waiting for the draws of the previous frame to finish reading it
+	void update(const FrameData &frame, const LightData &lights)
+	{
+		memcpy(&contents[0], &frame, sizeof(frame));
+		memcpy(&contents[lightOffset], &lights, sizeof(lights));
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, contents.size(), contents.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	// releases the buffer, must run before the context goes away
+	void shutdown()
+	{
+		if (buffer)
+			glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+
+private:
+	GLuint buffer;
+	size_t lightOffset;
+	vector<unsigned char> contents;
+};
+#endif
@@ -0,0 +1,220 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// x64 and x86 builds with /arch:SSE or later test four boxes per instruction, anything else
+// runs the same arithmetic one box at a time
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#define FRUSTUM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// World space bounds of something drawn: a box given by its center and half extents, and a
+// sphere around the same center. Either is a conservative bound on its own; testing against
+// whichever is tighter for each plane keeps long rotated objects from being drawn for the
+// corners their box gains when it is made axis aligned again.
+struct Bounds {
+	glm::vec3 center;
+	glm::vec3 extents;
+	float radius;
+};
+
+// bounds of things that are never culled, e.g. the sky; finite so the plane tests cannot produce NaNs
+const float UNBOUNDED_EXTENT = 1e30f;
+
+inline Bounds UnboundedBounds()
+{
+	Bounds bounds;
+	bounds.center = glm::vec3(0.0f);
+	bounds.extents = glm::vec3(UNBOUNDED_EXTENT);
+	bounds.radius = UNBOUNDED_EXTENT;
+	return bounds;
+}
+
+// the world bounds of local bounds (a box from boundsMin to boundsMax, a sphere of radius
+// around its center) placed by transform. The box stays tight under rotation by summing the
+// absolute matrix columns (Arvo); the sphere grows by the largest scale of the transform.
+inline Bounds TransformBounds(const glm::mat4 &transform, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, float radius)
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extents = (boundsMax - boundsMin) * 0.5f;
+	glm::vec3 x(transform[0]), y(transform[1]), z(transform[2]);
+	Bounds bounds;
+	bounds.center = glm::vec3(transform * glm::vec4(center, 1.0f));
+	bounds.extents = glm::abs(x) * extents.x + glm::abs(y) * extents.y + glm::abs(z) * extents.z;
+	float scale = sqrt(max(glm::dot(x, x), max(glm::dot(y, y), glm::dot(z, z))));
+	bounds.radius = radius * scale;
+	return bounds;
+}
+
+// smallest bounds holding both a and b; the sphere is taken around the new box's center
+inline Bounds MergeBounds(const Bounds &a, const Bounds &b)
+{
+	glm::vec3 boundsMin = glm::min(a.center - a.extents, b.center - b.extents);
+	glm::vec3 boundsMax = glm::max(a.center + a.extents, b.center + b.extents);
+	Bounds bounds;
+	bounds.center = (boundsMin + boundsMax) * 0.5f;
+	bounds.extents = (boundsMax - boundsMin) * 0.5f;
+	bounds.radius = max(glm::length(a.center - bounds.center) + a.radius, glm::length(b.center - bounds.center) + b.radius);
+	bounds.radius = min(bounds.radius, glm::length(bounds.extents));
+	return bounds;
+}
+
+// where bounds lie relative to a frustum, for skipping the tests below a node that is completely inside
+enum FrustumTest {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTS,
+	FRUSTUM_INSIDE
+};
+
+// The six planes of a view volume, pointing inwards and normalized, so dot(plane, (p, 1)) is
+// the distance of p inside the plane.
+struct Frustum {
+	glm::vec4 planes[6];	// left, right, bottom, top, near, far
+
+	// a frustum that contains everything, culling against it keeps all bounds
+	Frustum()
+	{
+		for (int i = 0; i < 6; i++)
+			planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	// the planes of the clip volume of viewProjection in world space (Gribb and Hartmann)
+	static Frustum FromMatrix(const glm::mat4 &viewProjection)
+	{
+		glm::mat4 rows = glm::transpose(viewProjection);
+		Frustum frustum;
+		frustum.planes[0] = rows[3] + rows[0];
+		frustum.planes[1] = rows[3] - rows[0];
+		frustum.planes[2] = rows[3] + rows[1];
+		frustum.planes[3] = rows[3] - rows[1];
+		frustum.planes[4] = rows[3] + rows[2];
+		frustum.planes[5] = rows[3] - rows[2];
+		for (int i = 0; i < 6; i++)
+			frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+		return frustum;
+	}
+
+	// whether bounds are outside, partly inside or completely inside, going by their box only
+	FrustumTest classify(const glm::vec3 &center, const glm::vec3 &extents) const
+	{
+		FrustumTest result = FRUSTUM_INSIDE;
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 normal(planes[i]);
+			float distance = glm::dot(normal, center) + planes[i].w;
+			float reach = glm::dot(glm::abs(normal), extents);
+			if (distance + reach < 0.0f)
+				return FRUSTUM_OUTSIDE;
+			if (distance - reach < 0.0f)
+				result = FRUSTUM_INTERSECTS;
+		}
+		return result;
+	}
+
+	// false only if bounds lie completely outside one of the planes
+	bool intersects(const Bounds &bounds) const
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			glm::vec3 normal(planes[i]);
+			float distance = glm::dot(normal, bounds.center) + planes[i].w;
+			float reach = min(glm::dot(glm::abs(normal), bounds.extents), bounds.radius);
+			if (distance + reach < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Bounds gathered as structure of arrays, so cull() can test four of them against a plane
+// with a handful of SSE instructions; a remainder of fewer than four is tested one by one.
+// The arrays are kept between frames, so gathering allocates nothing once they have grown.
+class CullBatch
+{
+public:
+	CullBatch() : count(0) {}
+
+	void clear() { count = 0; }
+
+	size_t size() const { return count; }
+
+	// adds bounds and returns their index in the results of cull()
+	size_t add(const Bounds &bounds)
+	{
+		if (count == centerX.size())
+		{
+			size_t capacity = max<size_t>(16, centerX.size() * 2);
+			centerX.resize(capacity); centerY.resize(capacity); centerZ.resize(capacity);
+			extentX.resize(capacity); extentY.resize(capacity); extentZ.resize(capacity);
+			radius.resize(capacity);
+		}
+		centerX[count] = bounds.center.x;
+		centerY[count] = bounds.center.y;
+		centerZ[count] = bounds.center.z;
+		extentX[count] = bounds.extents.x;
+		extentY[count] = bounds.extents.y;
+		extentZ[count] = bounds.extents.z;
+		radius[count] = bounds.radius;
+		return count++;
+	}
+
+	// visible[i] becomes 1 for the bounds that intersect frustum and 0 for the others;
+	// returns how many are visible
+	size_t cull(const Frustum &frustum, vector<uint8_t> &visible) const
+	{
+		visible.resize(count);
+		size_t visibleCount = 0;
+		size_t i = 0;
+#ifdef FRUSTUM_SSE
+		__m128 zero = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			__m128 r = _mm_loadu_ps(&radius[i]);
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				const glm::vec4 &plane = frustum.planes[p];
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				__m128 boxReach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(fabs(plane.y)))),
+					_mm_mul_ps(ez, _mm_set1_ps(fabs(plane.z))));
+				__m128 reach = _mm_min_ps(boxReach, r);
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+			}
+			int mask = _mm_movemask_ps(outside);
+			for (int lane = 0; lane < 4; lane++)
+			{
+				visible[i + lane] = (mask >> lane & 1) ? 0 : 1;
+				visibleCount += visible[i + lane];
+			}
+		}
+#endif
+		for (; i < count; i++)
+		{
+			Bounds bounds;
+			bounds.center = glm::vec3(centerX[i], centerY[i], centerZ[i]);
+			bounds.extents = glm::vec3(extentX[i], extentY[i], extentZ[i]);
+			bounds.radius = radius[i];
+			visible[i] = frustum.intersects(bounds) ? 1 : 0;
+			visibleCount += visible[i];
+		}
+		return visibleCount;
+	}
+
+private:
+	size_t count;
+	vector<float> centerX, centerY, centerZ;
+	vector<float> extentX, extentY, extentZ;
+	vector<float> radius;
+};
+#endif
@@ -0,0 +1,344 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include "glad/glad.h"
+
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// First fit allocator of ranges of [0, capacity). The free ranges are kept by offset, so a
+// released range merges with the free ranges on either side of it and the space does not
+// crumble into pieces too small to reuse.
+class RangeAllocator
+{
+public:
+	static const size_t INVALID = ~(size_t)0;
+
+	RangeAllocator() : capacity(0), used(0) {}
+
+	// the start of a free range of size, INVALID if no free range is that large
+	size_t allocate(size_t size)
+	{
+		for (map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+		{
+			if (it->second < size)
+				continue;
+			size_t offset = it->first, remaining = it->second - size;
+			freeRanges.erase(it);
+			if (remaining)
+				freeRanges[offset + size] = remaining;
+			used += size;
+			return offset;
+		}
+		return INVALID;
+	}
+
+	void release(size_t offset, size_t size)
+	{
+		if (!size)
+			return;
+		used -= size;
+		map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+		if (next != freeRanges.end() && offset + size == next->first)
+		{
+			size += next->second;
+			next = freeRanges.erase(next);
+		}
+		if (next != freeRanges.begin())
+		{
+			map<size_t, size_t>::iterator previous = std::prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				previous->second += size;
+				return;
+			}
+		}
+		freeRanges[offset] = size;
+	}
+
+	// makes [capacity, newCapacity) free, joined to a free range at the old end
+	void grow(size_t newCapacity)
+	{
+		size_t added = newCapacity - capacity;
+		used += added;
+		release(capacity, added);
+		capacity = newCapacity;
+	}
+
+	size_t size() const { return capacity; }
+	size_t usedSize() const { return used; }
+	size_t freeRangeCount() const { return freeRanges.size(); }
+
+private:
+	map<size_t, size_t> freeRanges;	// offset to size
+	size_t capacity, used;
+};
+
+// where a mesh lives in the geometry pools
+struct GeometryRange {
+	int pool;					// -1 for a mesh without geometry
+	GLint baseVertex;			// its first vertex in the pool's vertex buffer, added to every index
+	unsigned int vertexCount;
+	size_t indexOffset;			// in bytes into the pool's index buffer
+	size_t indexBytes;
+
+	GeometryRange() : pool(-1), baseVertex(0), vertexCount(0), indexOffset(0), indexBytes(0) {}
+};
+
+// how full the pools are, in bytes
+struct GeometryPoolStats {
+	unsigned int pools;
+	size_t vertexBytes, vertexCapacity;
+	size_t indexBytes, indexCapacity;
+	unsigned int freeRanges;	// holes left by released meshes, plus the free end of every buffer
+};
+
+// the vertex buffer a pool starts with holds this many bytes, the index buffer half as many;
+// a full buffer doubles
+const size_t GEOMETRY_POOL_INITIAL_BYTES = 4 << 20;
+// index ranges start on multiples of this many bytes, as 32 bit indices have to
+const size_t GEOMETRY_INDEX_ALIGNMENT = 4;
+
+// Process wide owner of all mesh geometry. Meshes whose vertices have the same attribute
+// layout share one pool: a vertex buffer, an index buffer and a vertex array reading them.
+// A mesh holds its range in them instead of GL names of its own and is drawn with
+// glDrawElementsBaseVertex, so every mesh of a pool draws from the same vertex array and
+// switching meshes changes no binding. Indices of 16 and 32 bits share the index buffer;
+// ranges stay 4 byte aligned. A full buffer is replaced by one twice the size, copied on the
+// GPU; the ranges keep their offsets, only the vertex arrays are pointed at the new buffers.
+class GeometryPools
+{
+public:
+	// copies a mesh in: vertexCount vertices packed in format's layout, and indexBytes of indices
+	GeometryRange allocate(const VertexFormat &format, const void *vertices, size_t vertexCount, const void *indices, size_t indexBytes)
+	{
+		GeometryRange range;
+		if (!vertexCount || !indexBytes)
+			return range;
+		range.pool = findPool(format);
+		Pool &pool = pools[range.pool];
+		size_t indexUnits = (indexBytes + GEOMETRY_INDEX_ALIGNMENT - 1) / GEOMETRY_INDEX_ALIGNMENT;
+		size_t firstVertex = pool.vertices.allocate(vertexCount);
+		if (firstVertex == RangeAllocator::INVALID)
+		{
+			growVertices(pool, vertexCount);
+			firstVertex = pool.vertices.allocate(vertexCount);
+		}
+		size_t firstIndexUnit = pool.indices.allocate(indexUnits);
+		if (firstIndexUnit == RangeAllocator::INVALID)
+		{
+			growIndices(pool, indexUnits);
+			firstIndexUnit = pool.indices.allocate(indexUnits);
+		}
+		range.baseVertex = (GLint)firstVertex;
+		range.vertexCount = (unsigned int)vertexCount;
+		range.indexOffset = firstIndexUnit * GEOMETRY_INDEX_ALIGNMENT;
+		range.indexBytes = indexBytes;
+
+		// the copy targets leave the element buffer binding of whatever vertex array is bound alone
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * pool.format.stride, vertexCount * pool.format.stride, vertices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, range.indexOffset, indexBytes, indices);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return range;
+	}
+
+	// gives the range back to its pool and empties it; ranges outliving shutdown() are ignored
+	void release(GeometryRange &range)
+	{
+		if (range.pool >= 0 && range.pool < (int)pools.size())
+		{
+			Pool &pool = pools[range.pool];
+			pool.vertices.release(range.baseVertex, range.vertexCount);
+			pool.indices.release(range.indexOffset / GEOMETRY_INDEX_ALIGNMENT, (range.indexBytes + GEOMETRY_INDEX_ALIGNMENT - 1) / GEOMETRY_INDEX_ALIGNMENT);
+		}
+		range = GeometryRange();
+	}
+
+	// the vertex array drawing the meshes of pool, 0 for none
+	GLuint vertexArray(int pool) const
+	{
+		return pool >= 0 && pool < (int)pools.size() ? pools[pool].vertexArray : 0;
+	}
+
+	// a vertex array drawing the meshes of pool with the per instance model matrices in
+	// instanceBuffer, pointed at by setAttributes (see SetInstanceAttributes); made once per
+	// pool and buffer
+	GLuint instancedVertexArray(int pool, GLuint instanceBuffer, void (*setAttributes)(GLuint) = SetInstanceAttributes)
+	{
+		if (pool < 0 || pool >= (int)pools.size())
+			return 0;
+		vector<pair<GLuint, GLuint> > &arrays = pools[pool].instancedArrays;
+		for (size_t i = 0; i < arrays.size(); i++)
+			if (arrays[i].first == instanceBuffer)
+				return arrays[i].second;
+		GLuint vao;
+		glGenVertexArrays(1, &vao);
+		attach(pools[pool], vao);
+		glBindVertexArray(vao);
+		setAttributes(instanceBuffer);
+		glBindVertexArray(0);
+		arrays.push_back(make_pair(instanceBuffer, vao));
+		return vao;
+	}
+
+	// deletes the vertex arrays made for instanceBuffer; call before deleting the buffer, the
+	// GL may hand its name out again and a cached array would still read the old buffer
+	void releaseInstancedVertexArrays(GLuint instanceBuffer)
+	{
+		for (size_t i = 0; i < pools.size(); i++)
+		{
+			vector<pair<GLuint, GLuint> > &arrays = pools[i].instancedArrays;
+			for (size_t j = 0; j < arrays.size(); )
+			{
+				if (arrays[j].first != instanceBuffer)
+				{
+					j++;
+					continue;
+				}
+				glDeleteVertexArrays(1, &arrays[j].second);
+				arrays[j] = arrays.back();
+				arrays.pop_back();
+			}
+		}
+	}
+
+	GeometryPoolStats stats() const
+	{
+		GeometryPoolStats result;
+		memset(&result, 0, sizeof(result));
+		result.pools = (unsigned int)pools.size();
+		for (size_t i = 0; i < pools.size(); i++)
+		{
+			const Pool &pool = pools[i];
+			result.vertexBytes += pool.vertices.usedSize() * pool.format.stride;
+			result.vertexCapacity += pool.vertices.size() * pool.format.stride;
+			result.indexBytes += pool.indices.usedSize() * GEOMETRY_INDEX_ALIGNMENT;
+			result.indexCapacity += pool.indices.size() * GEOMETRY_INDEX_ALIGNMENT;
+			result.freeRanges += (unsigned int)(pool.vertices.freeRangeCount() + pool.indices.freeRangeCount());
+		}
+		return result;
+	}
+
+	// deletes every buffer and vertex array; meshes must not be drawn afterwards, releasing them is harmless
+	void shutdown()
+	{
+		for (size_t i = 0; i < pools.size(); i++)
+		{
+			Pool &pool = pools[i];
+			glDeleteVertexArrays(1, &pool.vertexArray);
+			for (size_t j = 0; j < pool.instancedArrays.size(); j++)
+				glDeleteVertexArrays(1, &pool.instancedArrays[j].second);
+			glDeleteBuffers(1, &pool.vertexBuffer);
+			glDeleteBuffers(1, &pool.indexBuffer);
+		}
+		pools.clear();
+	}
+
+private:
+	struct Pool {
+		VertexFormat format;		// the attribute layout; the position bounds stay per mesh
+		GLuint vertexArray;
+		GLuint vertexBuffer, indexBuffer;
+		RangeAllocator vertices;	// in vertices
+		RangeAllocator indices;		// in GEOMETRY_INDEX_ALIGNMENT units
+		vector<pair<GLuint, GLuint> > instancedArrays;	// instance buffer and the vertex array reading it
+	};
+
+	vector<Pool> pools;
+
+	static bool SameAttributes(const VertexFormat &a, const VertexFormat &b)
+	{
+		return a.layout == b.layout && a.stride == b.stride && a.texCoordOffset == b.texCoordOffset &&
+			a.tangentOffset == b.tangentOffset && a.halfTexCoords == b.halfTexCoords;
+	}
+
+	int findPool(const VertexFormat &format)
+	{
+		for (size_t i = 0; i < pools.size(); i++)
+			if (SameAttributes(pools[i].format, format))
+				return (int)i;
+		pools.push_back(Pool());
+		Pool &pool = pools.back();
+		pool.format = format;
+		pool.vertexBuffer = pool.indexBuffer = 0;
+		glGenVertexArrays(1, &pool.vertexArray);
+		return (int)pools.size() - 1;
+	}
+
+	// points vao at the pool's current buffers
+	static void attach(const Pool &pool, GLuint vao)
+	{
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+		SetVertexAttributes(pool.format);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+		glBindVertexArray(0);
+	}
+
+	static void attachAll(const Pool &pool)
+	{
+		attach(pool, pool.vertexArray);
+		for (size_t i = 0; i < pool.instancedArrays.size(); i++)
+			attach(pool, pool.instancedArrays[i].second);
+	}
+
+	// replaces buffer, holding oldBytes, by one of newBytes with the same contents
+	static void Resize(GLuint &buffer, size_t oldBytes, size_t newBytes)
+	{
+		GLuint grown;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, newBytes, NULL, GL_STATIC_DRAW);
+		if (buffer)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		buffer = grown;
+	}
+
+	// the new size of an allocator of capacity that needs room for size more
+	static size_t GrownSize(size_t capacity, size_t size, size_t initial)
+	{
+		return max(capacity ? capacity * 2 : initial, capacity + size);
+	}
+
+	void growVertices(Pool &pool, size_t vertexCount)
+	{
+		size_t capacity = pool.vertices.size();
+		size_t grown = GrownSize(capacity, vertexCount, GEOMETRY_POOL_INITIAL_BYTES / pool.format.stride);
+		Resize(pool.vertexBuffer, capacity * pool.format.stride, grown * pool.format.stride);
+		pool.vertices.grow(grown);
+		attachAll(pool);
+	}
+
+	void growIndices(Pool &pool, size_t units)
+	{
+		size_t capacity = pool.indices.size();
+		size_t grown = GrownSize(capacity, units, GEOMETRY_POOL_INITIAL_BYTES / 2 / GEOMETRY_INDEX_ALIGNMENT);
+		Resize(pool.indexBuffer, capacity * GEOMETRY_INDEX_ALIGNMENT, grown * GEOMETRY_INDEX_ALIGNMENT);
+		pool.indices.grow(grown);
+		attachAll(pool);
+	}
+};
+
+// the process wide geometry pools
+inline GeometryPools& Geometry()
+{
+	static GeometryPools pools;
+	return pools;
+}
+#endif
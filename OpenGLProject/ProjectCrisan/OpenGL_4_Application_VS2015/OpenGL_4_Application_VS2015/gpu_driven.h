@@ -0,0 +1,480 @@
+#ifndef GPU_DRIVEN_H
+#define GPU_DRIVEN_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "frustum.h"
+#include "geometry_pool.h"
+#include "material.h"
+#include "model.h"
+#include "shader_s.h"
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// glad is generated for OpenGL 3.3, the few GL 4.3 enums and entry points the indirect path
+// needs are declared here and loaded by GpuDrivenRenderer when the context has them
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+
+typedef void (APIENTRYP GpuDispatchComputeProc)(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+typedef void (APIENTRYP GpuMemoryBarrierProc)(GLbitfield barriers);
+typedef void (APIENTRYP GpuMultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawCount, GLsizei stride);
+
+// invocations of shaders/cull.comp per work group, its local_size_x
+const unsigned int GPU_CULL_GROUP_SIZE = 64;
+
+// the command of a record whose object is hidden, the culling shader skips it
+const GLuint GPU_RECORD_HIDDEN = 0xffffffffu;
+
+// the DrawElementsIndirectCommand of glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;	// 0 until the culling shader counts the visible instances in
+	GLuint firstIndex;		// in indices, not bytes
+	GLuint baseVertex;
+	GLuint baseInstance;	// the first of the command's instances in the instance buffer
+};
+
+// a mesh placed in the world, as the culling shader reads it (std430 "Record")
+struct GpuInstanceRecord {
+	glm::mat4 model;
+	glm::vec4 boundsCenter;		// model space, w the radius around it
+	glm::vec3 boundsExtents;
+	GLuint command;				// the draw command of the mesh's full level, its other levels follow; GPU_RECORD_HIDDEN for none
+};
+
+// what the culling shader writes for every visible instance and the vertex shader reads as
+// instanced attributes (std430 "Instance")
+struct GpuVisibleInstance {
+	glm::mat4 model;
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+};
+
+// points the instance attributes of the bound VAO at buffer, an array of GpuVisibleInstance
+// that advances once per instance; the INDIRECT variant of shaders/model.vert reads them
+inline void SetIndirectInstanceAttributes(GLuint buffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (unsigned int column = 0; column < 4; column++)
+	{
+		GLuint location = VERTEX_ATTRIBUTE_INSTANCE_MODEL + column;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(GpuVisibleInstance), (void*)(offsetof(GpuVisibleInstance, model) + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(location, 1);
+	}
+	glEnableVertexAttribArray(VERTEX_ATTRIBUTE_INSTANCE_POSITION_OFFSET);
+	glVertexAttribPointer(VERTEX_ATTRIBUTE_INSTANCE_POSITION_OFFSET, 3, GL_FLOAT, GL_FALSE, sizeof(GpuVisibleInstance), (void*)offsetof(GpuVisibleInstance, positionOffset));
+	glVertexAttribDivisor(VERTEX_ATTRIBUTE_INSTANCE_POSITION_OFFSET, 1);
+	glEnableVertexAttribArray(VERTEX_ATTRIBUTE_INSTANCE_POSITION_SCALE);
+	glVertexAttribPointer(VERTEX_ATTRIBUTE_INSTANCE_POSITION_SCALE, 3, GL_FLOAT, GL_FALSE, sizeof(GpuVisibleInstance), (void*)offsetof(GpuVisibleInstance, positionScale));
+	glVertexAttribDivisor(VERTEX_ATTRIBUTE_INSTANCE_POSITION_SCALE, 1);
+}
+
+// what the last render() did
+struct GpuDrivenStats {
+	unsigned int objects;		// models placed
+	unsigned int records;		// meshes placed, each culled by one shader invocation
+	unsigned int commands;		// draw commands, one per level of every distinct mesh
+	unsigned int multiDraws;	// glMultiDrawElementsIndirect calls
+};
+
+// Draws placed models without a draw call or uniform upload per mesh. Every mesh placement is
+// a record in a shader storage buffer; each frame a compute shader culls all records against
+// the frustum, picks their level of detail as Mesh::selectLod does and counts the visible ones
+// into the instanceCount of the DrawElementsIndirectCommand of their mesh's level, writing
+// their transforms where that command's baseInstance points. The level each record was drawn
+// at stays on the GPU for the next frame's hysteresis. The commands are grouped by geometry
+// pool, index type and textures, and each group is drawn with one glMultiDrawElementsIndirect
+// from the pool's vertex array, which reads the transforms as instanced attributes; nothing
+// is read back.
+//
+// Needs OpenGL 4.3. Textures are bound per group, without bindless textures a group cannot
+// span materials. Placements are gathered once (add) and only their transforms change later
+// (setTransform, setHidden), re-uploading just the records of the object that changed.
+class GpuDrivenRenderer
+{
+public:
+	// loads the GL 4.3 entry points through load and compiles the culling shader; on an older
+	// context the renderer stays unavailable and draws nothing
+	GpuDrivenRenderer(GLADloadproc load, const char *cullShaderPath)
+		: dispatchCompute(NULL), memoryBarrier(NULL), multiDrawElementsIndirect(NULL), program(0),
+		recordBuffer(0), drawBuffer(0), commandTemplate(0), commandBuffer(0), instanceBuffer(0), levelBuffer(0), dirty(false)
+	{
+		memset(&stats, 0, sizeof(stats));
+		if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3))
+			return;
+		dispatchCompute = (GpuDispatchComputeProc)load("glDispatchCompute");
+		memoryBarrier = (GpuMemoryBarrierProc)load("glMemoryBarrier");
+		multiDrawElementsIndirect = (GpuMultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect");
+		if (!dispatchCompute || !memoryBarrier || !multiDrawElementsIndirect)
+			return;
+		program = CompileCompute(cullShaderPath);
+		if (!program)
+			return;
+		recordCountLocation = glGetUniformLocation(program, "recordCount");
+		planesLocation = glGetUniformLocation(program, "planes");
+		eyeLocation = glGetUniformLocation(program, "eye");
+		projectionScaleLocation = glGetUniformLocation(program, "projectionScale");
+		glUseProgram(program);
+		glUniform1f(glGetUniformLocation(program, "pixelError"), MESH_LOD_PIXEL_ERROR);
+		glUniform1f(glGetUniformLocation(program, "hysteresis"), MESH_LOD_HYSTERESIS);
+		glUniform1f(glGetUniformLocation(program, "minDistance"), RENDER_QUEUE_MIN_LOD_DISTANCE);
+		glUseProgram(0);
+		glGenBuffers(1, &recordBuffer);
+		glGenBuffers(1, &drawBuffer);
+		glGenBuffers(1, &commandTemplate);
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &instanceBuffer);
+		glGenBuffers(1, &levelBuffer);
+	}
+
+	bool available() const { return program != 0; }
+
+	// places model at transform and returns the object to move it by
+	int add(const Model &model, const glm::mat4 &transform)
+	{
+		Object object;
+		object.hidden = false;
+		object.firstRecord = (unsigned int)records.size();
+		for (size_t i = 0; i < model.meshes.size(); i++)
+		{
+			const Mesh &mesh = model.meshes[i];
+			if (mesh.geometry.pool < 0 || !mesh.indexCount)
+				continue;
+			GpuInstanceRecord record;
+			record.model = transform;
+			record.boundsCenter = glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, mesh.boundsRadius);
+			record.boundsExtents = (mesh.boundsMax - mesh.boundsMin) * 0.5f;
+			record.command = 0;
+			records.push_back(record);
+			recordMeshes.push_back(&mesh);
+		}
+		object.recordCount = (unsigned int)records.size() - object.firstRecord;
+		objects.push_back(object);
+		dirty = true;
+		return (int)objects.size() - 1;
+	}
+
+	// moves object, uploading its records unless everything is uploaded at the next render() anyway
+	void setTransform(int object, const glm::mat4 &transform)
+	{
+		const Object &placed = objects[object];
+		for (unsigned int i = 0; i < placed.recordCount; i++)
+			records[placed.firstRecord + i].model = transform;
+		if (dirty || !placed.recordCount)
+			return;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, recordBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, placed.firstRecord * sizeof(GpuInstanceRecord), placed.recordCount * sizeof(GpuInstanceRecord), &records[placed.firstRecord]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// leaves object out of the drawing, or puts it back, e.g. while a proxy stands in for it
+	void setHidden(int object, bool hidden)
+	{
+		Object &placed = objects[object];
+		if (placed.hidden == hidden)
+			return;
+		placed.hidden = hidden;
+		if (dirty || !placed.recordCount)
+			return;
+		for (unsigned int i = 0; i < placed.recordCount; i++)
+			records[placed.firstRecord + i].command = hidden ? GPU_RECORD_HIDDEN : recordCommands[placed.firstRecord + i];
+		glBindBuffer(GL_COPY_WRITE_BUFFER, recordBuffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, placed.firstRecord * sizeof(GpuInstanceRecord), placed.recordCount * sizeof(GpuInstanceRecord), &records[placed.firstRecord]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// culls every placed mesh against frustum and draws the visible ones with shader, the
+	// INDIRECT variant of the model shader, at the levels of detail seen from eye
+	// (projectionScale as for RenderQueue::setProjectionScale, 0 for full detail). Leaves no
+	// vertex array bound.
+	void render(const Shader &shader, const Frustum &frustum, const glm::vec3 &eye, float projectionScale)
+	{
+		if (!program || records.empty())
+			return;
+		if (dirty)
+			build();
+
+		// every frame starts from the commands with no instances
+		glBindBuffer(GL_COPY_READ_BUFFER, commandTemplate);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commands.size() * sizeof(DrawElementsIndirectCommand));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glUseProgram(program);
+		glUniform1ui(recordCountLocation, (GLuint)records.size());
+		glUniform4fv(planesLocation, 6, &frustum.planes[0].x);
+		glUniform3fv(eyeLocation, 1, &eye.x);
+		glUniform1f(projectionScaleLocation, projectionScale);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, recordBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, instanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, levelBuffer);
+		dispatchCompute(((GLuint)records.size() + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+		// the draws read the commands and the instances the shader wrote
+		memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+		shader.use();
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+		for (size_t i = 0; i < groups.size(); i++)
+		{
+			const Group &group = groups[i];
+			group.material->Bind();
+			shader.setFloat(UNIFORM_SHININESS, group.material->shininess);
+			shader.setBool(UNIFORM_OCTAHEDRAL_NORMALS, group.octahedralNormals);
+			glBindVertexArray(group.vao);
+			multiDrawElementsIndirect(GL_TRIANGLES, group.indexType, (void*)(group.firstCommand * sizeof(DrawElementsIndirectCommand)), group.commandCount, 0);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+		stats.multiDraws = (unsigned int)groups.size();
+	}
+
+	// the meshes the last render() found in view and the triangles it drew of them; reads the
+	// commands back, so it waits for the GPU and is only meant for statistics
+	void countVisible(unsigned int &visible, unsigned int &triangles) const
+	{
+		visible = triangles = 0;
+		if (!program || commands.empty())
+			return;
+		vector<DrawElementsIndirectCommand> counted(commands.size());
+		glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, counted.size() * sizeof(DrawElementsIndirectCommand), counted.data());
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		for (size_t i = 0; i < counted.size(); i++)
+		{
+			visible += counted[i].instanceCount;
+			triangles += counted[i].count / 3 * counted[i].instanceCount;
+		}
+	}
+
+	const GpuDrivenStats& lastStats() const { return stats; }
+
+	// deletes the program and buffers; the vertex arrays belong to the geometry pools
+	void shutdown()
+	{
+		if (!program)
+			return;
+		glDeleteProgram(program);
+		glDeleteBuffers(1, &recordBuffer);
+		glDeleteBuffers(1, &drawBuffer);
+		glDeleteBuffers(1, &commandTemplate);
+		glDeleteBuffers(1, &commandBuffer);
+		Geometry().releaseInstancedVertexArrays(instanceBuffer);
+		glDeleteBuffers(1, &instanceBuffer);
+		glDeleteBuffers(1, &levelBuffer);
+		program = 0;
+	}
+
+private:
+	struct Object {
+		unsigned int firstRecord, recordCount;
+		bool hidden;
+	};
+
+	// a glMultiDrawElementsIndirect: consecutive commands sharing vertex array, index type and textures
+	struct Group {
+		const Material *material;
+		GLuint vao;
+		GLenum indexType;
+		bool octahedralNormals;
+		unsigned int firstCommand, commandCount;
+	};
+
+	// the position unpacking of a command's mesh and its level (std430 "DrawData")
+	struct DrawData {
+		glm::vec4 positionOffset;	// w the error of the level
+		glm::vec4 positionScale;	// w how many levels the mesh has
+	};
+
+	GpuDispatchComputeProc dispatchCompute;
+	GpuMemoryBarrierProc memoryBarrier;
+	GpuMultiDrawElementsIndirectProc multiDrawElementsIndirect;
+	GLuint program;
+	GLint recordCountLocation, planesLocation, eyeLocation, projectionScaleLocation;
+	GLuint recordBuffer;		// GpuInstanceRecord per placed mesh
+	GLuint drawBuffer;			// DrawData per command
+	GLuint commandTemplate;		// the commands with no instances, copied over commandBuffer every frame
+	GLuint commandBuffer;
+	GLuint instanceBuffer;		// GpuVisibleInstance, room for every record at every level
+	GLuint levelBuffer;			// by record, the level it was drawn at last
+	vector<Object> objects;
+	vector<GpuInstanceRecord> records;
+	vector<const Mesh*> recordMeshes;	// by record
+	vector<GLuint> recordCommands;		// by record, its command while its object is shown
+	vector<DrawElementsIndirectCommand> commands;
+	vector<Group> groups;
+	bool dirty;					// placements were added since the buffers were built
+	GpuDrivenStats stats;
+
+	// sorts the placed meshes into groups and commands and uploads everything
+	void build()
+	{
+		// the distinct meshes, each sorted into the first group it can share
+		vector<const Mesh*> meshes;
+		vector<unsigned int> meshGroups;
+		vector<Group> found;
+		for (size_t i = 0; i < recordMeshes.size(); i++)
+		{
+			const Mesh *mesh = recordMeshes[i];
+			if (find(meshes.begin(), meshes.end(), mesh) != meshes.end())
+				continue;
+			GLuint vao = Geometry().instancedVertexArray(mesh->geometry.pool, instanceBuffer, SetIndirectInstanceAttributes);
+			size_t g = 0;
+			while (g < found.size() && !(found[g].vao == vao && found[g].indexType == mesh->indexType && found[g].material->sameAs(mesh->material)))
+				g++;
+			if (g == found.size())
+			{
+				Group group;
+				group.material = &mesh->material;
+				group.vao = vao;
+				group.indexType = mesh->indexType;
+				group.octahedralNormals = mesh->format.layout != VERTEX_LAYOUT_FLOAT;
+				group.firstCommand = group.commandCount = 0;
+				found.push_back(group);
+			}
+			found[g].commandCount += (unsigned int)mesh->lods.size();
+			meshes.push_back(mesh);
+			meshGroups.push_back((unsigned int)g);
+		}
+		// commands laid out group by group
+		for (size_t g = 1; g < found.size(); g++)
+			found[g].firstCommand = found[g - 1].firstCommand + found[g - 1].commandCount;
+		vector<unsigned int> meshCommands(meshes.size());
+		vector<unsigned int> filled(found.size(), 0);
+		size_t commandCount = 0;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			meshCommands[i] = found[meshGroups[i]].firstCommand + filled[meshGroups[i]];
+			filled[meshGroups[i]] += (unsigned int)meshes[i]->lods.size();
+			commandCount += meshes[i]->lods.size();
+		}
+		groups.swap(found);
+
+		commands.assign(commandCount, DrawElementsIndirectCommand());
+		vector<DrawData> draws(commandCount);
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const Mesh &mesh = *meshes[i];
+			for (size_t level = 0; level < mesh.lods.size(); level++)
+			{
+				DrawElementsIndirectCommand &command = commands[meshCommands[i] + level];
+				command.count = mesh.lods[level].indexCount;
+				command.instanceCount = 0;
+				command.firstIndex = (GLuint)(mesh.geometry.indexOffset / IndexSize(mesh.indexType) + mesh.lods[level].firstIndex);
+				command.baseVertex = (GLuint)mesh.geometry.baseVertex;
+				command.baseInstance = 0;
+				draws[meshCommands[i] + level].positionOffset = glm::vec4(mesh.format.positionOffset, mesh.lods[level].error);
+				draws[meshCommands[i] + level].positionScale = glm::vec4(mesh.format.positionScale, (float)mesh.lods.size());
+			}
+		}
+		// every level of a mesh gets room for all placements of the mesh, hidden ones included
+		recordCommands.resize(records.size());
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			size_t mesh = find(meshes.begin(), meshes.end(), recordMeshes[i]) - meshes.begin();
+			recordCommands[i] = meshCommands[mesh];
+			for (size_t level = 0; level < meshes[mesh]->lods.size(); level++)
+				commands[meshCommands[mesh] + level].baseInstance++;
+		}
+		for (size_t o = 0; o < objects.size(); o++)
+			for (unsigned int i = objects[o].firstRecord; i < objects[o].firstRecord + objects[o].recordCount; i++)
+				records[i].command = objects[o].hidden ? GPU_RECORD_HIDDEN : recordCommands[i];
+		GLuint first = 0;
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			GLuint placements = commands[i].baseInstance;
+			commands[i].baseInstance = first;
+			first += placements;
+		}
+
+		Upload(recordBuffer, records.size() * sizeof(GpuInstanceRecord), records.data(), GL_DYNAMIC_DRAW);
+		Upload(drawBuffer, draws.size() * sizeof(DrawData), draws.data(), GL_STATIC_DRAW);
+		Upload(commandTemplate, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+		Upload(commandBuffer, commands.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+		Upload(instanceBuffer, first * sizeof(GpuVisibleInstance), NULL, GL_DYNAMIC_COPY);
+		// no level drawn yet, the first frame takes the one the view asks for
+		vector<GLuint> levels(records.size(), ~0u);
+		Upload(levelBuffer, levels.size() * sizeof(GLuint), levels.data(), GL_DYNAMIC_COPY);
+		stats.objects = (unsigned int)objects.size();
+		stats.records = (unsigned int)records.size();
+		stats.commands = (unsigned int)commands.size();
+		dirty = false;
+	}
+
+	static void Upload(GLuint buffer, size_t bytes, const void *data, GLenum usage)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, bytes, data, usage);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// the linked program of the compute shader at path, 0 if it does not build
+	static GLuint CompileCompute(const char *path)
+	{
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+			return 0;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		std::string code = stream.str();
+		const char *source = code.c_str();
+		GLint success;
+		GLchar infoLog[1024];
+		GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+			std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: COMPUTE\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		GLuint linked = glCreateProgram();
+		glAttachShader(linked, shader);
+		glLinkProgram(linked);
+		glDeleteShader(shader);
+		glGetProgramiv(linked, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(linked, 1024, NULL, infoLog);
+			std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: PROGRAM\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+			glDeleteProgram(linked);
+			return 0;
+		}
+		return linked;
+	}
+};
+#endif
@@ -0,0 +1,412 @@
+#ifndef HLOD_H
+#define HLOD_H
+
+#include "glm/glm.hpp"
+
+#include "frustum.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "mesh.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "shader_s.h"
+#include "texture_manager.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Hierarchical level of detail proxies. tools/hlod_build sorts the static model nodes of a
+// scene into the cells of a grid on the ground plane and bakes every cell into one proxy: a
+// single simplified mesh in world space with all its diffuse textures packed into one atlas.
+// HlodSet draws a cell as its proxy, one draw instead of one per mesh of every node, while the
+// eye is further than the cell's switch distance from its bounds.
+//
+//   HlodHeader
+//   HlodCell[cellCount]
+//   HlodSource[sourceCount]
+//   uint32_t node names[nodeCount] (string table offsets, cell by cell)
+//   string table (NUL terminated)
+//   vertex/index blobs, each starting on a 16 byte boundary
+//
+// The file is written next to the scene as <scene>.hlod, the atlases as <scene>.hlod<cell>.ktx.
+// It is stale as soon as the size/time stamp of the scene or of a model it was baked from no
+// longer matches; a stale file is not used, the scene is then drawn without proxies.
+
+const char HLOD_MAGIC[4] = { 'G', 'P', 'S', 'H' };
+const uint32_t HLOD_VERSION = 1;
+
+// a cell drawn as its proxy only goes back to its nodes once the eye is this fraction of the
+// switch distance closer than where it switched, so a cell at the distance does not flicker
+const float HLOD_HYSTERESIS = 0.1f;
+
+struct HlodHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sceneSize;
+	int64_t sceneModified;
+	uint32_t vertexSize;
+	uint32_t cellCount;
+	uint32_t sourceCount;
+	uint32_t nodeCount;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+};
+
+struct HlodCell {
+	glm::vec3 boundsMin;	// world space bounds of the cell's nodes
+	glm::vec3 boundsMax;
+	float switchDistance;	// from the eye to the bounds, beyond it the proxy is drawn
+	uint32_t firstNode;
+	uint32_t nodeCount;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t atlas;			// string table offset
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+// a model file the proxies were baked from
+struct HlodSource {
+	uint32_t path;			// string table offset
+	uint32_t reserved;
+	uint64_t size;
+	int64_t modified;
+};
+
+// one cell as the builder produces it
+struct HlodProxy {
+	vector<string> nodes;
+	glm::vec3 boundsMin, boundsMax;
+	float switchDistance;
+	vector<Vertex> vertices;	// world space
+	vector<unsigned int> indices;
+	string atlas;				// path of the atlas texture
+};
+
+inline string HlodPath(const string &scenePath)
+{
+	return scenePath + ".hlod";
+}
+
+inline string HlodAtlasPath(const string &scenePath, unsigned int cell)
+{
+	return HlodPath(scenePath) + to_string(cell) + ".ktx";
+}
+
+// writes the proxies of a scene; sources are the model files with the stamps they were baked
+// from. Returns false (and leaves no file behind) on failure.
+inline bool WriteHlod(const string &path, const FileStamp &scene, const vector<pair<string, FileStamp> > &sources, const vector<HlodProxy> &proxies)
+{
+	string strings;
+	auto addString = [&strings](const string &str) -> uint32_t
+	{
+		uint32_t offset = (uint32_t)strings.size();
+		strings.append(str);
+		strings.push_back('\0');
+		return offset;
+	};
+
+	vector<HlodCell> cells(proxies.size());
+	vector<uint32_t> nodes;
+	for (size_t i = 0; i < proxies.size(); i++)
+	{
+		HlodCell &cell = cells[i];
+		cell.boundsMin = proxies[i].boundsMin;
+		cell.boundsMax = proxies[i].boundsMax;
+		cell.switchDistance = proxies[i].switchDistance;
+		cell.firstNode = (uint32_t)nodes.size();
+		cell.nodeCount = (uint32_t)proxies[i].nodes.size();
+		cell.vertexCount = (uint32_t)proxies[i].vertices.size();
+		cell.indexCount = (uint32_t)proxies[i].indices.size();
+		cell.atlas = addString(proxies[i].atlas);
+		for (size_t n = 0; n < proxies[i].nodes.size(); n++)
+			nodes.push_back(addString(proxies[i].nodes[n]));
+	}
+	vector<HlodSource> sourceTable(sources.size());
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		sourceTable[i].path = addString(sources[i].first);
+		sourceTable[i].reserved = 0;
+		sourceTable[i].size = sources[i].second.size;
+		sourceTable[i].modified = sources[i].second.modified;
+	}
+
+	auto align16 = [](uint64_t offset) { return (offset + 15) & ~(uint64_t)15; };
+
+	HlodHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HLOD_MAGIC, sizeof(header.magic));
+	header.version = HLOD_VERSION;
+	header.sceneSize = scene.size;
+	header.sceneModified = scene.modified;
+	header.vertexSize = sizeof(Vertex);
+	header.cellCount = (uint32_t)cells.size();
+	header.sourceCount = (uint32_t)sourceTable.size();
+	header.nodeCount = (uint32_t)nodes.size();
+	header.stringsOffset = sizeof(HlodHeader) + cells.size() * sizeof(HlodCell) + sourceTable.size() * sizeof(HlodSource) + nodes.size() * sizeof(uint32_t);
+	header.stringsSize = strings.size();
+
+	uint64_t offset = align16(header.stringsOffset + header.stringsSize);
+	for (size_t i = 0; i < cells.size(); i++)
+	{
+		cells[i].vertexOffset = offset;
+		offset = align16(offset + cells[i].vertexCount * sizeof(Vertex));
+		cells[i].indexOffset = offset;
+		offset = align16(offset + cells[i].indexCount * sizeof(unsigned int));
+	}
+
+	// write to a temporary name and move it into place, as the mesh cache does
+	string tempPath = path + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+
+		const char zeros[16] = { 0 };
+		auto pad = [&out, &zeros, &align16]()
+		{
+			uint64_t position = (uint64_t)out.tellp();
+			out.write(zeros, (streamsize)(align16(position) - position));
+		};
+
+		out.write((const char*)&header, sizeof(header));
+		if (!cells.empty())
+			out.write((const char*)&cells[0], cells.size() * sizeof(HlodCell));
+		if (!sourceTable.empty())
+			out.write((const char*)&sourceTable[0], sourceTable.size() * sizeof(HlodSource));
+		if (!nodes.empty())
+			out.write((const char*)&nodes[0], nodes.size() * sizeof(uint32_t));
+		out.write(strings.data(), strings.size());
+		pad();
+		for (size_t i = 0; i < proxies.size(); i++)
+		{
+			out.write((const char*)proxies[i].vertices.data(), proxies[i].vertices.size() * sizeof(Vertex));
+			pad();
+			out.write((const char*)proxies[i].indices.data(), proxies[i].indices.size() * sizeof(unsigned int));
+			pad();
+		}
+		if (!out)
+		{
+			out.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+	remove(path.c_str());
+	if (rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// what the last HlodSet::update() decided
+struct HlodStats {
+	unsigned int cells;
+	unsigned int proxies;		// cells drawn as their proxy
+	unsigned int nodes;			// nodes those proxies stand in for
+};
+
+// The proxies of a scene at runtime. update() decides per cell whether it is drawn as its
+// proxy; while it is, the program leaves the cell's nodes out (see proxiedNodes) and Submit
+// queues the proxy instead.
+class HlodSet
+{
+public:
+	HlodSet() : enabled(true)
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	// gives the atlases and the geometry of the proxies back to their managers
+	~HlodSet()
+	{
+		for (size_t i = 0; i < proxies.size(); i++)
+		{
+			for (size_t t = 0; t < proxies[i].textures.size(); t++)
+				Textures().release(proxies[i].textures[t].handle);
+			proxies[i].releaseGeometry();
+		}
+	}
+
+	HlodSet(const HlodSet&) = delete;
+	HlodSet& operator=(const HlodSet&) = delete;
+
+	// loads the proxies baked for the scene loaded from scenePath and creates their GL objects;
+	// false with a message on the console if there are none or they are out of date
+	bool Load(const string &scenePath, const Scene &scene)
+	{
+		string path = HlodPath(scenePath);
+		MappedFile file;
+		FileStamp stamp;
+		if (!GetFileStamp(scenePath, stamp) || !file.open(path))
+		{
+			cout << "HLOD:: no proxies for " << scenePath << ", run tools/hlod_build to bake them" << endl;
+			return false;
+		}
+		if (!validate(file, stamp))
+		{
+			cout << "HLOD:: " << path << " is out of date, run tools/hlod_build to bake it again" << endl;
+			return false;
+		}
+		const HlodHeader *header = (const HlodHeader*)file.data();
+		const HlodCell *cellTable = (const HlodCell*)(file.data() + sizeof(HlodHeader));
+		const HlodSource *sources = (const HlodSource*)(cellTable + header->cellCount);
+		const uint32_t *nodeNames = (const uint32_t*)(sources + header->sourceCount);
+		const char *strings = (const char*)file.data() + header->stringsOffset;
+
+		nodeCells.assign(scene.nodeCount(), -1);
+		proxies.reserve(header->cellCount);
+		for (uint32_t c = 0; c < header->cellCount; c++)
+		{
+			const HlodCell &entry = cellTable[c];
+			Cell cell;
+			cell.center = (entry.boundsMin + entry.boundsMax) * 0.5f;
+			cell.extents = (entry.boundsMax - entry.boundsMin) * 0.5f;
+			cell.switchDistance = entry.switchDistance;
+			cell.proxied = false;
+			for (uint32_t n = 0; n < entry.nodeCount; n++)
+			{
+				int node = scene.find(strings + nodeNames[entry.firstNode + n]);
+				if (node < 0)
+					continue;
+				cell.nodes.push_back(node);
+				nodeCells[node] = (int)cells.size();
+			}
+			Texture atlas;
+			atlas.type = MaterialTextureTypeName(MATERIAL_TEXTURE_DIFFUSE);
+			atlas.path = strings + entry.atlas;
+			atlas.handle = Textures().acquire(atlas.path);
+			proxies.emplace_back((const Vertex*)(file.data() + entry.vertexOffset), entry.vertexCount, (const unsigned int*)(file.data() + entry.indexOffset), entry.indexCount,
+				vector<Texture>(1, atlas));
+			cells.push_back(cell);
+		}
+		proxiedNodeFlags.assign(scene.nodeCount(), 0);
+		stats.cells = (unsigned int)cells.size();
+		return true;
+	}
+
+	unsigned int cellCount() const { return (unsigned int)cells.size(); }
+
+	// the nodes cell stands in for
+	const vector<int>& nodes(unsigned int cell) const { return cells[cell].nodes; }
+
+	// by node, the cell it is baked into, -1 for none
+	int cellOf(int node) const { return node < (int)nodeCells.size() ? nodeCells[node] : -1; }
+
+	// true while cell is drawn as its proxy; false for -1, no cell
+	bool isProxied(int cell) const { return cell >= 0 && cells[cell].proxied; }
+
+	// by node, 1 while its cell is drawn as the proxy; leave these nodes out
+	const vector<uint8_t>& proxiedNodes() const { return proxiedNodeFlags; }
+
+	// switched off, every cell is drawn as its nodes from the next update() on
+	void setEnabled(bool on) { enabled = on; }
+	bool isEnabled() const { return enabled; }
+
+	// decides for every cell whether it is drawn as its proxy from eye; true if any cell switched
+	bool update(const glm::vec3 &eye)
+	{
+		bool switched = false;
+		stats.proxies = stats.nodes = 0;
+		for (size_t c = 0; c < cells.size(); c++)
+		{
+			Cell &cell = cells[c];
+			float distance = glm::length(glm::max(glm::abs(eye - cell.center) - cell.extents, glm::vec3(0.0f)));
+			float limit = cell.proxied ? cell.switchDistance * (1.0f - HLOD_HYSTERESIS) : cell.switchDistance;
+			bool proxied = enabled && distance > limit;
+			if (proxied != cell.proxied)
+			{
+				cell.proxied = proxied;
+				for (size_t n = 0; n < cell.nodes.size(); n++)
+					proxiedNodeFlags[cell.nodes[n]] = proxied ? 1 : 0;
+				switched = true;
+			}
+			if (proxied)
+			{
+				stats.proxies++;
+				stats.nodes += (unsigned int)cell.nodes.size();
+			}
+		}
+		return switched;
+	}
+
+	// queues the proxies of the cells update() picked, drawn with shader like any model
+	void Submit(RenderQueue &queue, const Shader &shader) const
+	{
+		for (size_t c = 0; c < cells.size(); c++)
+			if (cells[c].proxied)
+				proxies[c].Submit(queue, shader, glm::mat4());
+	}
+
+	const HlodStats& lastStats() const { return stats; }
+
+private:
+	struct Cell {
+		glm::vec3 center, extents;	// world space box around the cell's nodes
+		float switchDistance;
+		vector<int> nodes;
+		bool proxied;
+	};
+
+	vector<Cell> cells;
+	vector<Mesh> proxies;			// by cell
+	vector<int> nodeCells;			// by node
+	vector<uint8_t> proxiedNodeFlags;
+	bool enabled;
+	HlodStats stats;
+
+	// checks the file against the scene and the models, and every offset against its size
+	static bool validate(const MappedFile &file, const FileStamp &scene)
+	{
+		uint64_t size = file.size();
+		if (size < sizeof(HlodHeader))
+			return false;
+		const HlodHeader *h = (const HlodHeader*)file.data();
+		if (memcmp(h->magic, HLOD_MAGIC, sizeof(h->magic)) != 0 || h->version != HLOD_VERSION || h->vertexSize != sizeof(Vertex) ||
+			h->sceneSize != scene.size || h->sceneModified != scene.modified)
+			return false;
+		uint64_t tables = sizeof(HlodHeader) + (uint64_t)h->cellCount * sizeof(HlodCell) + (uint64_t)h->sourceCount * sizeof(HlodSource) +
+			(uint64_t)h->nodeCount * sizeof(uint32_t);
+		if (tables != h->stringsOffset || h->stringsOffset + h->stringsSize > size)
+			return false;
+		const char *strings = (const char*)file.data() + h->stringsOffset;
+		if (h->stringsSize == 0 || strings[h->stringsSize - 1] != '\0')
+			return false;
+		const HlodCell *cellTable = (const HlodCell*)(file.data() + sizeof(HlodHeader));
+		const HlodSource *sources = (const HlodSource*)(cellTable + h->cellCount);
+		const uint32_t *nodeNames = (const uint32_t*)(sources + h->sourceCount);
+		for (uint32_t i = 0; i < h->sourceCount; i++)
+		{
+			FileStamp stamp;
+			if (sources[i].path >= h->stringsSize || !GetFileStamp(strings + sources[i].path, stamp) ||
+				stamp.size != sources[i].size || stamp.modified != sources[i].modified)
+				return false;
+		}
+		for (uint32_t i = 0; i < h->nodeCount; i++)
+			if (nodeNames[i] >= h->stringsSize)
+				return false;
+		for (uint32_t c = 0; c < h->cellCount; c++)
+		{
+			const HlodCell &cell = cellTable[c];
+			if (cell.vertexOffset % 16 != 0 || cell.indexOffset % 16 != 0 ||
+				cell.vertexOffset + (uint64_t)cell.vertexCount * sizeof(Vertex) > size ||
+				cell.indexOffset + (uint64_t)cell.indexCount * sizeof(unsigned int) > size ||
+				(uint64_t)cell.firstNode + cell.nodeCount > h->nodeCount || cell.atlas >= h->stringsSize)
+				return false;
+			const unsigned int *indices = (const unsigned int*)(file.data() + cell.indexOffset);
+			for (uint32_t i = 0; i < cell.indexCount; i++)
+				if (indices[i] >= cell.vertexCount)
+					return false;
+		}
+		return true;
+	}
+};
+#endif
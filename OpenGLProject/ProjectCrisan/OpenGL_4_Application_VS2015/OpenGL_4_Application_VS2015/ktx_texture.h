@@ -0,0 +1,221 @@
+#ifndef KTX_TEXTURE_H
+#define KTX_TEXTURE_H
+
+#include "glad/glad.h"
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// block compressed formats; RGTC is core since 3.0, S3TC and BPTC come from extensions
+// that glad was not generated with, so their enums are spelled out here
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+// Cooked textures are KTX 1.1 files written by tools/texture_cook next to their source image
+// as <source>.ktx. They hold a BCn format with its complete mip chain, so the runtime only
+// has to copy blocks into the texture. The cook stores the size/time stamp of the source
+// under the KTX_SOURCE_KEY key; a cooked file whose stamp no longer matches is ignored.
+//
+//   KtxHeader
+//   key/value data (bytesOfKeyValueData)
+//   for every level: uint32 imageSize, then imageSize bytes per face, each padded to 4 bytes
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+const char KTX_SOURCE_KEY[] = "gps.source";
+
+struct KtxHeader {
+	unsigned char identifier[12];
+	uint32_t endianness;
+	uint32_t glType;
+	uint32_t glTypeSize;
+	uint32_t glFormat;
+	uint32_t glInternalFormat;
+	uint32_t glBaseInternalFormat;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t numberOfArrayElements;
+	uint32_t numberOfFaces;
+	uint32_t numberOfMipmapLevels;
+	uint32_t bytesOfKeyValueData;
+};
+
+// one face of one mip level inside a KTX file
+struct KtxLevel {
+	uint32_t width, height;
+	size_t offset, size;
+};
+
+inline string KtxPath(const string &sourcePath)
+{
+	return sourcePath + ".ktx";
+}
+
+// bytes per 4x4 block, 0 for formats the loader does not handle
+inline unsigned int BlockBytes(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+	case GL_COMPRESSED_RGBA_BPTC_UNORM:
+		return 16;
+	}
+	return 0;
+}
+
+inline size_t CompressedSize(GLenum internalFormat, uint32_t width, uint32_t height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(internalFormat);
+}
+
+inline string FormatStamp(const FileStamp &stamp)
+{
+	ostringstream out;
+	out << stamp.size << ' ' << stamp.modified;
+	return out.str();
+}
+
+// parses a 2D, single face KTX file of a supported block format; levels are returned finest first.
+// sourceStamp, when given, receives the stamp the cook recorded (empty if there is none)
+inline bool ParseKtx(const unsigned char *data, size_t size, KtxHeader &header, vector<KtxLevel> &levels, string *sourceStamp = NULL)
+{
+	if (size < sizeof(KtxHeader))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS ||
+		header.glType != 0 || BlockBytes(header.glInternalFormat) == 0 || header.pixelWidth == 0 || header.pixelHeight == 0 ||
+		header.pixelDepth > 1 || header.numberOfArrayElements > 1 || header.numberOfFaces != 1 || header.numberOfMipmapLevels > 32)
+		return false;
+
+	size_t offset = sizeof(KtxHeader);
+	if (header.bytesOfKeyValueData > size - offset)
+		return false;
+	size_t keyValueEnd = offset + header.bytesOfKeyValueData;
+	if (sourceStamp)
+		sourceStamp->clear();
+	while (offset + 4 <= keyValueEnd)
+	{
+		uint32_t pairSize;
+		memcpy(&pairSize, data + offset, 4);
+		offset += 4;
+		if (pairSize > keyValueEnd - offset)
+			return false;
+		const char *key = (const char*)data + offset;
+		size_t keyLength = strnlen(key, pairSize);
+		if (sourceStamp && keyLength < pairSize && strcmp(key, KTX_SOURCE_KEY) == 0)
+			sourceStamp->assign(key + keyLength + 1, strnlen(key + keyLength + 1, pairSize - keyLength - 1));
+		offset += (pairSize + 3) & ~3u;
+	}
+	offset = keyValueEnd;
+
+	levels.clear();
+	uint32_t count = header.numberOfMipmapLevels ? header.numberOfMipmapLevels : 1;
+	uint32_t width = header.pixelWidth, height = header.pixelHeight;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (offset + 4 > size)
+			return false;
+		uint32_t imageSize;
+		memcpy(&imageSize, data + offset, 4);
+		offset += 4;
+		if (imageSize != CompressedSize(header.glInternalFormat, width, height) || imageSize > size - offset)
+			return false;
+		KtxLevel level = { width, height, offset, imageSize };
+		levels.push_back(level);
+		offset += (imageSize + 3) & ~(size_t)3;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+// writes a single face KTX file; levels[i] holds the blocks of mip level i, finest first
+inline bool WriteKtx(const string &path, GLenum internalFormat, uint32_t width, uint32_t height, const vector<vector<unsigned char> > &levels, const string &sourceStamp)
+{
+	KtxHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	header.endianness = KTX_ENDIANNESS;
+	header.glTypeSize = 1;
+	header.glInternalFormat = internalFormat;
+	header.glBaseInternalFormat = internalFormat == GL_COMPRESSED_RED_RGTC1 ? GL_RED :
+		internalFormat == GL_COMPRESSED_RG_RGTC2 ? GL_RG :
+		internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? GL_RGB : GL_RGBA;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.numberOfFaces = 1;
+	header.numberOfMipmapLevels = (uint32_t)levels.size();
+
+	string pair = string(KTX_SOURCE_KEY) + '\0' + sourceStamp + '\0';
+	uint32_t pairSize = (uint32_t)pair.size();
+	pair.resize((pair.size() + 3) & ~(size_t)3, '\0');
+	header.bytesOfKeyValueData = 4 + (uint32_t)pair.size();
+
+	// same temporary file and rename dance as the mesh cache
+	string tempPath = path + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+		const char zeros[4] = { 0 };
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)&pairSize, 4);
+		out.write(pair.data(), pair.size());
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			uint32_t imageSize = (uint32_t)levels[i].size();
+			out.write((const char*)&imageSize, 4);
+			out.write((const char*)levels[i].data(), levels[i].size());
+			out.write(zeros, (3 - (levels[i].size() + 3) % 4));
+		}
+		if (!out)
+		{
+			out.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+	remove(path.c_str());
+	if (rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// formats the current context can sample from, call on the context thread
+inline vector<GLenum> SupportedCompressedFormats()
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+	vector<GLint> formats(count);
+	if (count > 0)
+		glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+	vector<GLenum> result(formats.begin(), formats.end());
+	// RGTC is core, but drivers are not required to list it
+	result.push_back(GL_COMPRESSED_RED_RGTC1);
+	result.push_back(GL_COMPRESSED_RG_RGTC2);
+	return result;
+}
+#endif
@@ -0,0 +1,333 @@
+#ifndef LOOSE_OCTREE_H
+#define LOOSE_OCTREE_H
+
+#include "glm/glm.hpp"
+
+#include "frustum.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// what the last LooseOctree::cull() looked at
+struct OctreeCullStats {
+	unsigned int nodesVisited;
+	unsigned int itemsTested;	// items tested one by one; items of nodes completely in view are not
+	unsigned int visible;
+};
+
+// A loose octree over items with world space Bounds, each known by a small integer id (e.g. a
+// scene node index). The cells of a node are doubled in every direction, so an item is stored
+// in the one node of the level its size calls for whose cell holds its center: inserting and
+// moving an item never looks at other items, and a node's loose box bounds everything below
+// it. Items outside the root cube live in the root, which is never culled as a whole.
+//
+// Culling walks down only the nodes in view and takes the items of nodes completely in view
+// without testing them, so its cost follows what is visible rather than the number of items.
+class LooseOctree
+{
+public:
+	// a tree over the cube around center with the given half size, at most maxDepth levels below the root
+	LooseOctree(const glm::vec3 &center, float halfSize, unsigned int maxDepth = 8) : maxDepth(maxDepth)
+	{
+		memset(&stats, 0, sizeof(stats));
+		nodes.push_back(Node());
+		nodes[0].center = center;
+		nodes[0].halfSize = halfSize;
+	}
+
+	// adds the item id with bounds; an id that is already in the tree is moved instead
+	void insert(int id, const Bounds &bounds)
+	{
+		if (id >= (int)items.size())
+			items.resize(id + 1);
+		if (items[id].node >= 0)
+			unlink(id);
+		items[id].bounds = bounds;
+		link(id, findNode(bounds));
+	}
+
+	// the item moved or changed size; it only changes node when it left its cell or level
+	void update(int id, const Bounds &bounds)
+	{
+		if (id >= (int)items.size() || items[id].node < 0)
+		{
+			insert(id, bounds);
+			return;
+		}
+		items[id].bounds = bounds;
+		const Node &node = nodes[items[id].node];
+		if (levelOf(bounds) == node.depth && insideCell(node, bounds.center))
+			return;
+		unlink(id);
+		link(id, findNode(bounds));
+	}
+
+	void remove(int id)
+	{
+		if (id < (int)items.size() && items[id].node >= 0)
+			unlink(id);
+	}
+
+	bool contains(int id) const { return id < (int)items.size() && items[id].node >= 0; }
+
+	const Bounds& bounds(int id) const { return items[id].bounds; }
+
+	// the ids of the items whose bounds intersect frustum, in no particular order
+	void cull(const Frustum &frustum, vector<int> &visible)
+	{
+		visible.clear();
+		memset(&stats, 0, sizeof(stats));
+		candidates.clear();
+		candidateIds.clear();
+		cullNode(0, frustum, false, visible);
+
+		// the items of partly visible nodes are tested together, four at a time
+		candidates.cull(frustum, candidateVisible);
+		for (size_t i = 0; i < candidateIds.size(); i++)
+			if (candidateVisible[i])
+				visible.push_back(candidateIds[i]);
+		stats.itemsTested = (unsigned int)candidateIds.size();
+		stats.visible = (unsigned int)visible.size();
+	}
+
+	const OctreeCullStats& lastCullStats() const { return stats; }
+
+	// the ids of the items whose boxes overlap the sphere
+	void overlapSphere(const glm::vec3 &center, float radius, vector<int> &result) const
+	{
+		result.clear();
+		overlapNode(0, [&](const glm::vec3 &boxCenter, const glm::vec3 &extents) {
+			return DistanceSquared(center, boxCenter, extents) <= radius * radius;
+		}, result);
+	}
+
+	// the ids of the items whose boxes overlap the box from boxMin to boxMax
+	void overlapBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax, vector<int> &result) const
+	{
+		result.clear();
+		glm::vec3 center = (boxMin + boxMax) * 0.5f, extents = (boxMax - boxMin) * 0.5f;
+		overlapNode(0, [&](const glm::vec3 &boxCenter, const glm::vec3 &boxExtents) {
+			glm::vec3 gap = glm::abs(boxCenter - center) - boxExtents - extents;
+			return gap.x <= 0.0f && gap.y <= 0.0f && gap.z <= 0.0f;
+		}, result);
+	}
+
+	// the ids of the (up to) count items whose boxes are closest to point, closest first. Nodes
+	// are opened in order of distance, so only those nearer than the count-th item are visited.
+	void nearest(const glm::vec3 &point, unsigned int count, vector<int> &result) const
+	{
+		result.clear();
+		// (squared distance, index), nodes as index, items as -1 - id
+		typedef pair<float, int> Entry;
+		priority_queue<Entry, vector<Entry>, greater<Entry> > open;
+		open.push(Entry(0.0f, 0));
+		while (!open.empty() && result.size() < count)
+		{
+			Entry entry = open.top();
+			open.pop();
+			if (entry.second < 0)
+			{
+				result.push_back(-1 - entry.second);
+				continue;
+			}
+			const Node &node = nodes[entry.second];
+			for (int id = node.firstItem; id >= 0; id = items[id].next)
+				open.push(Entry(DistanceSquared(point, items[id].bounds.center, items[id].bounds.extents), -1 - id));
+			for (int i = 0; i < 8; i++)
+				if (node.children[i] >= 0)
+					open.push(Entry(DistanceSquared(point, nodes[node.children[i]].center, looseExtents(nodes[node.children[i]])), node.children[i]));
+		}
+	}
+
+private:
+	struct Node {
+		glm::vec3 center;		// of the cell; the loose box has twice its half size
+		float halfSize;
+		int parent;
+		int children[8];		// by octant, -1 for none
+		int firstItem;			// items stored here, linked through Item::next
+		unsigned int count;		// items here and below, the node is freed when it drops to 0
+		unsigned int depth;
+		unsigned int octant;	// index in the parent's children
+
+		Node() : center(0.0f), halfSize(0.0f), parent(-1), firstItem(-1), count(0), depth(0), octant(0)
+		{
+			for (int i = 0; i < 8; i++)
+				children[i] = -1;
+		}
+	};
+
+	struct Item {
+		Bounds bounds;
+		int node;			// -1 while not in the tree
+		int previous, next;	// in the item list of the node
+
+		Item() : node(-1), previous(-1), next(-1) {}
+	};
+
+	vector<Node> nodes;
+	vector<int> freeNodes;
+	vector<Item> items;		// by id
+	unsigned int maxDepth;
+
+	// culling scratch, kept between frames
+	CullBatch candidates;
+	vector<int> candidateIds;
+	vector<uint8_t> candidateVisible;
+	OctreeCullStats stats;
+
+	static glm::vec3 looseExtents(const Node &node) { return glm::vec3(node.halfSize * 2.0f); }
+
+	// squared distance from point to the box around center
+	static float DistanceSquared(const glm::vec3 &point, const glm::vec3 &center, const glm::vec3 &extents)
+	{
+		glm::vec3 gap = glm::max(glm::abs(point - center) - extents, glm::vec3(0.0f));
+		return glm::dot(gap, gap);
+	}
+
+	static bool insideCell(const Node &node, const glm::vec3 &point)
+	{
+		glm::vec3 offset = glm::abs(point - node.center);
+		return offset.x <= node.halfSize && offset.y <= node.halfSize && offset.z <= node.halfSize;
+	}
+
+	// the deepest level whose cells are at least as large as the item: a center anywhere in
+	// such a cell keeps the item inside the cell's loose box
+	unsigned int levelOf(const Bounds &bounds) const
+	{
+		float size = max(bounds.extents.x, max(bounds.extents.y, bounds.extents.z));
+		if (size <= 0.0f)
+			return maxDepth;
+		float levels = floor(log2(nodes[0].halfSize / size));
+		return levels <= 0.0f ? 0 : (unsigned int)min((float)maxDepth, levels);
+	}
+
+	// the node an item with bounds belongs in, creating the nodes on the way
+	int findNode(const Bounds &bounds)
+	{
+		if (!insideCell(nodes[0], bounds.center))
+			return 0;
+		unsigned int level = levelOf(bounds);
+		int index = 0;
+		while (nodes[index].depth < level)
+		{
+			const Node &node = nodes[index];
+			unsigned int octant = (bounds.center.x > node.center.x ? 1 : 0) | (bounds.center.y > node.center.y ? 2 : 0) | (bounds.center.z > node.center.z ? 4 : 0);
+			int child = node.children[octant];
+			index = child >= 0 ? child : allocateNode(index, octant);
+		}
+		return index;
+	}
+
+	int allocateNode(int parent, unsigned int octant)
+	{
+		int index;
+		if (!freeNodes.empty())
+		{
+			index = freeNodes.back();
+			freeNodes.pop_back();
+			nodes[index] = Node();
+		}
+		else
+		{
+			index = (int)nodes.size();
+			nodes.push_back(Node());
+		}
+		Node &node = nodes[index];
+		const Node &parentNode = nodes[parent];
+		float half = parentNode.halfSize * 0.5f;
+		node.center = parentNode.center + glm::vec3(octant & 1 ? half : -half, octant & 2 ? half : -half, octant & 4 ? half : -half);
+		node.halfSize = half;
+		node.parent = parent;
+		node.depth = parentNode.depth + 1;
+		node.octant = octant;
+		nodes[parent].children[octant] = index;
+		return index;
+	}
+
+	void link(int id, int nodeIndex)
+	{
+		Item &item = items[id];
+		item.node = nodeIndex;
+		item.previous = -1;
+		item.next = nodes[nodeIndex].firstItem;
+		if (item.next >= 0)
+			items[item.next].previous = id;
+		nodes[nodeIndex].firstItem = id;
+		for (int n = nodeIndex; n >= 0; n = nodes[n].parent)
+			nodes[n].count++;
+	}
+
+	// takes the item out of its node and frees the nodes left empty
+	void unlink(int id)
+	{
+		Item &item = items[id];
+		Node &node = nodes[item.node];
+		if (item.previous >= 0)
+			items[item.previous].next = item.next;
+		else
+			node.firstItem = item.next;
+		if (item.next >= 0)
+			items[item.next].previous = item.previous;
+		for (int n = item.node; n >= 0;)
+		{
+			int parent = nodes[n].parent;
+			if (--nodes[n].count == 0 && parent >= 0)
+			{
+				nodes[parent].children[nodes[n].octant] = -1;
+				freeNodes.push_back(n);
+			}
+			n = parent;
+		}
+		item.node = item.previous = item.next = -1;
+	}
+
+	void cullNode(int index, const Frustum &frustum, bool inside, vector<int> &visible)
+	{
+		const Node &node = nodes[index];
+		stats.nodesVisited++;
+		if (!inside && index != 0)
+		{
+			FrustumTest test = frustum.classify(node.center, looseExtents(node));
+			if (test == FRUSTUM_OUTSIDE)
+				return;
+			inside = test == FRUSTUM_INSIDE;
+		}
+		for (int id = node.firstItem; id >= 0; id = items[id].next)
+		{
+			if (inside)
+				visible.push_back(id);
+			else
+			{
+				candidates.add(items[id].bounds);
+				candidateIds.push_back(id);
+			}
+		}
+		for (int i = 0; i < 8; i++)
+			if (node.children[i] >= 0)
+				cullNode(node.children[i], frustum, inside, visible);
+	}
+
+	// collects the items below index whose boxes pass overlaps, skipping nodes whose loose box does not
+	template <typename Overlaps>
+	void overlapNode(int index, const Overlaps &overlaps, vector<int> &result) const
+	{
+		const Node &node = nodes[index];
+		if (index != 0 && !overlaps(node.center, looseExtents(node)))
+			return;
+		for (int id = node.firstItem; id >= 0; id = items[id].next)
+			if (overlaps(items[id].bounds.center, items[id].bounds.extents))
+				result.push_back(id);
+		for (int i = 0; i < 8; i++)
+			if (node.children[i] >= 0)
+				overlapNode(node.children[i], overlaps, result);
+	}
+};
+#endif
@@ -0,0 +1,155 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX 1
+#endif
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file. The OS pages the contents in on demand, so large cooked
+// assets can be handed to the GL without first being copied into a heap buffer.
+class MappedFile
+{
+public:
+	MappedFile() : ptr(NULL), length(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+	{
+	}
+
+	explicit MappedFile(const std::string &path) : MappedFile()
+	{
+		open(path);
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	// no copies, the view has a single owner
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// maps the file at path, returns false if it does not exist or is empty
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			close();
+			return false;
+		}
+		ptr = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (ptr == NULL)
+		{
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void *view = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference to the file
+		if (view == MAP_FAILED)
+			return false;
+		ptr = static_cast<const unsigned char*>(view);
+		length = static_cast<size_t>(st.st_size);
+#endif
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (ptr)
+			UnmapViewOfFile(ptr);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (ptr)
+			munmap(const_cast<unsigned char*>(ptr), length);
+#endif
+		ptr = NULL;
+		length = 0;
+	}
+
+	bool isOpen() const { return ptr != NULL; }
+	const unsigned char* data() const { return ptr; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char *ptr;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+// size and modification time of a file on disk, used to tell whether derived data is stale
+struct FileStamp
+{
+	uint64_t size;
+	int64_t modified;
+
+	bool operator==(const FileStamp &other) const { return size == other.size && modified == other.modified; }
+	bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
+
+inline bool GetFileStamp(const std::string &path, FileStamp &stamp)
+{
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path.c_str(), &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return false;
+#endif
+	stamp.size = static_cast<uint64_t>(st.st_size);
+	stamp.modified = static_cast<int64_t>(st.st_mtime);
+	return true;
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "glad/glad.h"
+
+#include "shader_s.h"
+#include "texture_manager.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+// a texture reference of a mesh as the importers produce it
+struct Texture {
+	TextureHandle handle;
+	string type;
+	string path;
+};
+
+// The sampler uniforms a material feeds are named texture_<type><n>, as the importers name
+// the texture types. Each of them reads a fixed texture unit:
+//
+//   unit = (n - 1) * MATERIAL_TEXTURE_TYPES + type
+//
+// so texture_diffuse1, texture_specular1, texture_normal1 and texture_height1 are units 0 to 3
+// and the second texture of each type follows on 4 to 7. The sampler uniforms of a program are
+// pointed at their units once (Material::BindSamplers), drawing only binds textures.
+enum MaterialTextureType {
+	MATERIAL_TEXTURE_DIFFUSE,
+	MATERIAL_TEXTURE_SPECULAR,
+	MATERIAL_TEXTURE_NORMAL,
+	MATERIAL_TEXTURE_HEIGHT,
+	MATERIAL_TEXTURE_TYPES
+};
+
+const unsigned int MATERIAL_TEXTURES_PER_TYPE = 2;
+const unsigned int MAX_MATERIAL_TEXTURES = MATERIAL_TEXTURE_TYPES * MATERIAL_TEXTURES_PER_TYPE;
+
+inline const char* MaterialTextureTypeName(MaterialTextureType type)
+{
+	static const char *names[MATERIAL_TEXTURE_TYPES] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+	return names[type];
+}
+
+// the type behind an importer texture type name, MATERIAL_TEXTURE_TYPES if there is none
+inline MaterialTextureType MaterialTextureTypeFromName(const string &name)
+{
+	for (int type = 0; type < MATERIAL_TEXTURE_TYPES; type++)
+		if (name == MaterialTextureTypeName((MaterialTextureType)type))
+			return (MaterialTextureType)type;
+	return MATERIAL_TEXTURE_TYPES;
+}
+
+// The textures of a mesh sorted into their units when the mesh is created. Binding it is a
+// loop over a fixed array: no strings, no uniform lookups and no allocation per draw.
+class Material
+{
+public:
+	float shininess;	// specular exponent, the "shininess" uniform of the lit shaders
+	GLenum target;		// what the textures are bound as, GL_TEXTURE_CUBE_MAP for the sky
+
+	Material() : shininess(32.0f), target(GL_TEXTURE_2D), unitCount(0), materialId(NextMaterialId())
+	{
+		for (unsigned int unit = 0; unit < MAX_MATERIAL_TEXTURES; unit++)
+			textures[unit] = 0;
+	}
+
+	// sorts textures (with acquired handles) into their units; textures beyond
+	// MATERIAL_TEXTURES_PER_TYPE of a type, or of an unknown type, are left out
+	explicit Material(const vector<Texture> &textures, GLenum target = GL_TEXTURE_2D) : Material()
+	{
+		unsigned int count[MATERIAL_TEXTURE_TYPES] = { 0 };
+		for (size_t i = 0; i < textures.size(); i++)
+		{
+			MaterialTextureType type = MaterialTextureTypeFromName(textures[i].type);
+			if (type == MATERIAL_TEXTURE_TYPES || count[type] == MATERIAL_TEXTURES_PER_TYPE)
+				continue;
+			unsigned int unit = count[type]++ * MATERIAL_TEXTURE_TYPES + type;
+			this->textures[unit] = textures[i].handle;
+			unitCount = unit + 1 > unitCount ? unit + 1 : unitCount;
+		}
+		// the first unit of every type is always bound, so a material without a specular map
+		// samples black there instead of whatever the previous mesh left behind
+		unitCount = max<unsigned int>(unitCount, MATERIAL_TEXTURE_TYPES);
+		this->target = target;
+	}
+
+	// small number telling materials apart in draw sort keys
+	unsigned int id() const { return materialId; }
+
+	// whether binding other instead leaves the same textures bound and shininess set
+	bool sameAs(const Material &other) const
+	{
+		if (target != other.target || unitCount != other.unitCount || shininess != other.shininess)
+			return false;
+		for (unsigned int unit = 0; unit < unitCount; unit++)
+			if (textures[unit] != other.textures[unit])
+				return false;
+		return true;
+	}
+
+	// binds the textures to their units. The GL names are looked up on every bind since a
+	// texture is a placeholder until the manager has streamed it in.
+	void Bind() const
+	{
+		for (unsigned int unit = 0; unit < unitCount; unit++)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(target, textures[unit] ? Textures().glName(textures[unit]) : 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// points the texture_<type><n> samplers of shader at their units; once per program
+	// that draws models, before its first draw
+	static void BindSamplers(const Shader &shader)
+	{
+		shader.use();
+		for (unsigned int unit = 0; unit < MAX_MATERIAL_TEXTURES; unit++)
+		{
+			string name = MaterialTextureTypeName((MaterialTextureType)(unit % MATERIAL_TEXTURE_TYPES)) + to_string(unit / MATERIAL_TEXTURE_TYPES + 1);
+			shader.setInt(name, (int)unit);
+		}
+	}
+
+private:
+	TextureHandle textures[MAX_MATERIAL_TEXTURES];	// by unit, 0 for none
+	unsigned int unitCount;							// units Bind() touches
+	unsigned int materialId;
+
+	static unsigned int NextMaterialId()
+	{
+		static unsigned int next = 0;
+		return ++next;
+	}
+};
+#endif
@@ -6,8 +6,15 @@
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
+#include "frustum.h"
+#include "geometry_pool.h"
+#include "material.h"
+#include "render_queue.h"
 #include "shader_s.h"
+#include "texture_manager.h"
+#include "vertex_format.h"
 
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -15,125 +22,254 @@
 #include <vector>
 using namespace std;
 
-struct Vertex {
-	// position
-	glm::vec3 Position;
-	// normal
-	glm::vec3 Normal;
-	// texCoords
-	glm::vec2 TexCoords;
-	// tangent
-	glm::vec3 Tangent;
-	// bitangent
-	glm::vec3 Bitangent;
+// a simplified level of a mesh (see mesh_simplify.h): a range of indices into the same
+// vertices as the full mesh, and how far it strays from the full mesh
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;			// model space distance
 };
 
-struct Texture {
-	unsigned int id;
-	string type;
-	string path;
+// a level is drawn while its error covers at most this many pixels
+const float MESH_LOD_PIXEL_ERROR = 1.0f;
+// and is only left once the error is this fraction past that, either way
+const float MESH_LOD_HYSTERESIS = 0.25f;
+
+// CPU side mesh as produced by the importers, before it is handed to the GL
+struct MeshData {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<Texture> textures; // only type and path are filled in, the owning Model acquires the handles
+	string material;
+	vector<unsigned int> lodIndices;	// the simplified levels after each other, ranges of lods
+	vector<MeshLod> lods;				// coarser and coarser, the full mesh is not one of them
+};
+
+// what a mesh is needed for besides drawing. Only meshes with a CPU side use keep their
+// vertices and indices in system memory once they are uploaded.
+enum MeshUsage {
+	MESH_USAGE_DRAW = 0,
+	MESH_USAGE_COLLISION = 1 << 0,
+	MESH_USAGE_PICKING = 1 << 1
 };
 
 class Mesh {
 public:
 	/*  Mesh Data  */
-	vector<Vertex> vertices;
-	vector<unsigned int> indices;
-	vector<Texture> textures;
-	unsigned int VAO;
+	vector<Vertex> vertices;		// empty unless the mesh was created with a CPU usage
+	vector<unsigned int> indices;	// likewise
+	vector<Texture> textures;		// the references the owning Model releases
+	Material material;				// the same textures sorted into their units
+	GeometryRange geometry;			// where the vertices and indices are in the geometry pools
+	unsigned int indexCount;		// of the full level
+	vector<MeshLod> lods;			// every level, the full one first; ranges of the indices in the pool
+	GLenum indexType;
+	VertexFormat format;
+	glm::vec3 boundsMin, boundsMax;	// model space bounds of the vertices
+	float boundsRadius;				// radius of the sphere around the center of those bounds holding every vertex
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor; pass the data in with std::move, it is released after the upload unless usage needs it.
+	// lodIndices and lods are the simplified levels, if the mesh has any.
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexLayout layout = VERTEX_LAYOUT_COMPACT, unsigned int usage = MESH_USAGE_DRAW,
+		const vector<unsigned int> &lodIndices = vector<unsigned int>(), const vector<MeshLod> &lods = vector<MeshLod>())
+		: textures(std::move(textures)), material(this->textures)
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), layout, lodIndices.data(), lods.data(), lods.size());
+		if (usage != MESH_USAGE_DRAW)
+		{
+			this->vertices = std::move(vertices);
+			this->indices = std::move(indices);
+		}
 	}
 
-	// render the mesh
-	void Draw(Shader shader)
+	// constructor for data that already lives somewhere else (e.g. a mapped cache file);
+	// the buffers are filled straight from the given memory, a CPU copy is only made if usage needs it.
+	Mesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount, vector<Texture> textures, VertexLayout layout = VERTEX_LAYOUT_COMPACT, unsigned int usage = MESH_USAGE_DRAW,
+		const unsigned int *lodIndices = NULL, const MeshLod *lods = NULL, size_t lodCount = 0)
+		: textures(std::move(textures)), material(this->textures)
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
+		setupMesh(vertices, vertexCount, indices, indexCount, layout, lodIndices, lods, lodCount);
+		if (usage != MESH_USAGE_DRAW)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-			else if (name == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-													 // now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			this->vertices.assign(vertices, vertices + vertexCount);
+			this->indices.assign(indices, indices + indexCount);
 		}
+	}
+
+	// render the mesh; samplers have to be set up with Material::BindSamplers. Leaves the
+	// vertex array of the mesh's pool bound, the next mesh of the pool draws from it as well.
+	void Draw(const Shader &shader) const
+	{
+		if (geometry.pool < 0)
+			return;
+		material.Bind();
+		shader.setFloat(UNIFORM_SHININESS, material.shininess);
+
+		// how the vertex shader unpacks this mesh's vertices
+		shader.setVec3(UNIFORM_POSITION_OFFSET, format.positionOffset);
+		shader.setVec3(UNIFORM_POSITION_SCALE, format.positionScale);
+		shader.setBool(UNIFORM_OCTAHEDRAL_NORMALS, format.layout != VERTEX_LAYOUT_FLOAT);
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		glBindVertexArray(Geometry().vertexArray(geometry.pool));
+		glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, indexType, (void*)geometry.indexOffset, geometry.baseVertex);
+	}
+
+	// world space bounds of the mesh placed by model
+	Bounds bounds(const glm::mat4 &model) const
+	{
+		return TransformBounds(model, boundsMin, boundsMax, boundsRadius);
+	}
+
+	// the level to draw where one model space unit of the mesh covers pixelsPerUnit pixels,
+	// given the level drawn last time: the coarsest whose error covers at most
+	// MESH_LOD_PIXEL_ERROR pixels, except that current is kept while its error is within
+	// MESH_LOD_HYSTERESIS of that, so a mesh at a switching distance does not flicker. 0 pixels
+	// per unit, a queue without a projection scale, is full detail
+	unsigned int selectLod(float pixelsPerUnit, unsigned int current) const
+	{
+		if (pixelsPerUnit <= 0.0f)
+			return 0;
+		unsigned int fine = 0, coarse = 0;
+		for (unsigned int i = 1; i < lods.size(); i++)
+		{
+			float pixels = lods[i].error * pixelsPerUnit;
+			if (pixels <= MESH_LOD_PIXEL_ERROR)
+				fine = i;
+			if (pixels <= MESH_LOD_PIXEL_ERROR * (1.0f - MESH_LOD_HYSTERESIS))
+				coarse = i;
+		}
+		if (current >= lods.size())
+			return fine;
+		if (current < coarse)
+			return coarse;
+		if (lods[current].error * pixelsPerUnit > MESH_LOD_PIXEL_ERROR * (1.0f + MESH_LOD_HYSTERESIS))
+			return fine;
+		return current;
+	}
+
+	// queues the mesh for drawing with shader, transformed by model; the queue drops it if it is out of view.
+	// With level, the level drawn last time for this placement, the mesh is drawn at the level
+	// selectLod picks for the queue's view and level is updated; without, at full detail.
+	void Submit(RenderQueue &queue, const Shader &shader, const glm::mat4 &model, RenderPass pass = RENDER_PASS_OPAQUE, uint8_t *level = NULL) const
+	{
+		if (geometry.pool < 0)
+			return;
+		Bounds worldBounds = bounds(model);
+		unsigned int lod = 0;
+		if (level)
+		{
+			float scale = boundsRadius > 0.0f ? worldBounds.radius / boundsRadius : 1.0f;
+			lod = *level = (uint8_t)selectLod(queue.pixelsPerUnit(worldBounds) * scale, *level);
+		}
+		DrawItem item;
+		item.shader = &shader;
+		item.material = &material;
+		item.format = &format;
+		item.vao = Geometry().vertexArray(geometry.pool);
+		item.indexType = indexType;
+		item.count = (GLsizei)lods[lod].indexCount;
+		item.instanceCount = 0;
+		item.indexOffset = geometry.indexOffset + lods[lod].firstIndex * IndexSize(indexType);
+		item.baseVertex = geometry.baseVertex;
+		item.model = model;
+		queue.submit(pass, item, worldBounds);
+	}
+
+	// makes buffer, an array of glm::mat4, the per instance model matrices of this mesh's
+	// instanced draws; the meshes of a pool sharing a buffer share the vertex array as well
+	void attachInstances(GLuint buffer)
+	{
+		instanceVAO = Geometry().instancedVertexArray(geometry.pool, buffer);
+	}
+
+	// gives the vertices and indices back to the geometry pool, the mesh cannot be drawn afterwards
+	void releaseGeometry()
+	{
+		Geometry().release(geometry);
+		indexCount = 0;
+		lods.clear();
+	}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	// queues one instanced draw of the attached instances at level, shader has to be an
+	// INSTANCED variant; bounds are the world bounds of all of them
+	void SubmitInstances(RenderQueue &queue, const Shader &shader, GLsizei instanceCount, const Bounds &bounds, RenderPass pass = RENDER_PASS_OPAQUE, unsigned int level = 0) const
+	{
+		if (geometry.pool < 0)
+			return;
+		DrawItem item;
+		item.shader = &shader;
+		item.material = &material;
+		item.format = &format;
+		item.vao = instanceVAO;
+		item.indexType = indexType;
+		item.count = (GLsizei)lods[level].indexCount;
+		item.instanceCount = instanceCount;
+		item.indexOffset = geometry.indexOffset + lods[level].firstIndex * IndexSize(indexType);
+		item.baseVertex = geometry.baseVertex;
+		item.model = glm::mat4();
+		queue.submit(pass, item, bounds);
 	}
 
 private:
 	/*  Render data  */
-	unsigned int VBO, EBO;
+	GLuint instanceVAO;		// see attachInstances
 
 	/*  Functions    */
-	// initializes all the buffer objects/arrays
-	void setupMesh()
+	// copies the vertices and the indices of every level into the geometry pool of their format
+	void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, VertexLayout layout,
+		const unsigned int *lodIndexData, const MeshLod *lodData, size_t lodCount)
 	{
-		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
-		glBindVertexArray(VAO);
-		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-		glBindVertexArray(0);
+		this->indexCount = indexCount;
+		instanceVAO = 0;
+		format = ChooseVertexFormat(vertexData, vertexCount, layout);
+		boundsMin = boundsMax = vertexCount ? vertexData[0].Position : glm::vec3(0.0f);
+		for (size_t i = 1; i < vertexCount; i++)
+		{
+			boundsMin = glm::min(boundsMin, vertexData[i].Position);
+			boundsMax = glm::max(boundsMax, vertexData[i].Position);
+		}
+		glm::vec3 boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++)
+			radiusSquared = max(radiusSquared, glm::dot(vertexData[i].Position - boundsCenter, vertexData[i].Position - boundsCenter));
+		boundsRadius = sqrt(radiusSquared);
+		const void *bufferData = vertexData;
+		vector<unsigned char> packed;
+		if (layout != VERTEX_LAYOUT_FLOAT)
+		{
+			PackVertices(vertexData, vertexCount, format, packed);
+			bufferData = packed.data();
+		}
+
+		// the levels follow the full mesh in one index range
+		MeshLod full = { 0, (uint32_t)indexCount, 0.0f };
+		lods.assign(1, full);
+		vector<unsigned int> allIndices;
+		if (lodCount)
+		{
+			allIndices.assign(indexData, indexData + indexCount);
+			for (size_t i = 0; i < lodCount; i++)
+			{
+				MeshLod lod = lodData[i];
+				lod.firstIndex = (uint32_t)allIndices.size();
+				allIndices.insert(allIndices.end(), lodIndexData + lodData[i].firstIndex, lodIndexData + lodData[i].firstIndex + lodData[i].indexCount);
+				lods.push_back(lod);
+			}
+			indexData = allIndices.data();
+		}
+		size_t totalIndices = lodCount ? allIndices.size() : indexCount;
+
+		// 16 bit indices whenever the vertex count allows
+		indexType = ChooseIndexType(vertexCount);
+		vector<unsigned short> shortIndices;
+		if (indexType == GL_UNSIGNED_SHORT)
+			shortIndices.assign(indexData, indexData + totalIndices);
+		const void *indexBytes = shortIndices.empty() ? (const void*)indexData : shortIndices.data();
+
+		geometry = Geometry().allocate(format, bufferData, vertexCount, indexBytes, totalIndices * IndexSize(indexType));
 	}
 };
 #endif
\ No newline at end of file
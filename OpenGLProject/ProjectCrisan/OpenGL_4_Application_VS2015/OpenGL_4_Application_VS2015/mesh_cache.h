@@ -0,0 +1,311 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// Cooked model format. A model imported through Assimp is written next to its source as
+// <source>.mcache and later launches map that file and upload the blobs directly.
+//
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   MeshCacheTexture[textureCount]
+//   MeshLod[lodCount]
+//   string table (NUL terminated)
+//   vertex/index/LOD index blobs, each starting on a 16 byte boundary
+//
+// All offsets are from the start of the file. The cache is stale as soon as the version,
+// the import flags or the size/time stamp of the source file no longer match.
+
+const char MESH_CACHE_MAGIC[4] = { 'G', 'P', 'S', 'M' };
+const uint32_t MESH_CACHE_VERSION = 5;	// 2: normals keep their z component, 3: optimized meshes, 4: split for 16 bit indices, 5: levels of detail
+
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t sourceSize;
+	int64_t sourceModified;
+	uint32_t importFlags;
+	uint32_t vertexSize;
+	uint32_t meshCount;
+	uint32_t textureCount;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+	uint32_t lodCount;
+	uint32_t reserved;
+};
+
+struct MeshCacheEntry {
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+	uint64_t lodIndexOffset;
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t lodIndexCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	uint32_t material; // string table offset
+	uint32_t firstLod;
+	uint32_t lodCount;
+};
+
+struct MeshCacheTexture {
+	uint32_t type; // string table offset
+	uint32_t path; // string table offset
+};
+
+inline string MeshCachePath(const string &sourcePath)
+{
+	return sourcePath + ".mcache";
+}
+
+// writes the imported meshes of a model; returns false (and leaves no file behind) on failure
+inline bool WriteMeshCache(const string &cachePath, const FileStamp &source, uint32_t importFlags, const vector<MeshData> &meshes)
+{
+	// string table, texture references and entries first so that all offsets are known up front
+	string strings;
+	auto addString = [&strings](const string &str) -> uint32_t
+	{
+		uint32_t offset = (uint32_t)strings.size();
+		strings.append(str);
+		strings.push_back('\0');
+		return offset;
+	};
+
+	vector<MeshCacheEntry> entries(meshes.size());
+	vector<MeshCacheTexture> textures;
+	vector<MeshLod> lods;
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		MeshCacheEntry &entry = entries[i];
+		memset(&entry, 0, sizeof(entry));
+		entry.vertexCount = (uint32_t)meshes[i].vertices.size();
+		entry.indexCount = (uint32_t)meshes[i].indices.size();
+		entry.firstTexture = (uint32_t)textures.size();
+		entry.textureCount = (uint32_t)meshes[i].textures.size();
+		entry.material = addString(meshes[i].material);
+		entry.lodIndexCount = (uint32_t)meshes[i].lodIndices.size();
+		entry.firstLod = (uint32_t)lods.size();
+		entry.lodCount = (uint32_t)meshes[i].lods.size();
+		lods.insert(lods.end(), meshes[i].lods.begin(), meshes[i].lods.end());
+		for (size_t t = 0; t < meshes[i].textures.size(); t++)
+		{
+			MeshCacheTexture texture;
+			texture.type = addString(meshes[i].textures[t].type);
+			texture.path = addString(meshes[i].textures[t].path);
+			textures.push_back(texture);
+		}
+	}
+
+	auto align16 = [](uint64_t offset) { return (offset + 15) & ~(uint64_t)15; };
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = source.size;
+	header.sourceModified = source.modified;
+	header.importFlags = importFlags;
+	header.vertexSize = sizeof(Vertex);
+	header.meshCount = (uint32_t)entries.size();
+	header.textureCount = (uint32_t)textures.size();
+	header.lodCount = (uint32_t)lods.size();
+	header.stringsOffset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) + textures.size() * sizeof(MeshCacheTexture) + lods.size() * sizeof(MeshLod);
+	header.stringsSize = strings.size();
+
+	uint64_t offset = align16(header.stringsOffset + header.stringsSize);
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		entries[i].vertexOffset = offset;
+		offset = align16(offset + entries[i].vertexCount * sizeof(Vertex));
+		entries[i].indexOffset = offset;
+		offset = align16(offset + entries[i].indexCount * sizeof(unsigned int));
+		entries[i].lodIndexOffset = offset;
+		offset = align16(offset + entries[i].lodIndexCount * sizeof(unsigned int));
+	}
+
+	// write to a temporary name and move it into place, a crash halfway never leaves a truncated cache
+	string tempPath = cachePath + ".tmp";
+	{
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+			return false;
+
+		const char zeros[16] = { 0 };
+		auto pad = [&out, &zeros, &align16]()
+		{
+			uint64_t position = (uint64_t)out.tellp();
+			out.write(zeros, (streamsize)(align16(position) - position));
+		};
+
+		out.write((const char*)&header, sizeof(header));
+		if (!entries.empty())
+			out.write((const char*)&entries[0], entries.size() * sizeof(MeshCacheEntry));
+		if (!textures.empty())
+			out.write((const char*)&textures[0], textures.size() * sizeof(MeshCacheTexture));
+		if (!lods.empty())
+			out.write((const char*)&lods[0], lods.size() * sizeof(MeshLod));
+		out.write(strings.data(), strings.size());
+		pad();
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			out.write((const char*)meshes[i].vertices.data(), meshes[i].vertices.size() * sizeof(Vertex));
+			pad();
+			out.write((const char*)meshes[i].indices.data(), meshes[i].indices.size() * sizeof(unsigned int));
+			pad();
+			out.write((const char*)meshes[i].lodIndices.data(), meshes[i].lodIndices.size() * sizeof(unsigned int));
+			pad();
+		}
+		if (!out)
+		{
+			out.close();
+			remove(tempPath.c_str());
+			return false;
+		}
+	}
+	remove(cachePath.c_str());
+	if (rename(tempPath.c_str(), cachePath.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+// a mapped and validated cache file; the accessors point straight into the mapping
+class MeshCache
+{
+public:
+	// maps the cache and checks it against the source, false means it is missing, stale or corrupt
+	bool open(const string &cachePath, const FileStamp &source, uint32_t importFlags)
+	{
+		if (!file.open(cachePath))
+			return false;
+		if (!validate(source, importFlags))
+		{
+			file.close();
+			return false;
+		}
+		return true;
+	}
+
+	unsigned int meshCount() const { return header()->meshCount; }
+
+	const MeshCacheEntry& mesh(unsigned int i) const
+	{
+		return ((const MeshCacheEntry*)(file.data() + sizeof(MeshCacheHeader)))[i];
+	}
+
+	const Vertex* vertices(unsigned int i) const
+	{
+		return (const Vertex*)(file.data() + mesh(i).vertexOffset);
+	}
+
+	const unsigned int* indices(unsigned int i) const
+	{
+		return (const unsigned int*)(file.data() + mesh(i).indexOffset);
+	}
+
+	// the simplified levels of mesh i, entry.lodCount of them, ranges of lodIndices(i)
+	const MeshLod* lods(unsigned int i) const
+	{
+		return lodTable() + mesh(i).firstLod;
+	}
+
+	const unsigned int* lodIndices(unsigned int i) const
+	{
+		return (const unsigned int*)(file.data() + mesh(i).lodIndexOffset);
+	}
+
+	string material(unsigned int i) const
+	{
+		return string(strings() + mesh(i).material);
+	}
+
+	// texture references of mesh i, the handles are left for the caller to acquire
+	vector<Texture> textures(unsigned int i) const
+	{
+		const MeshCacheEntry &entry = mesh(i);
+		vector<Texture> result(entry.textureCount);
+		for (unsigned int t = 0; t < entry.textureCount; t++)
+		{
+			const MeshCacheTexture &ref = textureTable()[entry.firstTexture + t];
+			result[t].handle = 0;
+			result[t].type = strings() + ref.type;
+			result[t].path = strings() + ref.path;
+		}
+		return result;
+	}
+
+private:
+	MappedFile file;
+
+	const MeshCacheHeader* header() const { return (const MeshCacheHeader*)file.data(); }
+
+	const MeshCacheTexture* textureTable() const
+	{
+		return (const MeshCacheTexture*)(file.data() + sizeof(MeshCacheHeader) + header()->meshCount * sizeof(MeshCacheEntry));
+	}
+
+	const MeshLod* lodTable() const
+	{
+		return (const MeshLod*)(textureTable() + header()->textureCount);
+	}
+
+	const char* strings() const { return (const char*)file.data() + header()->stringsOffset; }
+
+	bool validate(const FileStamp &source, uint32_t importFlags) const
+	{
+		uint64_t size = file.size();
+		if (size < sizeof(MeshCacheHeader))
+			return false;
+		const MeshCacheHeader *h = header();
+		if (memcmp(h->magic, MESH_CACHE_MAGIC, sizeof(h->magic)) != 0 || h->version != MESH_CACHE_VERSION ||
+			h->vertexSize != sizeof(Vertex) || h->importFlags != importFlags ||
+			h->sourceSize != source.size || h->sourceModified != source.modified)
+			return false;
+
+		// every offset has to stay inside the file, a truncated cache is treated like a stale one
+		uint64_t tables = sizeof(MeshCacheHeader) + (uint64_t)h->meshCount * sizeof(MeshCacheEntry) + (uint64_t)h->textureCount * sizeof(MeshCacheTexture) +
+			(uint64_t)h->lodCount * sizeof(MeshLod);
+		if (tables != h->stringsOffset || h->stringsOffset + h->stringsSize > size)
+			return false;
+		if (h->stringsSize != 0 && strings()[h->stringsSize - 1] != '\0')
+			return false;
+		for (unsigned int i = 0; i < h->meshCount; i++)
+		{
+			const MeshCacheEntry &entry = mesh(i);
+			if (entry.vertexOffset % 16 != 0 || entry.indexOffset % 16 != 0 || entry.lodIndexOffset % 16 != 0 ||
+				entry.vertexOffset + (uint64_t)entry.vertexCount * sizeof(Vertex) > size ||
+				entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int) > size ||
+				entry.lodIndexOffset + (uint64_t)entry.lodIndexCount * sizeof(unsigned int) > size ||
+				(uint64_t)entry.firstTexture + entry.textureCount > h->textureCount ||
+				(uint64_t)entry.firstLod + entry.lodCount > h->lodCount ||
+				entry.material >= h->stringsSize)
+				return false;
+			for (unsigned int t = 0; t < entry.indexCount; t++)
+				if (indices(i)[t] >= entry.vertexCount)
+					return false;
+			for (unsigned int t = 0; t < entry.lodIndexCount; t++)
+				if (lodIndices(i)[t] >= entry.vertexCount)
+					return false;
+			for (unsigned int l = 0; l < entry.lodCount; l++)
+				if ((uint64_t)lods(i)[l].firstIndex + lods(i)[l].indexCount > entry.lodIndexCount)
+					return false;
+		}
+		for (unsigned int t = 0; t < h->textureCount; t++)
+			if (textureTable()[t].type >= h->stringsSize || textureTable()[t].path >= h->stringsSize)
+				return false;
+		return true;
+	}
+};
+#endif
@@ -0,0 +1,396 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "glm/glm.hpp"
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Import time clean up of the triangle lists the importers produce. Both emit one vertex
+// per face corner, so without this stage every triangle runs the vertex shader three times.
+// OptimizeMesh runs the steps in order:
+//
+//   WeldVertices         merges bitwise identical vertices
+//   OptimizeVertexCache  reorders triangles for the post transform cache (Forsyth's linear speed scoring)
+//   OptimizeOverdraw     sorts clusters of that order so outward facing ones are drawn first (Sander et al.)
+//   OptimizeVertexFetch  renumbers vertices in first use order so the vertex buffer is read front to back
+//
+// Their effect is measured as ACMR, the average number of vertex shader runs per triangle
+// for a FIFO cache of VERTEX_CACHE_SIZE entries: 3 for unshared vertices, around 0.6 to 0.7
+// for a well ordered regular mesh.
+
+// cache size ACMR is measured with; 16 entries is what older hardware guarantees
+const unsigned int VERTEX_CACHE_SIZE = 16;
+// cache size the triangle order is optimized for; the scoring degrades gracefully on smaller caches
+const unsigned int VERTEX_CACHE_OPTIMIZE_SIZE = 32;
+// how much worse than the cache optimized order the ACMR of an overdraw cluster may get
+const float OVERDRAW_ACMR_THRESHOLD = 1.05f;
+
+struct MeshOptimizeStats {
+	size_t verticesBefore, verticesAfter, triangles;
+	float acmrBefore;	// as imported
+	float acmrWelded;	// after welding, in the original triangle order
+	float acmrAfter;
+};
+
+// vertex shader runs per triangle for a FIFO cache of cacheSize entries
+inline float ComputeACMR(const unsigned int *indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+	if (indexCount < 3)
+		return 0.0f;
+	// a vertex is cached while fewer than cacheSize misses happened after its own
+	vector<size_t> stamp(vertexCount, 0);
+	size_t misses = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		unsigned int v = indices[i];
+		if (stamp[v] == 0 || misses - stamp[v] >= cacheSize)
+			stamp[v] = ++misses;
+	}
+	return (float)misses / (float)(indexCount / 3);
+}
+
+// merges vertices with identical bytes and rewrites the indices; returns the new vertex count
+inline size_t WeldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+	size_t buckets = 1;
+	while (buckets < vertices.size() * 2)
+		buckets *= 2;
+	const unsigned int EMPTY = ~0u;
+	vector<unsigned int> table(buckets, EMPTY);
+	vector<unsigned int> remap(vertices.size());
+	size_t unique = 0;
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		// FNV-1a over the vertex, open addressing with linear probing
+		const unsigned char *bytes = (const unsigned char*)&vertices[i];
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t b = 0; b < sizeof(Vertex); b++)
+			hash = (hash ^ bytes[b]) * 1099511628211ull;
+		size_t slot = (size_t)hash & (buckets - 1);
+		while (table[slot] != EMPTY && memcmp(&vertices[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+			slot = (slot + 1) & (buckets - 1);
+		if (table[slot] == EMPTY)
+		{
+			// unique vertices are compacted in place, always at or before i
+			vertices[unique] = vertices[i];
+			table[slot] = (unsigned int)unique++;
+		}
+		remap[i] = table[slot];
+	}
+	vertices.resize(unique);
+	for (size_t i = 0; i < indices.size(); i++)
+		indices[i] = remap[indices[i]];
+	return unique;
+}
+
+// Forsyth's scoring for a vertex at cachePosition (-1 when not cached) with activeTriangles left to draw
+inline float VertexCacheScore(int cachePosition, unsigned int activeTriangles)
+{
+	if (activeTriangles == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// the last triangle's vertices get a fixed score so that strips do not run off in one direction
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = pow(1.0f - (float)(cachePosition - 3) / (VERTEX_CACHE_OPTIMIZE_SIZE - 3), 1.5f);
+	}
+	// prefer vertices with few triangles left, finishing them off frees the cache
+	return score + 2.0f / sqrt((float)activeTriangles);
+}
+
+// reorders triangles so that consecutive ones share as many vertices as possible
+inline void OptimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+		return;
+
+	// triangles around each vertex; the first active[v] entries are the ones not drawn yet
+	vector<unsigned int> offsets(vertexCount + 1, 0), active(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++)
+		active[indices[i]]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + active[v];
+	vector<unsigned int> adjacency(triangleCount * 3), filled(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+		for (int k = 0; k < 3; k++)
+			adjacency[filled[indices[3 * t + k]]++] = (unsigned int)t;
+
+	vector<int> cachePosition(vertexCount, -1);
+	vector<float> vertexScore(vertexCount), triangleScore(triangleCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = VertexCacheScore(-1, active[v]);
+	for (size_t t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+	vector<bool> emitted(triangleCount, false);
+
+	vector<unsigned int> cache, nextCache;
+	cache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+	nextCache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+	vector<unsigned int> result;
+	result.reserve(indices.size());
+	size_t best = (size_t)(max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+	size_t scan = 0;	// triangles before this one are all emitted
+	while (result.size() < indices.size())
+	{
+		if (best == (size_t)-1)
+		{
+			// nothing in the cache has triangles left, continue with the next one in input order
+			while (emitted[scan])
+				scan++;
+			best = scan;
+		}
+		emitted[best] = true;
+		const unsigned int *triangle = &indices[3 * best];
+		result.insert(result.end(), triangle, triangle + 3);
+
+		// the triangle's vertices move to the front of the cache
+		nextCache.assign(triangle, triangle + 3);
+		for (size_t i = 0; i < cache.size(); i++)
+			if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+				nextCache.push_back(cache[i]);
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = triangle[k];
+			unsigned int *around = &adjacency[offsets[v]];
+			for (unsigned int i = 0; i < active[v]; i++)
+			{
+				if (around[i] == best)
+				{
+					swap(around[i], around[active[v] - 1]);
+					active[v]--;
+					break;
+				}
+			}
+		}
+
+		// rescore everything that was or is in the cache and pick the best triangle around it
+		for (size_t i = 0; i < nextCache.size(); i++)
+			cachePosition[nextCache[i]] = i < VERTEX_CACHE_OPTIMIZE_SIZE ? (int)i : -1;
+		for (size_t i = 0; i < nextCache.size(); i++)
+		{
+			unsigned int v = nextCache[i];
+			float score = VertexCacheScore(cachePosition[v], active[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+			const unsigned int *around = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < active[v]; j++)
+				triangleScore[around[j]] += delta;
+		}
+		best = (size_t)-1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < nextCache.size() && i < VERTEX_CACHE_OPTIMIZE_SIZE; i++)
+		{
+			unsigned int v = nextCache[i];
+			const unsigned int *around = &adjacency[offsets[v]];
+			for (unsigned int j = 0; j < active[v]; j++)
+			{
+				if (triangleScore[around[j]] > bestScore)
+				{
+					bestScore = triangleScore[around[j]];
+					best = around[j];
+				}
+			}
+		}
+		if (nextCache.size() > VERTEX_CACHE_OPTIMIZE_SIZE)
+			nextCache.resize(VERTEX_CACHE_OPTIMIZE_SIZE);
+		cache.swap(nextCache);
+	}
+	indices.swap(result);
+}
+
+// FIFO cache simulation step shared by the overdraw passes; returns how many of the triangle's vertices missed
+inline unsigned int TriangleCacheMisses(const unsigned int *triangle, vector<size_t> &stamp, size_t &time)
+{
+	unsigned int misses = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		unsigned int v = triangle[k];
+		if (stamp[v] == 0 || time - stamp[v] >= VERTEX_CACHE_SIZE)
+		{
+			stamp[v] = ++time;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+// Splits a cache optimized order into clusters and draws the ones facing away from the mesh
+// center first, so that front most surfaces tend to be rasterized before what they hide.
+// Clusters start at triangles that miss the cache entirely and are cut further as long as
+// each piece stays within threshold of their ACMR, which keeps most of the cache gains.
+inline void OptimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, float threshold = OVERDRAW_ACMR_THRESHOLD)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+		return;
+
+	// hard boundaries: triangles the cache optimized order starts from scratch anyway
+	vector<size_t> hard;
+	vector<size_t> stamp(vertices.size(), 0);
+	size_t time = 0;
+	for (size_t t = 0; t < triangleCount; t++)
+		if (TriangleCacheMisses(&indices[3 * t], stamp, time) == 3 || t == 0)
+			hard.push_back(t);
+	hard.push_back(triangleCount);
+
+	// soft boundaries: cut a hard cluster wherever the part so far is within threshold of its
+	// ACMR; reordered clusters start with a cold cache, so both are measured that way
+	vector<size_t> clusters;	// first triangle of every cluster
+	for (size_t h = 0; h + 1 < hard.size(); h++)
+	{
+		time += VERTEX_CACHE_SIZE;
+		size_t misses = 0;
+		for (size_t t = hard[h]; t < hard[h + 1]; t++)
+			misses += TriangleCacheMisses(&indices[3 * t], stamp, time);
+		float clusterACMR = (float)misses / (hard[h + 1] - hard[h]);
+
+		time += VERTEX_CACHE_SIZE;
+		clusters.push_back(hard[h]);
+		size_t partMisses = 0, partTriangles = 0;
+		for (size_t t = hard[h]; t < hard[h + 1]; t++)
+		{
+			partMisses += TriangleCacheMisses(&indices[3 * t], stamp, time);
+			partTriangles++;
+			if (t + 1 < hard[h + 1] && partMisses <= threshold * clusterACMR * partTriangles)
+			{
+				clusters.push_back(t + 1);
+				time += VERTEX_CACHE_SIZE;
+				partMisses = partTriangles = 0;
+			}
+		}
+	}
+
+	glm::vec3 meshCenter(0.0f);
+	for (size_t i = 0; i < vertices.size(); i++)
+		meshCenter += vertices[i].Position;
+	meshCenter /= (float)max<size_t>(1, vertices.size());
+
+	// area weighted center and normal of each cluster give how much it faces outwards
+	vector<pair<float, size_t> > order(clusters.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c]; t < end; t++)
+		{
+			const glm::vec3 &a = vertices[indices[3 * t]].Position;
+			const glm::vec3 &b = vertices[indices[3 * t + 1]].Position;
+			const glm::vec3 &d = vertices[indices[3 * t + 2]].Position;
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(n);
+			center += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		float length = glm::length(normal);
+		float facing = area > 0.0f && length > 0.0f ? glm::dot(center / area - meshCenter, normal / length) : 0.0f;
+		order[c] = make_pair(-facing, c);
+	}
+	stable_sort(order.begin(), order.end(), [](const pair<float, size_t> &a, const pair<float, size_t> &b) { return a.first < b.first; });
+
+	vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		size_t c = order[i].second;
+		size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		result.insert(result.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * end);
+	}
+	indices.swap(result);
+}
+
+// renumbers vertices in the order the indices first use them and drops unused ones
+inline void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+	const unsigned int UNUSED = ~0u;
+	vector<unsigned int> remap(vertices.size(), UNUSED);
+	vector<Vertex> result;
+	result.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		unsigned int &target = remap[indices[i]];
+		if (target == UNUSED)
+		{
+			target = (unsigned int)result.size();
+			result.push_back(vertices[indices[i]]);
+		}
+		indices[i] = target;
+	}
+	vertices.swap(result);
+}
+
+// Cuts mesh into pieces of at most maxVertices vertices that keep its triangle order, so an
+// optimized mesh stays optimized; each piece shares the material and textures of mesh.
+// Meshes that are small enough come back as the only piece.
+inline void SplitMesh(MeshData &mesh, size_t maxVertices, vector<MeshData> &pieces)
+{
+	if (mesh.vertices.size() <= maxVertices)
+	{
+		pieces.push_back(std::move(mesh));
+		return;
+	}
+	const unsigned int UNUSED = ~0u;
+	vector<unsigned int> remap(mesh.vertices.size(), UNUSED);
+	vector<unsigned int> used;	// vertices remapped for the current piece
+	MeshData piece;
+	piece.textures = mesh.textures;
+	piece.material = mesh.material;
+	for (size_t t = 0; t < mesh.indices.size(); t += 3)
+	{
+		unsigned int added = 0;
+		for (int k = 0; k < 3; k++)
+			added += remap[mesh.indices[t + k]] == UNUSED ? 1 : 0;
+		if (piece.vertices.size() + added > maxVertices)
+		{
+			for (size_t i = 0; i < used.size(); i++)
+				remap[used[i]] = UNUSED;
+			used.clear();
+			pieces.push_back(std::move(piece));
+			piece = MeshData();
+			piece.textures = mesh.textures;
+			piece.material = mesh.material;
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int &target = remap[mesh.indices[t + k]];
+			if (target == UNUSED)
+			{
+				target = (unsigned int)piece.vertices.size();
+				piece.vertices.push_back(mesh.vertices[mesh.indices[t + k]]);
+				used.push_back(mesh.indices[t + k]);
+			}
+			piece.indices.push_back(target);
+		}
+	}
+	pieces.push_back(std::move(piece));
+}
+
+// runs every step on mesh and reports what they did
+inline MeshOptimizeStats OptimizeMesh(MeshData &mesh)
+{
+	MeshOptimizeStats stats;
+	stats.verticesBefore = mesh.vertices.size();
+	stats.triangles = mesh.indices.size() / 3;
+	stats.acmrBefore = ComputeACMR(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	WeldVertices(mesh.vertices, mesh.indices);
+	stats.acmrWelded = ComputeACMR(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	OptimizeVertexCache(mesh.indices, mesh.vertices.size());
+	OptimizeOverdraw(mesh.indices, mesh.vertices);
+	OptimizeVertexFetch(mesh.vertices, mesh.indices);
+	stats.verticesAfter = mesh.vertices.size();
+	stats.acmrAfter = ComputeACMR(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	return stats;
+}
+#endif
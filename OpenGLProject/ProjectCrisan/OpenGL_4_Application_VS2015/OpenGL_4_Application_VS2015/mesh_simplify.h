@@ -0,0 +1,380 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include "glm/glm.hpp"
+
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+// Import time level of detail. BuildMeshLods simplifies an optimized mesh a few times over,
+// each level to a quarter of the triangles of the one before, with quadric error metrics
+// (Garland and Heckbert). A collapse moves a vertex onto a neighbour instead of a new
+// position, so every level is just another index list over the mesh's own vertices and the
+// vertex buffer is shared by all of them.
+//
+// Vertices that share a position but differ in their other attributes (texture seams, hard
+// edges) share one quadric and are never the vertex that moves, which would tear the seam
+// open; open borders only collapse along themselves. Collapses that would flip a triangle
+// are rejected.
+
+// levels after the full mesh
+const unsigned int MESH_LOD_LEVELS = 3;
+// meshes with fewer triangles keep only the full level
+const size_t MESH_LOD_MIN_TRIANGLES = 256;
+// each level aims for this fraction of the triangles of the level before
+const float MESH_LOD_REDUCTION = 0.25f;
+// a level that gets no further than this fraction of the level before ends the chain
+const float MESH_LOD_MIN_REDUCTION = 0.6f;
+// cosine of the largest turn of a triangle's normal a collapse may cause
+const float MESH_LOD_MAX_NORMAL_TURN = 0.2f;
+
+// symmetric 4x4 matrix summing weighted squared distances to planes, upper triangle by rows,
+// and the sum of the weights
+struct Quadric {
+	double m[10];
+	double weight;
+
+	Quadric() : weight(0.0) { memset(m, 0, sizeof(m)); }
+
+	// the plane n.p + d = 0 with unit n, counted weight times
+	void addPlane(const glm::dvec3 &n, double d, double weight)
+	{
+		m[0] += weight * n.x * n.x; m[1] += weight * n.x * n.y; m[2] += weight * n.x * n.z; m[3] += weight * n.x * d;
+		m[4] += weight * n.y * n.y; m[5] += weight * n.y * n.z; m[6] += weight * n.y * d;
+		m[7] += weight * n.z * n.z; m[8] += weight * n.z * d;
+		m[9] += weight * d * d;
+		this->weight += weight;
+	}
+
+	void add(const Quadric &other)
+	{
+		for (int i = 0; i < 10; i++)
+			m[i] += other.m[i];
+		weight += other.weight;
+	}
+
+	double error(const glm::dvec3 &p) const
+	{
+		double e = m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x
+			+ m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y
+			+ m[7] * p.z * p.z + 2.0 * m[8] * p.z + m[9];
+		return e > 0.0 ? e : 0.0;
+	}
+
+	// the root mean square distance of p to the planes
+	double distance(const glm::dvec3 &p) const
+	{
+		return weight > 0.0 ? sqrt(error(p) / weight) : 0.0;
+	}
+};
+
+// One simplification run over a mesh: simplify() collapses edges, cheapest first, until at
+// most the given number of triangles is left, and can be called again with fewer to go on
+// from there.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+		: triangles(indices), liveTriangles(indices.size() / 3), maxError(0.0)
+	{
+		size_t vertexCount = vertices.size();
+		positions.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+			positions[i] = glm::dvec3(vertices[i].Position);
+		weldPositions(vertices);
+		dead.assign(vertexCount, 0);
+		stamps.assign(vertexCount, 0);
+		vertexTriangles.resize(vertexCount);
+		for (size_t t = 0; t < liveTriangles; t++)
+			for (int k = 0; k < 3; k++)
+				vertexTriangles[triangles[t * 3 + k]].push_back((unsigned int)t);
+		triangleAlive.assign(liveTriangles, 1);
+
+		// every triangle's plane goes into the quadrics of its corners, weighted by its area
+		quadrics.resize(vertexCount);
+		for (size_t t = 0; t < liveTriangles; t++)
+		{
+			glm::dvec3 a = positions[triangles[t * 3]], b = positions[triangles[t * 3 + 1]], c = positions[triangles[t * 3 + 2]];
+			glm::dvec3 normal = glm::cross(b - a, c - a);
+			double length = glm::length(normal);
+			if (length <= 0.0)
+				continue;
+			normal /= length;
+			for (int k = 0; k < 3; k++)
+				quadrics[positionOf[triangles[t * 3 + k]]].addPlane(normal, -glm::dot(normal, a), length * 0.5);
+		}
+		findBorders();
+
+		for (size_t t = 0; t < triangles.size() / 3; t++)
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+				push(a, b);
+				push(b, a);
+			}
+	}
+
+	// collapses until at most targetTriangles are left or nothing more can go; returns how many are left.
+	// Collapses that would move the surface further than errorLimit are left out.
+	size_t simplify(size_t targetTriangles, double errorLimit = DBL_MAX)
+	{
+		while (liveTriangles > targetTriangles && !candidates.empty())
+		{
+			Candidate candidate = candidates.top();
+			candidates.pop();
+			if (dead[candidate.from] || dead[candidate.to] || candidate.fromStamp != stamps[candidate.from] || candidate.toStamp != stamps[candidate.to])
+				continue;
+			if (candidate.distance > errorLimit || !canCollapse(candidate.from, candidate.to))
+				continue;
+			collapse(candidate.from, candidate.to);
+			maxError = max(maxError, candidate.distance);
+		}
+		return liveTriangles;
+	}
+
+	// the triangles left, as indices into the original vertices
+	void indices(vector<unsigned int> &result) const
+	{
+		result.clear();
+		result.reserve(liveTriangles * 3);
+		for (size_t t = 0; t < triangleAlive.size(); t++)
+			if (triangleAlive[t])
+				result.insert(result.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+	}
+
+	// how far the surface can have moved so far, in model space units: the largest distance of
+	// a collapsed vertex to the planes it stands for
+	float error() const { return (float)maxError; }
+
+private:
+	struct Candidate {
+		double cost;		// the area weighted quadric error, collapses in small areas go first
+		double distance;
+		unsigned int from, to;
+		unsigned int fromStamp, toStamp;
+
+		bool operator<(const Candidate &other) const { return cost > other.cost; }
+	};
+
+	vector<glm::dvec3> positions;
+	vector<unsigned int> positionOf;			// by vertex, the first vertex with the same position
+	vector<uint8_t> seam;						// by vertex, the position is shared with another vertex
+	vector<uint8_t> border;						// by vertex, the position is on an open border
+	unordered_set<uint64_t> borderEdges;		// position pairs, smaller first
+	vector<Quadric> quadrics;					// by position
+	vector<unsigned int> triangles;
+	vector<uint8_t> triangleAlive;
+	size_t liveTriangles;
+	vector<vector<unsigned int> > vertexTriangles;
+	vector<uint8_t> dead;
+	vector<unsigned int> stamps;				// bumped when a vertex's quadric changes, staling its candidates
+	priority_queue<Candidate> candidates;
+	double maxError;			// largest distance of a collapse so far
+
+	static uint64_t EdgeKey(unsigned int a, unsigned int b)
+	{
+		return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+	}
+
+	void weldPositions(const vector<Vertex> &vertices)
+	{
+		size_t buckets = 1;
+		while (buckets < vertices.size() * 2)
+			buckets *= 2;
+		const unsigned int EMPTY = ~0u;
+		vector<unsigned int> table(buckets, EMPTY);
+		positionOf.resize(vertices.size());
+		seam.assign(vertices.size(), 0);
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const unsigned char *bytes = (const unsigned char*)&vertices[i].Position;
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t b = 0; b < sizeof(glm::vec3); b++)
+				hash = (hash ^ bytes[b]) * 1099511628211ull;
+			size_t slot = (size_t)hash & (buckets - 1);
+			while (table[slot] != EMPTY && vertices[table[slot]].Position != vertices[i].Position)
+				slot = (slot + 1) & (buckets - 1);
+			if (table[slot] == EMPTY)
+				table[slot] = (unsigned int)i;
+			else
+				seam[table[slot]] = seam[i] = 1;
+			positionOf[i] = table[slot];
+		}
+		for (size_t i = 0; i < vertices.size(); i++)
+			seam[i] = seam[positionOf[i]];
+	}
+
+	// edges of only one triangle, compared by position so seams do not count; their vertices
+	// also get the plane through the edge at right angles to the triangle, which keeps the
+	// border in place
+	void findBorders()
+	{
+		unordered_set<uint64_t> once;
+		for (size_t t = 0; t < triangles.size() / 3; t++)
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t key = EdgeKey(positionOf[triangles[t * 3 + k]], positionOf[triangles[t * 3 + (k + 1) % 3]]);
+				if (!once.insert(key).second)
+					once.erase(key);
+			}
+		borderEdges.swap(once);
+		border.assign(positions.size(), 0);
+		for (size_t t = 0; t < triangles.size() / 3; t++)
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int a = positionOf[triangles[t * 3 + k]], b = positionOf[triangles[t * 3 + (k + 1) % 3]];
+				if (!borderEdges.count(EdgeKey(a, b)))
+					continue;
+				border[a] = border[b] = 1;
+				glm::dvec3 pa = positions[a], pb = positions[b], pc = positions[triangles[t * 3 + (k + 2) % 3]];
+				glm::dvec3 edge = pb - pa;
+				glm::dvec3 normal = glm::cross(edge, glm::cross(edge, pc - pa));
+				double length = glm::length(normal);
+				if (length <= 0.0)
+					continue;
+				normal /= length;
+				double weight = glm::dot(edge, edge);
+				quadrics[a].addPlane(normal, -glm::dot(normal, pa), weight);
+				quadrics[b].addPlane(normal, -glm::dot(normal, pa), weight);
+			}
+		for (size_t i = 0; i < positions.size(); i++)
+			border[i] = border[positionOf[i]];
+	}
+
+	// queues moving from onto to, unless from may never move
+	void push(unsigned int from, unsigned int to)
+	{
+		if (seam[from] || positionOf[from] == positionOf[to])
+			return;
+		if (border[from] && !borderEdges.count(EdgeKey(positionOf[from], positionOf[to])))
+			return;
+		Quadric sum = quadrics[positionOf[from]];
+		sum.add(quadrics[positionOf[to]]);
+		Candidate candidate;
+		candidate.cost = sum.error(positions[to]);
+		candidate.distance = sum.distance(positions[to]);
+		candidate.from = from;
+		candidate.to = to;
+		candidate.fromStamp = stamps[from];
+		candidate.toStamp = stamps[to];
+		candidates.push(candidate);
+	}
+
+	// from and to still share a triangle, and none of from's other triangles turns over
+	bool canCollapse(unsigned int from, unsigned int to) const
+	{
+		bool adjacent = false;
+		const vector<unsigned int> &around = vertexTriangles[from];
+		for (size_t i = 0; i < around.size(); i++)
+		{
+			const unsigned int *triangle = &triangles[around[i] * 3];
+			if (!triangleAlive[around[i]])
+				continue;
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				adjacent = true;
+				continue;
+			}
+			glm::dvec3 corners[3], moved[3];
+			for (int k = 0; k < 3; k++)
+			{
+				corners[k] = positions[triangle[k]];
+				moved[k] = triangle[k] == from ? positions[to] : corners[k];
+			}
+			glm::dvec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			glm::dvec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+			double lengths = glm::length(before) * glm::length(after);
+			if (lengths <= 0.0 || glm::dot(before, after) < MESH_LOD_MAX_NORMAL_TURN * lengths)
+				return false;
+		}
+		return adjacent;
+	}
+
+	void collapse(unsigned int from, unsigned int to)
+	{
+		quadrics[positionOf[to]].add(quadrics[positionOf[from]]);
+		vector<unsigned int> &around = vertexTriangles[from];
+		vector<unsigned int> &target = vertexTriangles[to];
+		for (size_t i = 0; i < around.size(); i++)
+		{
+			unsigned int t = around[i];
+			if (!triangleAlive[t])
+				continue;
+			unsigned int *triangle = &triangles[t * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+			{
+				triangleAlive[t] = 0;
+				liveTriangles--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+				if (triangle[k] == from)
+					triangle[k] = to;
+			target.push_back(t);
+		}
+		vector<unsigned int>().swap(around);
+		dead[from] = 1;
+
+		// drop the triangles to lost, then queue the edges around to again; the flip test of
+		// the neighbours' other candidates is redone when they come up
+		size_t kept = 0;
+		for (size_t i = 0; i < target.size(); i++)
+			if (triangleAlive[target[i]])
+				target[kept++] = target[i];
+		target.resize(kept);
+		stamps[to]++;
+		for (size_t i = 0; i < target.size(); i++)
+		{
+			const unsigned int *triangle = &triangles[target[i] * 3];
+			for (int k = 0; k < 3; k++)
+			{
+				if (triangle[k] == to)
+					continue;
+				push(triangle[k], to);
+				push(to, triangle[k]);
+			}
+		}
+	}
+};
+
+// adds the simplified levels of mesh, an optimized mesh, to its lodIndices and lods; each
+// level is reordered for the vertex cache like the full mesh. Small meshes get none.
+inline void BuildMeshLods(MeshData &mesh)
+{
+	mesh.lodIndices.clear();
+	mesh.lods.clear();
+	size_t triangles = mesh.indices.size() / 3;
+	if (triangles < MESH_LOD_MIN_TRIANGLES)
+		return;
+	MeshSimplifier simplifier(mesh.vertices, mesh.indices);
+	vector<unsigned int> level;
+	for (unsigned int i = 0; i < MESH_LOD_LEVELS; i++)
+	{
+		size_t target = (size_t)(triangles * MESH_LOD_REDUCTION);
+		size_t left = simplifier.simplify(target);
+		if (!left || left > triangles * MESH_LOD_MIN_REDUCTION)
+			break;
+		simplifier.indices(level);
+		OptimizeVertexCache(level, mesh.vertices.size());
+		MeshLod lod;
+		lod.firstIndex = (uint32_t)mesh.lodIndices.size();
+		lod.indexCount = (uint32_t)level.size();
+		lod.error = simplifier.error();
+		mesh.lodIndices.insert(mesh.lodIndices.end(), level.begin(), level.end());
+		mesh.lods.push_back(lod);
+		triangles = left;
+		if (triangles < MESH_LOD_MIN_TRIANGLES)
+			break;
+	}
+}
+#endif
@@ -10,65 +10,402 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 
+#include "frustum.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "obj_import.h"
 #include "shader_s.h"
+#include "texture_manager.h"
+#include "thread_pool.h"
+#include "triangle_bvh.h"
 
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <future>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma = false);
+
+// everything a Model needs from disk. It is produced without touching the GL, so it can be
+// built on any thread; only turning it into a Model has to happen on the context thread.
+struct ModelData
+{
+	string directory;
+	vector<MeshData> meshes;				// result of an Assimp import, empty when the cache was used
+	unique_ptr<MeshCache> cache;			// mapped cooked model, null when Assimp was used
+	unique_ptr<TriangleBvh> collision;		// for models imported for collision or picking
+
+	unsigned int meshCount() const
+	{
+		return cache ? cache->meshCount() : (unsigned int)meshes.size();
+	}
+
+	vector<Texture> textures(unsigned int i) const
+	{
+		return cache ? cache->textures(i) : meshes[i].textures;
+	}
+
+	// the full level of mesh i, wherever it lives
+	const Vertex* vertices(unsigned int i) const
+	{
+		return cache ? cache->vertices(i) : meshes[i].vertices.data();
+	}
+
+	size_t vertexCount(unsigned int i) const
+	{
+		return cache ? cache->mesh(i).vertexCount : meshes[i].vertices.size();
+	}
+
+	const unsigned int* indices(unsigned int i) const
+	{
+		return cache ? cache->indices(i) : meshes[i].indices.data();
+	}
+
+	size_t indexCount(unsigned int i) const
+	{
+		return cache ? cache->mesh(i).indexCount : meshes[i].indices.size();
+	}
+};
 
 class Model
 {
 public:
 	/*  Model Data */
-	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	VertexLayout vertexLayout;
+	unsigned int usage;	// MeshUsage flags of every mesh; models used for collision or picking keep their CPU data
+	glm::vec3 boundsMin, boundsMax;	// model space bounds of all meshes
+	float boundsRadius;				// sphere around the center of those bounds holding every mesh
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	Model(string const &path, bool gamma = false, VertexLayout layout = VERTEX_LAYOUT_COMPACT, unsigned int usage = MESH_USAGE_DRAW)
+		: gammaCorrection(gamma), vertexLayout(layout), usage(usage), boundsMin(0.0f), boundsMax(0.0f), boundsRadius(0.0f), instanceBuffer(0)
+	{
+		ModelData data = Import(path, usage);
+		upload(data);
+	}
+
+	// constructor for a model imported ahead of time (see LoadAsync), creates the GL objects.
+	// the imported vertices and indices are moved out of data.
+	Model(ModelData &&data, bool gamma = false, VertexLayout layout = VERTEX_LAYOUT_COMPACT, unsigned int usage = MESH_USAGE_DRAW)
+		: gammaCorrection(gamma), vertexLayout(layout), usage(usage), boundsMin(0.0f), boundsMax(0.0f), boundsRadius(0.0f), instanceBuffer(0)
+	{
+		upload(data);
+	}
+
+	// gives the texture handles and the geometry of all meshes back to their managers and
+	// deletes the instance buffer
+	~Model()
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			for (unsigned int j = 0; j < meshes[i].textures.size(); j++)
+				Textures().release(meshes[i].textures[j].handle);
+			meshes[i].releaseGeometry();
+		}
+		if (instanceBuffer)
+		{
+			Geometry().releaseInstancedVertexArrays(instanceBuffer);
+			glDeleteBuffers(1, &instanceBuffer);
+		}
+	}
+
+	// the texture references and the instance buffer are owned, so a Model can be moved (as
+	// vector<Model> does when it grows) but not copied or assigned
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+	Model& operator=(Model&&) = delete;
+
+	// takes over everything other owns; other is left without meshes or instance buffer
+	Model(Model &&other)
+		: meshes(std::move(other.meshes)), directory(std::move(other.directory)), gammaCorrection(other.gammaCorrection), vertexLayout(other.vertexLayout),
+		usage(other.usage), boundsMin(other.boundsMin), boundsMax(other.boundsMax), boundsRadius(other.boundsRadius),
+		instanceBuffer(other.instanceBuffer), instanceTransforms(std::move(other.instanceTransforms)), instanceBounds(std::move(other.instanceBounds)),
+		instanceCullBatch(std::move(other.instanceCullBatch)), instanceVisible(std::move(other.instanceVisible)), visibleInstances(std::move(other.visibleInstances)),
+		uploadedInstances(std::move(other.uploadedInstances)), instanceLevels(std::move(other.instanceLevels)), collisionBvh(std::move(other.collisionBvh))
 	{
-		loadModel(path);
+		other.meshes.clear();
+		other.instanceBuffer = 0;
 	}
 
+	// the triangles of the model for collision queries and picking, null unless usage asked for them
+	const TriangleBvh* collision() const { return collisionBvh.get(); }
+
 	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(const Shader &shader) const
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
-private:
-	/*  Functions   */
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const &path)
+	// world space bounds of the model placed by model
+	Bounds bounds(const glm::mat4 &model) const
+	{
+		return TransformBounds(model, boundsMin, boundsMax, boundsRadius);
+	}
+
+	// queues all meshes of the model, transformed by model. levels, one per mesh, are the levels
+	// of detail this placement was drawn at last time (see Mesh::Submit); null draws full detail.
+	void Submit(RenderQueue &queue, const Shader &shader, const glm::mat4 &model, RenderPass pass = RENDER_PASS_OPAQUE, uint8_t *levels = NULL) const
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Submit(queue, shader, model, pass, levels ? &levels[i] : NULL);
+	}
+
+	// places copies of the model at the given transforms, for SubmitInstances. Their bounds are
+	// computed once here, so set them again only when the copies move.
+	void SetInstances(const vector<glm::mat4> &transforms)
 	{
-		// read file via ASSIMP
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-		// check for errors
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+		if (!instanceBuffer)
+		{
+			glGenBuffers(1, &instanceBuffer);
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				meshes[i].attachInstances(instanceBuffer);
+		}
+		instanceTransforms = transforms;
+		instanceBounds.clear();
+		instanceCullBatch.clear();
+		for (size_t i = 0; i < transforms.size(); i++)
 		{
-			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+			instanceBounds.push_back(bounds(transforms[i]));
+			instanceCullBatch.add(instanceBounds.back());
+		}
+		// nothing is in the buffer yet
+		uploadedInstances.assign(1, ~0u);
+	}
+
+	// queues the instances in the queue's frustum with one draw per mesh; shader is the INSTANCED
+	// variant of a model shader. The buffer is rewritten only when the set in view changes.
+	void SubmitInstances(RenderQueue &queue, const Shader &shader, RenderPass pass = RENDER_PASS_OPAQUE)
+	{
+		if (instanceTransforms.empty())
 			return;
+		instanceCullBatch.cull(queue.frustum(), instanceVisible);
+		visibleInstances.clear();
+		Bounds bounds;
+		for (unsigned int i = 0; i < instanceTransforms.size(); i++)
+		{
+			if (!instanceVisible[i])
+				continue;
+			bounds = visibleInstances.empty() ? instanceBounds[i] : MergeBounds(bounds, instanceBounds[i]);
+			visibleInstances.push_back(i);
+		}
+		queue.countInstances((unsigned int)visibleInstances.size(), (unsigned int)(instanceTransforms.size() - visibleInstances.size()));
+		if (visibleInstances.empty())
+			return;
+
+		if (visibleInstances != uploadedInstances)
+		{
+			vector<glm::mat4> transforms;
+			transforms.reserve(visibleInstances.size());
+			for (size_t i = 0; i < visibleInstances.size(); i++)
+				transforms.push_back(instanceTransforms[visibleInstances[i]]);
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+			glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			uploadedInstances = visibleInstances;
 		}
+		// all instances share a level, the one the closest of them needs
+		float pixelsPerUnit = 0.0f;
+		for (size_t i = 0; i < visibleInstances.size(); i++)
+		{
+			const Bounds &instance = instanceBounds[visibleInstances[i]];
+			float scale = boundsRadius > 0.0f ? instance.radius / boundsRadius : 1.0f;
+			pixelsPerUnit = max(pixelsPerUnit, queue.pixelsPerUnit(instance) * scale);
+		}
+		instanceLevels.resize(meshes.size(), 0);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			instanceLevels[i] = (uint8_t)meshes[i].selectLod(pixelsPerUnit, instanceLevels[i]);
+			meshes[i].SubmitInstances(queue, shader, (GLsizei)visibleInstances.size(), bounds, pass, instanceLevels[i]);
+		}
+	}
+
+	// loads a model with supported ASSIMP extensions from file.
+	// a cooked cache that matches the source file is used instead when there is one; fresh imports
+	// are welded and reordered for the GPU (see mesh_optimizer.h) and get their levels of detail
+	// (see mesh_simplify.h) before they are cooked.
+	// the triangle BVH of models used for collision or picking is built here as well.
+	// does not touch the GL, so it is safe to call from any thread.
+	static ModelData Import(string const &path, unsigned int usage = MESH_USAGE_DRAW)
+	{
+		ModelData data;
 		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
+		data.directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		FileStamp stamp;
+		bool haveStamp = GetFileStamp(path, stamp);
+		unique_ptr<MeshCache> cache(new MeshCache());
+		if (haveStamp && cache->open(MeshCachePath(path), stamp, importFlags))
+		{
+			data.cache = std::move(cache);
+		}
+		else
+		{
+			// OBJ files go through the parallel reader, anything it cannot handle through ASSIMP
+			if (!ObjImporter::IsObjFile(path) || !ObjImporter::Import(path, data.meshes))
+			{
+				// read file via ASSIMP
+				Assimp::Importer importer;
+				const aiScene* scene = importer.ReadFile(path, importFlags);
+				// check for errors
+				if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+				{
+					cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+					return data;
+				}
+
+				// process ASSIMP's root node recursively
+				processNode(scene->mRootNode, scene, data.meshes);
+			}
+
+			optimizeMeshes(path, data.meshes);
+
+			// cook the result so the next launch can skip the import
+			if (haveStamp && !WriteMeshCache(MeshCachePath(path), stamp, importFlags, data.meshes))
+				cout << "WARNING::MESH_CACHE:: could not write " << MeshCachePath(path) << endl;
+		}
+
+		if (usage & (MESH_USAGE_COLLISION | MESH_USAGE_PICKING))
+			data.collision = BuildCollision(data);
+		return data;
+	}
+
+	// runs Import on the worker pool; pass the result to the ModelData constructor on the GL thread
+	static future<ModelData> LoadAsync(string const &path, unsigned int usage = MESH_USAGE_DRAW)
+	{
+		return WorkerPool().submit([path, usage]() { return Import(path, usage); });
+	}
+
+private:
+	/*  Instancing  */
+	GLuint instanceBuffer;					// glm::mat4 per visible instance, read by the instanced vertex array of every mesh
+	vector<glm::mat4> instanceTransforms;	// all instances
+	vector<Bounds> instanceBounds;			// their world bounds
+	CullBatch instanceCullBatch;			// the same bounds, for culling
+	vector<uint8_t> instanceVisible;
+	vector<unsigned int> visibleInstances;	// in view this frame
+	vector<unsigned int> uploadedInstances;	// in the buffer
+	vector<uint8_t> instanceLevels;			// by mesh, the level of detail the instances were drawn at
+
+	unique_ptr<TriangleBvh> collisionBvh;
+
+	/*  Functions   */
+	// post processing applied to every import; part of the cache key, so changing it re-cooks all models
+	static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+	// creates the GL side of the imported data: mesh buffers straight from the import or the mapped cache, and textures.
+	// the textures are only requested here, they stream in over the next frames. imported meshes are moved out of data.
+	void upload(ModelData &data)
+	{
+		directory = data.directory;
+		if (!data.collision && (usage & (MESH_USAGE_COLLISION | MESH_USAGE_PICKING)))
+			data.collision = BuildCollision(data);
+		collisionBvh = std::move(data.collision);
+		meshes.reserve(data.meshCount());
+		for (unsigned int i = 0; i < data.meshCount(); i++)
+		{
+			if (data.cache)
+			{
+				const MeshCacheEntry &entry = data.cache->mesh(i);
+				meshes.emplace_back(data.cache->vertices(i), entry.vertexCount, data.cache->indices(i), entry.indexCount, loadTextures(data.textures(i)), vertexLayout, usage,
+					data.cache->lodIndices(i), data.cache->lods(i), entry.lodCount);
+			}
+			else
+			{
+				MeshData &mesh = data.meshes[i];
+				meshes.emplace_back(std::move(mesh.vertices), std::move(mesh.indices), loadTextures(std::move(mesh.textures)), vertexLayout, usage, mesh.lodIndices, mesh.lods);
+			}
+		}
+
+		// the bounds of the whole model, for placing and culling it as one piece
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			boundsMin = i ? glm::min(boundsMin, meshes[i].boundsMin) : meshes[i].boundsMin;
+			boundsMax = i ? glm::max(boundsMax, meshes[i].boundsMax) : meshes[i].boundsMax;
+		}
+		glm::vec3 boundsCenter = (boundsMin + boundsMax) * 0.5f;
+		boundsRadius = 0.0f;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			boundsRadius = max(boundsRadius, glm::length((meshes[i].boundsMin + meshes[i].boundsMax) * 0.5f - boundsCenter) + meshes[i].boundsRadius);
+		boundsRadius = min(boundsRadius, glm::length(boundsMax - boundsMin) * 0.5f);
+	}
+
+	// the triangle BVH over all meshes of data
+	static unique_ptr<TriangleBvh> BuildCollision(const ModelData &data)
+	{
+		unique_ptr<TriangleBvh> bvh(new TriangleBvh());
+		for (unsigned int i = 0; i < data.meshCount(); i++)
+		{
+			if (data.cache)
+				bvh->addMesh(data.cache->vertices(i), data.cache->mesh(i).vertexCount, data.cache->indices(i), data.cache->mesh(i).indexCount);
+			else
+				bvh->addMesh(data.meshes[i].vertices.data(), data.meshes[i].vertices.size(), data.meshes[i].indices.data(), data.meshes[i].indices.size());
+		}
+		bvh->build();
+		return bvh;
+	}
+
+	// welds, reorders and if needed splits every mesh for the GPU, simplifies the pieces into
+	// their levels of detail and prints the vertex cache and level statistics of the model
+	static void optimizeMeshes(const string &path, vector<MeshData> &meshes)
+	{
+		size_t verticesBefore = 0, verticesAfter = 0, triangles = 0;
+		double missesBefore = 0.0, missesWelded = 0.0, missesAfter = 0.0;
+		vector<MeshData> pieces;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			MeshOptimizeStats stats = OptimizeMesh(meshes[i]);
+			// pieces small enough for 16 bit indices
+			SplitMesh(meshes[i], MAX_SHORT_INDEXED_VERTICES, pieces);
+			verticesBefore += stats.verticesBefore;
+			verticesAfter += stats.verticesAfter;
+			triangles += stats.triangles;
+			missesBefore += (double)stats.acmrBefore * stats.triangles;
+			missesWelded += (double)stats.acmrWelded * stats.triangles;
+			missesAfter += (double)stats.acmrAfter * stats.triangles;
+		}
+		meshes.swap(pieces);
+		if (!triangles)
+			return;
+		char report[256];
+		snprintf(report, sizeof(report), "%u vertices -> %u, ACMR %.3f -> %.3f (%.3f welded only)", (unsigned int)verticesBefore,
+			(unsigned int)verticesAfter, missesBefore / triangles, missesAfter / triangles, missesWelded / triangles);
+		cout << "MESH_OPTIMIZER:: " << path << ": " << report << endl;
+
+		// triangles of every level over all pieces, a piece that stops early counts its last level
+		size_t levelTriangles[MESH_LOD_LEVELS + 1] = { 0 };
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			BuildMeshLods(meshes[i]);
+			size_t last = meshes[i].indices.size() / 3;
+			levelTriangles[0] += last;
+			for (unsigned int level = 0; level < MESH_LOD_LEVELS; level++)
+			{
+				if (level < meshes[i].lods.size())
+					last = meshes[i].lods[level].indexCount / 3;
+				levelTriangles[level + 1] += last;
+			}
+		}
+		cout << "MESH_LOD:: " << path << ": " << levelTriangles[0];
+		for (unsigned int level = 1; level <= MESH_LOD_LEVELS; level++)
+			cout << " -> " << levelTriangles[level];
+		cout << " triangles" << endl;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	static void processNode(aiNode *node, const aiScene *scene, vector<MeshData> &imported)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -76,22 +413,25 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			imported.push_back(processMesh(mesh, scene));
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, imported);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	static MeshData processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		MeshData data;
+		vector<Vertex> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vector<Texture> &textures = data.textures;
+		vertices.reserve(mesh->mNumVertices);
+		indices.reserve(mesh->mNumFaces * 3);
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -106,7 +446,7 @@ private:
 			// normals
 			vector.x = mesh->mNormals[i].x;
 			vector.y = mesh->mNormals[i].y;
-			//vector.z = mesh->mNormals[i].z;
+			vector.z = mesh->mNormals[i].z;
 			vertex.Normal = vector;
 			// texture coordinates
 			if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
@@ -142,6 +482,9 @@ private:
 		}
 		// process materials
 		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		aiString materialName;
+		if (material->Get(AI_MATKEY_NAME, materialName) == AI_SUCCESS)
+			data.material = materialName.C_Str();
 		// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
 		// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
 		// Same applies to other texture as the following list summarizes:
@@ -150,94 +493,56 @@ private:
 		// normal: texture_normalN
 
 		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
+		vector<Texture> diffuseMaps = materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
 		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
 		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
+		vector<Texture> specularMaps = materialTextures(material, aiTextureType_SPECULAR, "texture_specular");
 		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
+		std::vector<Texture> normalMaps = materialTextures(material, aiTextureType_HEIGHT, "texture_normal");
 		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
 		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
+		std::vector<Texture> heightMaps = materialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// return the extracted mesh data, the GL side is created by upload
+		return data;
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// collects all material textures of a given type as (type, path) references.
+	static vector<Texture> materialTextures(aiMaterial *mat, aiTextureType type, string typeName)
 	{
 		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			Texture texture;
+			texture.handle = 0;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+			textures.push_back(texture);
 		}
 		return textures;
 	}
+
+	// acquires the referenced textures from the process wide manager; a texture shared with
+	// another mesh or model (same path or same contents) is only loaded once.
+	vector<Texture> loadTextures(vector<Texture> textures)
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+			textures[i].handle = TextureFromFile(textures[i].path.c_str(), this->directory);
+		return textures;
+	}
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// returns a new reference to the texture, it shows a placeholder until the file has been streamed in
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma)
 {
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return Textures().acquire(filename);
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,593 @@
+#ifndef OBJ_IMPORT_H
+#define OBJ_IMPORT_H
+
+#include "glm/glm.hpp"
+#include "tiny_obj_loader.h"
+
+#include "mapped_file.h"
+#include "mesh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Wavefront OBJ reader for the format nearly all of our assets use, without going through
+// Assimp. The file is mapped and cut into line aligned chunks that are parsed in parallel on
+// the worker pool; relative indices and the object/material in effect at the start of each
+// chunk are only known once every chunk before it is done, so those are resolved while the
+// chunks are stitched together. Materials are read with the bundled tiny_obj_loader.
+//
+// The meshes match what Model::processMesh makes of an Assimp import with our flags: one mesh
+// per object and material, one vertex per face corner, polygons split into triangle fans,
+// flipped V coordinates and tangents averaged over the corners that share a vertex.
+class ObjImporter
+{
+public:
+	// fills meshes from the file at path; false if it cannot be read or parsed
+	static bool Import(const string &path, vector<MeshData> &meshes)
+	{
+		MappedFile file;
+		if (!file.open(path))
+			return false;
+		const char *data = (const char*)file.data();
+		size_t size = file.size();
+
+		// line aligned chunks, a few per worker so that uneven chunks still balance out
+		size_t chunkSize = max(CHUNK_SIZE, size / (WorkerPool().size() * 4) + 1);
+		vector<size_t> bounds(1, 0);
+		while (bounds.back() < size)
+		{
+			size_t end = min(size, bounds.back() + chunkSize);
+			const char *newline = end < size ? (const char*)memchr(data + end, '\n', size - end) : NULL;
+			bounds.push_back(newline ? newline - data + 1 : size);
+		}
+
+		vector<Chunk> chunks(bounds.size() - 1);
+		vector<future<void> > parses;
+		for (size_t i = 1; i < chunks.size(); i++)
+		{
+			Chunk *chunk = &chunks[i];
+			const char *begin = data + bounds[i], *end = data + bounds[i + 1];
+			parses.push_back(WorkerPool().submit([chunk, begin, end]() { ParseChunk(begin, end, *chunk); }));
+		}
+		if (!chunks.empty())
+			ParseChunk(data, data + bounds[1], chunks[0]);
+		for (size_t i = 0; i < parses.size(); i++)
+		{
+			WorkerPool().wait(parses[i]);
+			parses[i].get();
+		}
+
+		// relative indices only knew the counts inside their own chunk
+		Attributes attributes;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			Chunk &chunk = chunks[i];
+			if (chunk.failed)
+				return false;
+			int base[3] = { (int)attributes.positions.size() / 3, (int)attributes.texCoords.size() / 2, (int)attributes.normals.size() / 3 };
+			for (size_t r = 0; r < chunk.relative.size(); r++)
+			{
+				Corner &corner = chunk.corners[chunk.relative[r] / 3];
+				unsigned int component = chunk.relative[r] % 3;
+				int &index = component == 0 ? corner.position : component == 1 ? corner.texCoord : corner.normal;
+				index += base[component];
+				// still before the first attribute; -1 would read as "absent" later on
+				if (index < 0)
+					return false;
+			}
+			attributes.positions.insert(attributes.positions.end(), chunk.positions.begin(), chunk.positions.end());
+			attributes.texCoords.insert(attributes.texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+			attributes.normals.insert(attributes.normals.end(), chunk.normals.begin(), chunk.normals.end());
+			vector<float>().swap(chunk.positions);
+			vector<float>().swap(chunk.texCoords);
+			vector<float>().swap(chunk.normals);
+		}
+
+		// replay the object, usemtl and mtllib statements in file order to group the triangles
+		vector<Group> groups;
+		map<string, size_t> groupIndex;
+		string object, material;
+		tinyobj::MaterialFileReader readMaterials(path.substr(0, path.find_last_of('/') + 1));
+		vector<tinyobj::material_t> materials;
+		map<string, int> materialIndex;
+		string materialError;
+		auto addRun = [&](size_t chunk, size_t first, size_t end)
+		{
+			if (first == end)
+				return;
+			string key = object + '\n' + material;
+			map<string, size_t>::iterator found = groupIndex.find(key);
+			if (found == groupIndex.end())
+			{
+				found = groupIndex.insert(make_pair(key, groups.size())).first;
+				groups.push_back(Group());
+				groups.back().material = material;
+			}
+			Run run = { chunk, first, end };
+			groups[found->second].runs.push_back(run);
+		};
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			size_t triangle = 0;
+			for (size_t s = 0; s < chunks[i].statements.size(); s++)
+			{
+				const Statement &statement = chunks[i].statements[s];
+				addRun(i, triangle, statement.triangle);
+				triangle = statement.triangle;
+				if (statement.type == OBJECT)
+					object = statement.name;
+				else if (statement.type == MATERIAL)
+					material = statement.name;
+				else
+					readMaterials(statement.name, &materials, &materialIndex, &materialError);
+			}
+			addRun(i, triangle, chunks[i].corners.size() / 3);
+		}
+
+		// the vertices of every group are written out in parallel
+		meshes.clear();
+		meshes.resize(groups.size());
+		vector<future<bool> > builds;
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			const tinyobj::material_t *mtl = NULL;
+			map<string, int>::iterator found = materialIndex.find(groups[g].material);
+			if (found != materialIndex.end())
+				mtl = &materials[found->second];
+			MeshData *mesh = &meshes[g];
+			const Group *group = &groups[g];
+			const vector<Chunk> *source = &chunks;
+			const Attributes *shared = &attributes;
+			builds.push_back(WorkerPool().submit([mesh, group, source, shared, mtl]() { return BuildMesh(*group, *source, *shared, mtl, *mesh); }));
+		}
+		bool valid = true;
+		for (size_t g = 0; g < builds.size(); g++)
+		{
+			WorkerPool().wait(builds[g]);
+			valid = builds[g].get() && valid;
+		}
+		if (!valid)
+			meshes.clear();
+		return valid;
+	}
+
+	static bool IsObjFile(const string &path)
+	{
+		size_t dot = path.find_last_of('.');
+		if (dot == string::npos || path.size() - dot != 4)
+			return false;
+		string extension = path.substr(dot + 1);
+		for (unsigned int i = 0; i < extension.size(); i++)
+			extension[i] = (char)tolower((unsigned char)extension[i]);
+		return extension == "obj";
+	}
+
+private:
+	// files below this size are parsed in one piece on the calling thread
+	static const size_t CHUNK_SIZE = 1024 * 1024;
+
+	// indices into the attribute arrays, 0 based, -1 when the face does not use that attribute
+	struct Corner
+	{
+		int position, texCoord, normal;
+	};
+
+	enum StatementType { OBJECT, MATERIAL, LIBRARY };
+
+	// an o/g, usemtl or mtllib line and the chunk local index of the first triangle after it
+	struct Statement
+	{
+		StatementType type;
+		size_t triangle;
+		string name;
+	};
+
+	struct Chunk
+	{
+		vector<float> positions;	// xyz
+		vector<float> texCoords;	// uv
+		vector<float> normals;		// xyz
+		vector<Corner> corners;		// 3 per triangle
+		vector<Statement> statements;
+		vector<size_t> relative;	// 3 * corner + component of every index that was relative to this chunk
+		bool failed;
+
+		Chunk() : failed(false) {}
+	};
+
+	struct Attributes
+	{
+		vector<float> positions, texCoords, normals;
+	};
+
+	// consecutive triangles of one chunk
+	struct Run
+	{
+		size_t chunk, first, end;
+	};
+
+	struct Group
+	{
+		string material;
+		vector<Run> runs;
+	};
+
+	static bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	static void SkipSpace(const char *&p, const char *end)
+	{
+		while (p < end && IsSpace(*p))
+			p++;
+	}
+
+	// decimal float without going through the locale aware strtod; false if there are no digits
+	static bool ParseFloat(const char *&p, const char *end, float &value)
+	{
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		bool any = false;
+		for (; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+		{
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				digits += mantissa != 0;
+			}
+			else
+				exponent++;
+		}
+		if (p < end && *p == '.')
+		{
+			for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					digits += mantissa != 0;
+					exponent--;
+				}
+			}
+		}
+		if (!any)
+			return false;
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char *e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+				negativeExponent = *e++ == '-';
+			if (e < end && *e >= '0' && *e <= '9')
+			{
+				int power = 0;
+				for (; e < end && *e >= '0' && *e <= '9'; e++)
+					power = min(power * 10 + (*e - '0'), 1000);
+				exponent += negativeExponent ? -power : power;
+				p = e;
+			}
+		}
+		double result = (double)mantissa;
+		if (exponent < 0)
+			result = exponent >= -22 ? result / powers[-exponent] : result * pow(10.0, exponent);
+		else if (exponent > 0)
+			result = exponent <= 22 ? result * powers[exponent] : result * pow(10.0, exponent);
+		value = (float)(negative ? -result : result);
+		return true;
+	}
+
+	static bool ParseInt(const char *&p, const char *end, int &value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		long long result = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			result = min(result * 10 + (*p - '0'), (long long)INT32_MAX);
+		value = (int)(negative ? -result : result);
+		return true;
+	}
+
+	// reads up to count floats into out, missing trailing values are 0; false if there is none
+	static bool ParseFloats(const char *p, const char *end, int count, vector<float> &out)
+	{
+		float values[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < count; i++)
+		{
+			SkipSpace(p, end);
+			if (!ParseFloat(p, end, values[i]))
+			{
+				if (i == 0)
+					return false;
+				break;
+			}
+		}
+		out.insert(out.end(), values, values + count);
+		return true;
+	}
+
+	// one OBJ index: positive ones are absolute, negative ones count back from the attributes read so far
+	static bool ParseIndex(const char *&p, const char *end, int count, int &index, bool &relative)
+	{
+		int value;
+		if (!ParseInt(p, end, value) || value == 0)
+			return false;
+		relative = value < 0;
+		index = relative ? count + value : value - 1;
+		return true;
+	}
+
+	// the rest of the line without surrounding blanks
+	static string ParseName(const char *p, const char *end)
+	{
+		SkipSpace(p, end);
+		while (end > p && IsSpace(end[-1]))
+			end--;
+		return string(p, end);
+	}
+
+	static bool StartsWith(const char *p, const char *end, const char *keyword)
+	{
+		size_t length = strlen(keyword);
+		return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && IsSpace(p[length]);
+	}
+
+	static void ParseFace(const char *p, const char *end, Chunk &chunk)
+	{
+		Corner polygon[256];
+		unsigned char relative[256];	// bit per component
+		int count = 0;
+		int positions = (int)chunk.positions.size() / 3, texCoords = (int)chunk.texCoords.size() / 2, normals = (int)chunk.normals.size() / 3;
+		for (SkipSpace(p, end); p < end && count < 256; SkipSpace(p, end))
+		{
+			Corner corner = { -1, -1, -1 };
+			bool isRelative;
+			relative[count] = 0;
+			if (!ParseIndex(p, end, positions, corner.position, isRelative))
+			{
+				chunk.failed = true;
+				return;
+			}
+			relative[count] |= isRelative ? 1 : 0;
+			if (p < end && *p == '/')
+			{
+				p++;
+				if (p < end && *p != '/')
+				{
+					if (!ParseIndex(p, end, texCoords, corner.texCoord, isRelative))
+					{
+						chunk.failed = true;
+						return;
+					}
+					relative[count] |= isRelative ? 2 : 0;
+				}
+				if (p < end && *p == '/')
+				{
+					p++;
+					if (!ParseIndex(p, end, normals, corner.normal, isRelative))
+					{
+						chunk.failed = true;
+						return;
+					}
+					relative[count] |= isRelative ? 4 : 0;
+				}
+			}
+			polygon[count++] = corner;
+		}
+		// more corners than polygon holds are left to the fallback instead of being cut off
+		if (p < end)
+		{
+			chunk.failed = true;
+			return;
+		}
+
+		// fan triangulation; points and lines have no surface to draw and are dropped
+		for (int i = 1; i + 1 < count; i++)
+		{
+			const int fan[3] = { 0, i, i + 1 };
+			for (int k = 0; k < 3; k++)
+			{
+				size_t index = chunk.corners.size();
+				chunk.corners.push_back(polygon[fan[k]]);
+				for (unsigned int component = 0; component < 3; component++)
+					if (relative[fan[k]] & (1 << component))
+						chunk.relative.push_back(3 * index + component);
+			}
+		}
+	}
+
+	static void ParseChunk(const char *begin, const char *end, Chunk &chunk)
+	{
+		for (const char *line = begin; line < end && !chunk.failed; )
+		{
+			const char *lineEnd = (const char*)memchr(line, '\n', end - line);
+			if (!lineEnd)
+				lineEnd = end;
+			const char *p = line;
+			SkipSpace(p, lineEnd);
+			if (lineEnd - p >= 2)
+			{
+				if (p[0] == 'v' && IsSpace(p[1]))
+					chunk.failed = !ParseFloats(p + 2, lineEnd, 3, chunk.positions);
+				else if (p[0] == 'v' && p[1] == 't' && lineEnd - p > 2 && IsSpace(p[2]))
+					chunk.failed = !ParseFloats(p + 3, lineEnd, 2, chunk.texCoords);
+				else if (p[0] == 'v' && p[1] == 'n' && lineEnd - p > 2 && IsSpace(p[2]))
+					chunk.failed = !ParseFloats(p + 3, lineEnd, 3, chunk.normals);
+				else if (p[0] == 'f' && IsSpace(p[1]))
+					ParseFace(p + 2, lineEnd, chunk);
+				else if ((p[0] == 'o' || p[0] == 'g') && IsSpace(p[1]))
+					addStatement(chunk, OBJECT, ParseName(p + 2, lineEnd));
+				else if (StartsWith(p, lineEnd, "usemtl"))
+					addStatement(chunk, MATERIAL, ParseName(p + 7, lineEnd));
+				else if (StartsWith(p, lineEnd, "mtllib"))
+					addStatement(chunk, LIBRARY, ParseName(p + 7, lineEnd));
+			}
+			line = lineEnd + 1;
+		}
+	}
+
+	static void addStatement(Chunk &chunk, StatementType type, const string &name)
+	{
+		Statement statement = { type, chunk.corners.size() / 3, name };
+		chunk.statements.push_back(statement);
+	}
+
+	// texture references of a material in the order processMesh collects them from Assimp
+	static void MaterialTextures(const tinyobj::material_t &mtl, vector<Texture> &textures)
+	{
+		// tiny_obj_loader only knows the lower case map_bump, Assimp also reads map_Bump
+		string bump = mtl.bump_texname;
+		map<string, string>::const_iterator upper = mtl.unknown_parameter.find("map_Bump");
+		if (bump.empty() && upper != mtl.unknown_parameter.end())
+			bump = upper->second;
+		const string *names[4] = { &mtl.diffuse_texname, &mtl.specular_texname, &bump, &mtl.ambient_texname };
+		const char *types[4] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+		for (int i = 0; i < 4; i++)
+		{
+			string name = ParseName(names[i]->data(), names[i]->data() + names[i]->size());
+			if (name.empty())
+				continue;
+			Texture texture;
+			texture.handle = 0;
+			texture.type = types[i];
+			texture.path = name;
+			textures.push_back(texture);
+		}
+	}
+
+	static bool BuildMesh(const Group &group, const vector<Chunk> &chunks, const Attributes &attributes, const tinyobj::material_t *mtl, MeshData &mesh)
+	{
+		int positions = (int)attributes.positions.size() / 3;
+		int texCoords = (int)attributes.texCoords.size() / 2;
+		int normals = (int)attributes.normals.size() / 3;
+		// Assimp names materials that are missing from the library like this
+		mesh.material = mtl ? mtl->name : "DefaultMaterial";
+		if (mtl)
+			MaterialTextures(*mtl, mesh.textures);
+
+		size_t triangles = 0;
+		for (size_t r = 0; r < group.runs.size(); r++)
+			triangles += group.runs[r].end - group.runs[r].first;
+		mesh.vertices.reserve(3 * triangles);
+		vector<Corner> corners;	// where each vertex came from
+		corners.reserve(3 * triangles);
+		mesh.indices.reserve(3 * triangles);
+
+		for (size_t r = 0; r < group.runs.size(); r++)
+		{
+			const Run &run = group.runs[r];
+			const Corner *runCorners = chunks[run.chunk].corners.data();
+			for (size_t t = run.first; t < run.end; t++)
+			{
+				Vertex vertex[3];
+				bool hasNormals = true;
+				for (int k = 0; k < 3; k++)
+				{
+					const Corner &corner = runCorners[3 * t + k];
+					if (corner.position < 0 || corner.position >= positions || corner.texCoord >= texCoords || corner.normal >= normals)
+						return false;
+					const float *p = &attributes.positions[3 * corner.position];
+					vertex[k].Position = glm::vec3(p[0], p[1], p[2]);
+					if (corner.normal >= 0)
+					{
+						const float *n = &attributes.normals[3 * corner.normal];
+						vertex[k].Normal = glm::vec3(n[0], n[1], n[2]);
+					}
+					else
+						hasNormals = false;
+					if (corner.texCoord >= 0)
+						vertex[k].TexCoords = glm::vec2(attributes.texCoords[2 * corner.texCoord], 1.0f - attributes.texCoords[2 * corner.texCoord + 1]);
+					else
+						vertex[k].TexCoords = glm::vec2(0.0f, 0.0f);
+				}
+
+				glm::vec3 v = vertex[1].Position - vertex[0].Position, w = vertex[2].Position - vertex[0].Position;
+				if (!hasNormals)
+				{
+					// faces without normals get their flat normal instead of leaving the vertex normals undefined
+					glm::vec3 normal = glm::cross(v, w);
+					float length = glm::length(normal);
+					normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+					for (int k = 0; k < 3; k++)
+						vertex[k].Normal = normal;
+				}
+
+				// tangent and bitangent of the face like Assimp's CalcTangentSpace, made orthogonal to each normal
+				float sx = vertex[1].TexCoords.x - vertex[0].TexCoords.x, sy = vertex[1].TexCoords.y - vertex[0].TexCoords.y;
+				float tx = vertex[2].TexCoords.x - vertex[0].TexCoords.x, ty = vertex[2].TexCoords.y - vertex[0].TexCoords.y;
+				float direction = (tx * sy - ty * sx) < 0.0f ? -1.0f : 1.0f;
+				if (sx * ty == sy * tx)
+				{
+					sx = 0.0f;
+					sy = 1.0f;
+					tx = 1.0f;
+					ty = 0.0f;
+				}
+				glm::vec3 tangent = (w * sy - v * ty) * direction;
+				glm::vec3 bitangent = (w * sx - v * tx) * direction;
+				for (int k = 0; k < 3; k++)
+				{
+					const glm::vec3 &n = vertex[k].Normal;
+					glm::vec3 localTangent = tangent - n * glm::dot(tangent, n);
+					glm::vec3 localBitangent = bitangent - n * glm::dot(bitangent, n);
+					float tangentLength = glm::length(localTangent), bitangentLength = glm::length(localBitangent);
+					vertex[k].Tangent = tangentLength > 0.0f ? localTangent / tangentLength : glm::vec3(0.0f);
+					vertex[k].Bitangent = bitangentLength > 0.0f ? localBitangent / bitangentLength : glm::vec3(0.0f);
+					mesh.indices.push_back((unsigned int)mesh.vertices.size());
+					mesh.vertices.push_back(vertex[k]);
+					corners.push_back(runCorners[3 * t + k]);
+				}
+			}
+		}
+
+		// like Assimp, average the tangents of corners that share all their indices, which
+		// also makes those vertices identical again for the mesh optimizer to weld
+		vector<unsigned int> order(corners.size());
+		for (unsigned int i = 0; i < order.size(); i++)
+			order[i] = i;
+		auto less = [&corners](unsigned int a, unsigned int b)
+		{
+			const Corner &x = corners[a], &y = corners[b];
+			return x.position != y.position ? x.position < y.position : x.texCoord != y.texCoord ? x.texCoord < y.texCoord : x.normal < y.normal;
+		};
+		sort(order.begin(), order.end(), less);
+		for (size_t begin = 0, end; begin < order.size(); begin = end)
+		{
+			for (end = begin + 1; end < order.size() && !less(order[begin], order[end]); end++)
+				;
+			if (end - begin < 2 || corners[order[begin]].normal < 0)
+				continue; // flat normals differ per face, their tangents stay per face as well
+			glm::vec3 tangent(0.0f), bitangent(0.0f);
+			for (size_t i = begin; i < end; i++)
+			{
+				tangent += mesh.vertices[order[i]].Tangent;
+				bitangent += mesh.vertices[order[i]].Bitangent;
+			}
+			float tangentLength = glm::length(tangent), bitangentLength = glm::length(bitangent);
+			tangent = tangentLength > 0.0f ? tangent / tangentLength : glm::vec3(0.0f);
+			bitangent = bitangentLength > 0.0f ? bitangent / bitangentLength : glm::vec3(0.0f);
+			for (size_t i = begin; i < end; i++)
+			{
+				mesh.vertices[order[i]].Tangent = tangent;
+				mesh.vertices[order[i]].Bitangent = bitangent;
+			}
+		}
+		return true;
+	}
+};
+#endif
@@ -0,0 +1,300 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include "glad/glad.h"
+#include "glm/glm.hpp"
+
+#include "frustum.h"
+#include "material.h"
+#include "shader_s.h"
+#include "vertex_format.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Passes run in this order, each with its own fixed function state.
+enum RenderPass {
+	RENDER_PASS_OPAQUE,		// front to back, so early depth testing rejects hidden fragments
+	RENDER_PASS_WIREFRAME,	// glPolygonMode GL_LINE
+	RENDER_PASS_SKY,		// glDepthFunc GL_LEQUAL, the sky sits on the far plane
+	RENDER_PASS_COUNT
+};
+
+// Sort key of a draw, most significant field first:
+//
+//   pass 3 | program 10 | material 16 | vertex array 15 | depth 20
+//
+// so a frame switches program, then textures, then vertex arrays as rarely as the draws allow,
+// and draws sharing all three go front to back. The ids are truncated to their fields, which
+// only costs sorting quality once there are more objects than a field can tell apart.
+const int DRAW_KEY_DEPTH_BITS = 20;
+const int DRAW_KEY_VAO_SHIFT = DRAW_KEY_DEPTH_BITS;
+const int DRAW_KEY_MATERIAL_SHIFT = DRAW_KEY_VAO_SHIFT + 15;
+const int DRAW_KEY_PROGRAM_SHIFT = DRAW_KEY_MATERIAL_SHIFT + 16;
+const int DRAW_KEY_PASS_SHIFT = DRAW_KEY_PROGRAM_SHIFT + 10;
+
+inline uint64_t DrawKey(RenderPass pass, unsigned int program, unsigned int material, unsigned int vao, unsigned int depth)
+{
+	return (uint64_t)pass << DRAW_KEY_PASS_SHIFT |
+		(uint64_t)(program & 0x3ff) << DRAW_KEY_PROGRAM_SHIFT |
+		(uint64_t)(material & 0xffff) << DRAW_KEY_MATERIAL_SHIFT |
+		(uint64_t)(vao & 0x7fff) << DRAW_KEY_VAO_SHIFT |
+		(uint64_t)(depth & ((1u << DRAW_KEY_DEPTH_BITS) - 1));
+}
+
+inline RenderPass DrawKeyPass(uint64_t key)
+{
+	return (RenderPass)(key >> DRAW_KEY_PASS_SHIFT);
+}
+
+struct DrawKeyIndex {
+	uint64_t key;
+	uint32_t item;
+};
+
+// stable LSD radix sort by key, one byte per round; rounds in which every key has the same
+// byte are skipped, which for a frame's keys is most of the upper ones
+inline void RadixSortDrawKeys(vector<DrawKeyIndex> &keys, vector<DrawKeyIndex> &scratch)
+{
+	size_t count = keys.size();
+	if (count < 2)
+		return;
+	scratch.resize(count);
+	size_t histogram[8][256];
+	memset(histogram, 0, sizeof(histogram));
+	for (size_t i = 0; i < count; i++)
+		for (int round = 0; round < 8; round++)
+			histogram[round][(keys[i].key >> (round * 8)) & 0xff]++;
+
+	DrawKeyIndex *from = keys.data(), *to = scratch.data();
+	for (int round = 0; round < 8; round++)
+	{
+		size_t *buckets = histogram[round];
+		if (buckets[(from[0].key >> (round * 8)) & 0xff] == count)
+			continue;
+		size_t offset = 0;
+		for (int b = 0; b < 256; b++)
+		{
+			size_t size = buckets[b];
+			buckets[b] = offset;
+			offset += size;
+		}
+		for (size_t i = 0; i < count; i++)
+			to[buckets[(from[i].key >> (round * 8)) & 0xff]++] = from[i];
+		swap(from, to);
+	}
+	if (from != keys.data())
+		memcpy(keys.data(), from, count * sizeof(DrawKeyIndex));
+}
+
+// the eye counts as at least this far from what it is inside of when levels of detail are picked
+const float RENDER_QUEUE_MIN_LOD_DISTANCE = 0.01f;
+
+// one draw call and the state it needs
+struct DrawItem {
+	const Shader *shader;
+	const Material *material;	// null leaves the bound textures alone
+	const VertexFormat *format;	// how to unpack the vertices, null for vertex arrays of plain floats
+	GLuint vao;
+	GLenum indexType;			// 0 for glDrawArrays
+	GLsizei count;
+	GLsizei instanceCount;		// 0 draws once with model; otherwise the VAO supplies a model matrix per instance
+	size_t indexOffset;			// in bytes into the index buffer, e.g. of a mesh in a geometry pool
+	GLint baseVertex;			// added to every index; the first vertex for glDrawArrays
+	glm::mat4 model;
+
+	DrawItem() : shader(NULL), material(NULL), format(NULL), vao(0), indexType(0), count(0), instanceCount(0), indexOffset(0), baseVertex(0) {}
+};
+
+// what the last execute() did
+struct RenderQueueStats {
+	unsigned int submitted;			// draws queued
+	unsigned int culled;			// of those, dropped as out of view
+	unsigned int draws;				// issued
+	unsigned int programs;			// state changes
+	unsigned int materials;
+	unsigned int vertexArrays;
+	unsigned int instances;			// instances in view, as reported by countInstances
+	unsigned int culledInstances;	// and out of view
+	unsigned int triangles;			// drawn, counting every instance
+};
+
+// Scene code submits the draws of a frame in any order; execute() culls them against the
+// frustum in one batch, sorts the rest by key and issues them, changing program, textures and
+// vertex array only when the next draw needs a different one. The arrays are kept between
+// frames, so a frame allocates nothing once they have grown.
+class RenderQueue
+{
+public:
+	RenderQueue() : eye(0.0f), depthRange(100.0f), projectionScale(0.0f), visibleInstances(0), culledInstances(0)
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	// where depths are measured from; distances up to range use the full depth field of the key
+	void setView(const glm::vec3 &eyePosition, float range)
+	{
+		eye = eyePosition;
+		depthRange = range;
+	}
+
+	// what the draws of the frame are culled against, e.g. Frustum::FromMatrix(projection * view).
+	// The default frustum contains everything.
+	void setFrustum(const Frustum &viewFrustum)
+	{
+		cullFrustum = viewFrustum;
+	}
+
+	const Frustum& frustum() const { return cullFrustum; }
+
+	// how many pixels something of size 1 covers at distance 1 from the eye, viewport height
+	// / (2 tan(fovy / 2)) for a perspective projection; what level of detail selection goes
+	// by. The default of 0 keeps every mesh at full detail.
+	void setProjectionScale(float scale)
+	{
+		projectionScale = scale;
+	}
+
+	// pixels a world space unit covers at the point of bounds nearest to the eye
+	float pixelsPerUnit(const Bounds &bounds) const
+	{
+		float distance = glm::length(bounds.center - eye) - bounds.radius;
+		return projectionScale / max(distance, RENDER_QUEUE_MIN_LOD_DISTANCE);
+	}
+
+	// queues a draw that is never culled; center is a world space point of it to sort by
+	void submit(RenderPass pass, const DrawItem &item, const glm::vec3 &center)
+	{
+		Bounds bounds = UnboundedBounds();
+		bounds.center = center;
+		submit(pass, item, bounds);
+	}
+
+	// queues a draw that is dropped if bounds, its world space bounds, are out of view
+	void submit(RenderPass pass, const DrawItem &item, const Bounds &bounds)
+	{
+		float distance = glm::length(bounds.center - eye) / depthRange;
+		const unsigned int maxDepth = (1u << DRAW_KEY_DEPTH_BITS) - 1;
+		unsigned int depth = distance >= 1.0f ? maxDepth : (unsigned int)(distance * maxDepth);
+		DrawKeyIndex key;
+		key.key = DrawKey(pass, item.shader->ID, item.material ? item.material->id() : 0, item.vao, depth);
+		key.item = (uint32_t)items.size();
+		keys.push_back(key);
+		items.push_back(item);
+		itemBounds.add(bounds);
+	}
+
+	// adds to the instance statistics of the frame; whoever culls instances before submitting
+	// them (see Model::SubmitInstances) reports the outcome here
+	void countInstances(unsigned int visible, unsigned int culled)
+	{
+		visibleInstances += visible;
+		culledInstances += culled;
+	}
+
+	// culls, sorts and issues everything submitted since the last call, then empties the queue
+	void execute()
+	{
+		memset(&stats, 0, sizeof(stats));
+		stats.submitted = (unsigned int)keys.size();
+		stats.instances = visibleInstances;
+		stats.culledInstances = culledInstances;
+		itemBounds.cull(cullFrustum, visible);
+		size_t kept = 0;
+		for (size_t i = 0; i < keys.size(); i++)
+			if (visible[keys[i].item])
+				keys[kept++] = keys[i];
+		keys.resize(kept);
+		stats.culled = stats.submitted - (unsigned int)kept;
+		RadixSortDrawKeys(keys, scratch);
+
+		int pass = -1;
+		const Shader *shader = NULL;
+		const Material *material = NULL;
+		GLuint vao = 0;
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			const DrawItem &item = items[keys[i].item];
+			RenderPass itemPass = DrawKeyPass(keys[i].key);
+			if (itemPass != pass)
+			{
+				setPassState(itemPass);
+				pass = itemPass;
+			}
+			if (item.shader != shader)
+			{
+				shader = item.shader;
+				shader->use();
+				stats.programs++;
+			}
+			if (item.material && item.material != material)
+			{
+				material = item.material;
+				material->Bind();
+				stats.materials++;
+			}
+			if (item.material)
+				shader->setFloat(UNIFORM_SHININESS, item.material->shininess);
+			if (item.vao != vao)
+			{
+				vao = item.vao;
+				glBindVertexArray(vao);
+				stats.vertexArrays++;
+			}
+
+			if (!item.instanceCount)
+				shader->setMat4(UNIFORM_MODEL, item.model);
+			if (item.format)
+			{
+				shader->setVec3(UNIFORM_POSITION_OFFSET, item.format->positionOffset);
+				shader->setVec3(UNIFORM_POSITION_SCALE, item.format->positionScale);
+				shader->setBool(UNIFORM_OCTAHEDRAL_NORMALS, item.format->layout != VERTEX_LAYOUT_FLOAT);
+			}
+
+			if (item.instanceCount)
+			{
+				if (item.indexType)
+					glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.count, item.indexType, (void*)item.indexOffset, item.instanceCount, item.baseVertex);
+				else
+					glDrawArraysInstanced(GL_TRIANGLES, item.baseVertex, item.count, item.instanceCount);
+			}
+			else if (item.indexType)
+				glDrawElementsBaseVertex(GL_TRIANGLES, item.count, item.indexType, (void*)item.indexOffset, item.baseVertex);
+			else
+				glDrawArrays(GL_TRIANGLES, item.baseVertex, item.count);
+			stats.draws++;
+			stats.triangles += item.count / 3 * (item.instanceCount ? item.instanceCount : 1);
+		}
+		glBindVertexArray(0);
+		setPassState(RENDER_PASS_OPAQUE);
+
+		keys.clear();
+		items.clear();
+		itemBounds.clear();
+		visibleInstances = culledInstances = 0;
+	}
+
+	const RenderQueueStats& lastStats() const { return stats; }
+
+private:
+	vector<DrawItem> items;
+	vector<DrawKeyIndex> keys;
+	vector<DrawKeyIndex> scratch;
+	CullBatch itemBounds;		// by item
+	vector<uint8_t> visible;	// by item, the result of culling itemBounds
+	Frustum cullFrustum;
+	glm::vec3 eye;
+	float depthRange;
+	float projectionScale;
+	unsigned int visibleInstances, culledInstances;
+	RenderQueueStats stats;
+
+	static void setPassState(RenderPass pass)
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, pass == RENDER_PASS_WIREFRAME ? GL_LINE : GL_FILL);
+		glDepthFunc(pass == RENDER_PASS_SKY ? GL_LEQUAL : GL_LESS);
+	}
+};
+#endif
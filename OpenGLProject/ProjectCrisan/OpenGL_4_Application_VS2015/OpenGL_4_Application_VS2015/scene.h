@@ -0,0 +1,346 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Scene description, one node per line (see scenes/demo.scene):
+//
+//   node <name> [parent <name>] [model "<path>"] [shader <name>]
+//        [translate x y z] [rotate degrees x y z]... [scale x y z]
+//        [static | dynamic] [wireframe] [instanced] [collision]
+//
+// The transform composes like the glm chain it replaces: translate, then every rotate in the
+// order given, then scale. Nodes are static unless marked dynamic, children of dynamic nodes
+// move with them and are dynamic as well. The code moves dynamic nodes by name.
+
+enum SceneNodeFlags {
+	SCENE_NODE_DYNAMIC = 1 << 0,	// may move after loading
+	SCENE_NODE_WIREFRAME = 1 << 1,	// drawn in the wireframe pass
+	SCENE_NODE_INSTANCED = 1 << 2,	// drawn as one instance of all instanced nodes of its model
+	SCENE_NODE_DIRTY = 1 << 3,		// local transform changed since the last update
+	SCENE_NODE_MOVED = 1 << 4,		// world matrix changed in the last update
+	SCENE_NODE_COLLISION = 1 << 5	// blocks moving objects and picking rays
+};
+
+// The nodes are kept as structure of arrays, sorted so that every parent comes before its
+// children. updateTransforms() is then a single forward pass over the arrays that only
+// touches nodes whose own or inherited transform changed.
+class Scene
+{
+public:
+	/*  Node Data  */
+	vector<string> names;
+	vector<int> parents;			// index of the parent node, -1 for roots; always lower than the node's own
+	vector<glm::vec3> positions;	// local translation, rotation and scale
+	vector<glm::quat> rotations;
+	vector<glm::vec3> scales;
+	vector<glm::mat4> worlds;		// parent world * T * R * S, valid after updateTransforms()
+	vector<uint8_t> flags;			// SceneNodeFlags
+	vector<int> models;				// index into modelPaths, -1 for nodes without geometry
+	vector<int> shaders;			// index into shaderNames
+
+	// what the nodes refer to, each listed once
+	vector<string> modelPaths;
+	vector<string> shaderNames;
+
+	unsigned int nodeCount() const { return (unsigned int)names.size(); }
+
+	// reads a scene file; false with a message on the console if it cannot be used
+	bool Load(const string &path)
+	{
+		ifstream file(path.c_str());
+		if (!file)
+		{
+			cout << "ERROR::SCENE::FILE_NOT_SUCCESFULLY_READ: " << path << endl;
+			return false;
+		}
+		clear();
+		vector<string> parentNames;
+		string line;
+		for (unsigned int lineNumber = 1; getline(file, line); lineNumber++)
+		{
+			vector<string> tokens = Tokenize(line);
+			if (tokens.empty())
+				continue;
+			if (tokens[0] != "node" || tokens.size() < 2 || !parseNode(tokens, parentNames))
+			{
+				cout << "ERROR::SCENE::SYNTAX " << path << ":" << lineNumber << ": " << line << endl;
+				clear();
+				return false;
+			}
+		}
+		if (!resolveParents(parentNames))
+		{
+			clear();
+			return false;
+		}
+		updateTransforms();
+		return true;
+	}
+
+	// index of the node called name, -1 if there is none
+	int find(const string &name) const
+	{
+		map<string, int>::const_iterator it = byName.find(name);
+		return it == byName.end() ? -1 : it->second;
+	}
+
+	void setPosition(int node, const glm::vec3 &position)
+	{
+		positions[node] = position;
+		flags[node] |= SCENE_NODE_DIRTY;
+	}
+
+	void setRotation(int node, const glm::quat &rotation)
+	{
+		rotations[node] = rotation;
+		flags[node] |= SCENE_NODE_DIRTY;
+	}
+
+	void setScale(int node, const glm::vec3 &scale)
+	{
+		scales[node] = scale;
+		flags[node] |= SCENE_NODE_DIRTY;
+	}
+
+	bool moved(int node) const { return (flags[node] & SCENE_NODE_MOVED) != 0; }
+
+	// recomputes the world matrices of dirty nodes and everything below them; returns how many
+	unsigned int updateTransforms()
+	{
+		unsigned int updated = 0;
+		size_t count = names.size();
+		for (size_t i = 0; i < count; i++)
+		{
+			uint8_t nodeFlags = flags[i] & ~SCENE_NODE_MOVED;
+			int parent = parents[i];
+			bool parentMoved = parent >= 0 && (flags[parent] & SCENE_NODE_MOVED);
+			if ((nodeFlags & SCENE_NODE_DIRTY) || parentMoved)
+			{
+				glm::mat4 local = glm::mat4_cast(rotations[i]);
+				local[0] *= scales[i].x;
+				local[1] *= scales[i].y;
+				local[2] *= scales[i].z;
+				local[3] = glm::vec4(positions[i], 1.0f);
+				worlds[i] = parent >= 0 ? worlds[parent] * local : local;
+				nodeFlags = (nodeFlags & ~SCENE_NODE_DIRTY) | SCENE_NODE_MOVED;
+				updated++;
+			}
+			flags[i] = nodeFlags;
+		}
+		return updated;
+	}
+
+	// the world matrices of the instanced nodes of model, in node order; nodes set in hidden,
+	// by node, are left out
+	void instanceTransforms(int model, vector<glm::mat4> &transforms, const vector<uint8_t> *hidden = NULL) const
+	{
+		transforms.clear();
+		for (size_t i = 0; i < names.size(); i++)
+			if (models[i] == model && (flags[i] & SCENE_NODE_INSTANCED) && !(hidden && (*hidden)[i]))
+				transforms.push_back(worlds[i]);
+	}
+
+	// true if an instanced node of model moved in the last update
+	bool instancesMoved(int model) const
+	{
+		for (size_t i = 0; i < names.size(); i++)
+			if (models[i] == model && (flags[i] & (SCENE_NODE_INSTANCED | SCENE_NODE_MOVED)) == (SCENE_NODE_INSTANCED | SCENE_NODE_MOVED))
+				return true;
+		return false;
+	}
+
+private:
+	map<string, int> byName;
+
+	void clear()
+	{
+		names.clear(); parents.clear(); positions.clear(); rotations.clear(); scales.clear();
+		worlds.clear(); flags.clear(); models.clear(); shaders.clear();
+		modelPaths.clear(); shaderNames.clear(); byName.clear();
+	}
+
+	// whitespace separated tokens, "quoted" ones may contain spaces; # starts a comment
+	static vector<string> Tokenize(const string &line)
+	{
+		vector<string> tokens;
+		size_t i = 0;
+		while (i < line.size())
+		{
+			if (isspace((unsigned char)line[i]))
+				i++;
+			else if (line[i] == '#')
+				break;
+			else if (line[i] == '"')
+			{
+				size_t end = line.find('"', i + 1);
+				end = end == string::npos ? line.size() : end;
+				tokens.push_back(line.substr(i + 1, end - i - 1));
+				i = end + 1;
+			}
+			else
+			{
+				size_t start = i;
+				while (i < line.size() && !isspace((unsigned char)line[i]))
+					i++;
+				tokens.push_back(line.substr(start, i - start));
+			}
+		}
+		return tokens;
+	}
+
+	static bool ParseFloats(const vector<string> &tokens, size_t &t, float *values, int count)
+	{
+		for (int i = 0; i < count; i++, t++)
+		{
+			if (t >= tokens.size())
+				return false;
+			istringstream in(tokens[t]);
+			if (!(in >> values[i]))
+				return false;
+		}
+		return true;
+	}
+
+	static int Intern(vector<string> &list, const string &value)
+	{
+		vector<string>::iterator it = std::find(list.begin(), list.end(), value);
+		if (it != list.end())
+			return (int)(it - list.begin());
+		list.push_back(value);
+		return (int)list.size() - 1;
+	}
+
+	bool parseNode(const vector<string> &tokens, vector<string> &parentNames)
+	{
+		if (byName.count(tokens[1]))
+			return false;
+		string parent;
+		int model = -1, shader = -1;
+		glm::vec3 position(0.0f), scale(1.0f);
+		glm::quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+		uint8_t nodeFlags = SCENE_NODE_DIRTY;
+		for (size_t t = 2; t < tokens.size();)
+		{
+			const string &key = tokens[t++];
+			float v[4];
+			if (key == "parent" && t < tokens.size())
+				parent = tokens[t++];
+			else if (key == "model" && t < tokens.size())
+				model = Intern(modelPaths, tokens[t++]);
+			else if (key == "shader" && t < tokens.size())
+				shader = Intern(shaderNames, tokens[t++]);
+			else if (key == "translate" && ParseFloats(tokens, t, v, 3))
+				position = glm::vec3(v[0], v[1], v[2]);
+			else if (key == "rotate" && ParseFloats(tokens, t, v, 4))
+				rotation = rotation * glm::angleAxis(glm::radians(v[0]), glm::normalize(glm::vec3(v[1], v[2], v[3])));
+			else if (key == "scale" && ParseFloats(tokens, t, v, 3))
+				scale = glm::vec3(v[0], v[1], v[2]);
+			else if (key == "static")
+				nodeFlags &= ~SCENE_NODE_DYNAMIC;
+			else if (key == "dynamic")
+				nodeFlags |= SCENE_NODE_DYNAMIC;
+			else if (key == "wireframe")
+				nodeFlags |= SCENE_NODE_WIREFRAME;
+			else if (key == "instanced")
+				nodeFlags |= SCENE_NODE_INSTANCED;
+			else if (key == "collision")
+				nodeFlags |= SCENE_NODE_COLLISION;
+			else
+				return false;
+		}
+		byName[tokens[1]] = (int)names.size();
+		names.push_back(tokens[1]);
+		parentNames.push_back(parent);
+		positions.push_back(position);
+		rotations.push_back(rotation);
+		scales.push_back(scale);
+		worlds.push_back(glm::mat4());
+		flags.push_back(nodeFlags);
+		models.push_back(model);
+		shaders.push_back(shader < 0 ? Intern(shaderNames, "model") : shader);
+		return true;
+	}
+
+	// turns parent names into indices and sorts the nodes so that parents come first
+	bool resolveParents(const vector<string> &parentNames)
+	{
+		size_t count = names.size();
+		vector<int> parent(count, -1);
+		for (size_t i = 0; i < count; i++)
+		{
+			if (parentNames[i].empty())
+				continue;
+			parent[i] = find(parentNames[i]);
+			if (parent[i] < 0)
+			{
+				cout << "ERROR::SCENE::UNKNOWN_PARENT " << parentNames[i] << " of " << names[i] << endl;
+				return false;
+			}
+		}
+
+		// depth of every node; a chain longer than the node count is a cycle
+		vector<unsigned int> depth(count, 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			for (int p = parent[i]; p >= 0; p = parent[p])
+			{
+				if (++depth[i] > count)
+				{
+					cout << "ERROR::SCENE::PARENT_CYCLE at " << names[i] << endl;
+					return false;
+				}
+			}
+		}
+		vector<int> order(count);
+		for (size_t i = 0; i < count; i++)
+			order[i] = (int)i;
+		stable_sort(order.begin(), order.end(), [&depth](int a, int b) { return depth[a] < depth[b]; });
+		vector<int> newIndex(count);
+		for (size_t i = 0; i < count; i++)
+			newIndex[order[i]] = (int)i;
+
+		Reorder(names, order);
+		Reorder(positions, order);
+		Reorder(rotations, order);
+		Reorder(scales, order);
+		Reorder(worlds, order);
+		Reorder(flags, order);
+		Reorder(models, order);
+		Reorder(shaders, order);
+		parents.resize(count);
+		byName.clear();
+		for (size_t i = 0; i < count; i++)
+		{
+			parents[i] = parent[order[i]] < 0 ? -1 : newIndex[parent[order[i]]];
+			byName[names[i]] = (int)i;
+			// whatever hangs below a moving node moves as well
+			if (parents[i] >= 0 && (flags[parents[i]] & SCENE_NODE_DYNAMIC))
+				flags[i] |= SCENE_NODE_DYNAMIC;
+		}
+		return true;
+	}
+
+	template <typename T>
+	static void Reorder(vector<T> &values, const vector<int> &order)
+	{
+		vector<T> sorted;
+		sorted.reserve(values.size());
+		for (size_t i = 0; i < order.size(); i++)
+			sorted.push_back(values[order[i]]);
+		values.swap(sorted);
+	}
+};
+#endif
@@ -3,17 +3,59 @@
 
 #include "glad/glad.h"
 #include "glm/glm.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+
+// FNV-1a of a uniform name. constexpr, so names given as literals are hashed by the compiler
+// in optimized builds (and always when used to initialize a constexpr UniformName).
+constexpr uint32_t UniformNameHash(const char *name, uint32_t hash = 2166136261u)
+{
+	return *name ? UniformNameHash(name + 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+// the argument of every Shader setter: a uniform name reduced to its hash
+struct UniformName
+{
+	uint32_t hash;
+
+	template <size_t N>
+	constexpr UniformName(const char (&name)[N]) : hash(UniformNameHash(name)) {}
+	// names built at run time, hashed on every call
+	UniformName(const std::string &name) : hash(UniformNameHash(name.c_str())) {}
+};
+
+// the uniforms set for every draw, hashed once here instead of at every call in debug builds
+constexpr UniformName UNIFORM_MODEL("model");
+constexpr UniformName UNIFORM_SHININESS("shininess");
+constexpr UniformName UNIFORM_POSITION_OFFSET("positionOffset");
+constexpr UniformName UNIFORM_POSITION_SCALE("positionScale");
+constexpr UniformName UNIFORM_OCTAHEDRAL_NORMALS("octahedralNormals");
+
+// binding points of the uniform blocks all programs share, see frame_uniforms.h
+enum UniformBlockBinding {
+	UNIFORM_BLOCK_FRAME = 0,	// "FrameData": camera matrices and position
+	UNIFORM_BLOCK_LIGHT = 1		// "LightData": point and directional light
+};
+
+// A linked program and a table of its active uniforms, reflected once after linking. The
+// setters find a uniform through the hash of its name, so they never allocate or ask the
+// driver for a location, and they skip the GL call when the uniform already holds the value.
+// glUniform* writes to the bound program, so the setters may only be called while this
+// program is in use; debug builds assert it against the program of the last use().
 class Shader
 {
 public:
 	unsigned int ID;
-	// constructor generates the shader on the fly
+	// constructor generates the shader on the fly; defines (e.g. "#define INSTANCED\n") are
+	// inserted into both stages right after their #version line to build shader variants
 	// ------------------------------------------------------------------------
-	Shader(const char* vertexPath, const char* fragmentPath)
+	Shader(const char* vertexPath, const char* fragmentPath, const char* defines = "")
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -36,8 +78,8 @@ public:
 			vShaderFile.close();
 			fShaderFile.close();
 			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
+			vertexCode = InsertDefines(vShaderStream.str(), defines);
+			fragmentCode = InsertDefines(fShaderStream.str(), defines);
 		}
 		catch (std::ifstream::failure e)
 		{
@@ -68,74 +110,248 @@ public:
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
-
+		bindUniformBlock("FrameData", UNIFORM_BLOCK_FRAME);
+		bindUniformBlock("LightData", UNIFORM_BLOCK_LIGHT);
+		reflectUniforms();
 	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use() const
 	{
 		glUseProgram(ID);
+		CurrentProgram() = ID;
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
-	void setBool(const std::string &name, bool value) const
+	void setBool(UniformName name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setInt(name, (int)value);
 	}
 	// ------------------------------------------------------------------------
-	void setInt(const std::string &name, int value) const
+	void setInt(UniformName name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		if (GLint location = changed(name, &value, sizeof(value)))
+			glUniform1i(location - 1, value);
 	}
 	// ------------------------------------------------------------------------
-	void setFloat(const std::string &name, float value) const
+	void setFloat(UniformName name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		if (GLint location = changed(name, &value, sizeof(value)))
+			glUniform1f(location - 1, value);
 	}
 	// ------------------------------------------------------------------------
-	void setVec2(const std::string &name, const glm::vec2 &value) const
+	void setVec2(UniformName name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (GLint location = changed(name, &value[0], sizeof(value)))
+			glUniform2fv(location - 1, 1, &value[0]);
 	}
-	void setVec2(const std::string &name, float x, float y) const
+	void setVec2(UniformName name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setVec2(name, glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
-	void setVec3(const std::string &name, const glm::vec3 &value) const
+	void setVec3(UniformName name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (GLint location = changed(name, &value[0], sizeof(value)))
+			glUniform3fv(location - 1, 1, &value[0]);
 	}
-	void setVec3(const std::string &name, float x, float y, float z) const
+	void setVec3(UniformName name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec3(name, glm::vec3(x, y, z));
 	}
 	// ------------------------------------------------------------------------
-	void setVec4(const std::string &name, const glm::vec4 &value) const
+	void setVec4(UniformName name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (GLint location = changed(name, &value[0], sizeof(value)))
+			glUniform4fv(location - 1, 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w) const
+	void setVec4(UniformName name, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec4(name, glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
-	void setMat2(const std::string &name, const glm::mat2 &mat) const
+	void setMat2(UniformName name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (GLint location = changed(name, &mat[0][0], sizeof(mat)))
+			glUniformMatrix2fv(location - 1, 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat3(const std::string &name, const glm::mat3 &mat) const
+	void setMat3(UniformName name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (GLint location = changed(name, &mat[0][0], sizeof(mat)))
+			glUniformMatrix3fv(location - 1, 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
-	void setMat4(const std::string &name, const glm::mat4 &mat) const
+	void setMat4(UniformName name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (GLint location = changed(name, &mat[0][0], sizeof(mat)))
+			glUniformMatrix4fv(location - 1, 1, GL_FALSE, &mat[0][0]);
+	}
+	// ------------------------------------------------------------------------
+	// location of an active uniform, -1 if the program has none by that name
+	GLint uniformLocation(UniformName name) const
+	{
+		const Uniform *uniform = find(name.hash);
+		return uniform ? uniform->location : -1;
 	}
 
 private:
+	// one active uniform, or one element of a uniform array
+	struct Uniform
+	{
+		uint32_t hash;
+		GLint location;		// -1 marks an empty slot of the table
+		unsigned int value;	// offset of the last value set into values
+		unsigned int size;
+	};
+
+	// open addressing on the name hash, sized to a power of two at least twice the uniform count
+	std::vector<Uniform> uniforms;
+	// what every uniform currently holds; GL starts them all at zero
+	mutable std::vector<unsigned char> values;
+
+	const Uniform* find(uint32_t hash) const
+	{
+		if (uniforms.empty())
+			return NULL;
+		size_t mask = uniforms.size() - 1;
+		for (size_t slot = hash & mask; uniforms[slot].location != -1; slot = (slot + 1) & mask)
+			if (uniforms[slot].hash == hash)
+				return &uniforms[slot];
+		return NULL;
+	}
+
+	// location + 1 if the uniform exists and value differs from what it holds, 0 otherwise;
+	// records value as the new contents, so the caller has to set it
+	GLint changed(UniformName name, const void *value, size_t size) const
+	{
+		assert(CurrentProgram() == ID);
+		const Uniform *uniform = find(name.hash);
+		if (!uniform)
+			return 0;
+		unsigned char *held = &values[uniform->value];
+		size = size < uniform->size ? size : uniform->size;
+		if (memcmp(held, value, size) == 0)
+			return 0;
+		memcpy(held, value, size);
+		return uniform->location + 1;
+	}
+
+	// the program of the last use(), kept here so the setters' assert needs no glGet
+	static GLuint& CurrentProgram()
+	{
+		static GLuint current = 0;
+		return current;
+	}
+
+	static unsigned int UniformTypeSize(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 16;
+		case GL_FLOAT_MAT3: return 36;
+		case GL_FLOAT_MAT4: return 64;
+		}
+		return 4; // scalars and samplers
+	}
+
+	void addUniform(const std::string &name, GLint location, unsigned int value, unsigned int size)
+	{
+		uint32_t hash = UniformNameHash(name.c_str());
+		size_t mask = uniforms.size() - 1, slot = hash & mask;
+		for (; uniforms[slot].location != -1; slot = (slot + 1) & mask)
+		{
+			if (uniforms[slot].hash == hash)
+			{
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << name << std::endl;
+				return;
+			}
+		}
+		Uniform uniform = { hash, location, value, size };
+		uniforms[slot] = uniform;
+	}
+
+	// the #version directive has to stay the first line, the defines go after it
+	static std::string InsertDefines(const std::string &code, const char *defines)
+	{
+		if (!*defines)
+			return code;
+		size_t version = code.find("#version");
+		size_t line = version == std::string::npos ? 0 : code.find('\n', version);
+		line = line == std::string::npos ? code.size() : line + 1;
+		return code.substr(0, line) + defines + code.substr(line);
+	}
+
+	// GLSL 4.10 has no binding layout qualifier for blocks, so they are bound after linking
+	void bindUniformBlock(const char *name, UniformBlockBinding binding)
+	{
+		GLuint index = glGetUniformBlockIndex(ID, name);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
+
+	// builds the uniform table from the linked program
+	void reflectUniforms()
+	{
+		struct Active
+		{
+			std::string name;
+			GLint location;
+			unsigned int size;
+		};
+		std::vector<Active> active;
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> buffer(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint arraySize;
+			GLenum type;
+			GLsizei length;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &arraySize, &type, buffer.data());
+			Active uniform = { std::string(buffer.data(), length), glGetUniformLocation(ID, buffer.data()), UniformTypeSize(type) };
+			if (uniform.location < 0)
+				continue; // part of a uniform block
+			// arrays are reported as "name[0]"; "name" and every "name[i]" can be set
+			size_t nameLength = uniform.name.size();
+			if (nameLength > 3 && uniform.name.compare(nameLength - 3, 3, "[0]") == 0)
+			{
+				std::string base = uniform.name.substr(0, nameLength - 3);
+				uniform.name = base;
+				active.push_back(uniform);
+				for (GLint element = 0; element < arraySize; element++)
+				{
+					uniform.name = base + "[" + std::to_string(element) + "]";
+					uniform.location = glGetUniformLocation(ID, uniform.name.c_str());
+					active.push_back(uniform);
+				}
+			}
+			else
+				active.push_back(uniform);
+		}
+
+		size_t slots = 1;
+		while (slots < active.size() * 2)
+			slots *= 2;
+		Uniform empty = { 0, -1, 0, 0 };
+		uniforms.assign(slots, empty);
+		values.clear();
+		unsigned int value = 0;
+		for (size_t i = 0; i < active.size(); i++)
+		{
+			// "name" and "name[0]" share their location, and so the value they hold
+			if (i == 0 || active[i].location != active[i - 1].location)
+			{
+				value = (unsigned int)values.size();
+				values.resize(values.size() + active[i].size, 0);
+			}
+			addUniform(active[i].name, active[i].location, value, active[i].size);
+		}
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
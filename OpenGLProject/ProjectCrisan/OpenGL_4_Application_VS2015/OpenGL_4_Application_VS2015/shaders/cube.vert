@@ -2,18 +2,31 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef INSTANCED
+layout (location = 5) in mat4 aModel;		// one per box of the dynamics stress test
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 out vec3 FogFrag;
 
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+#ifndef INSTANCED
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
 
 void main()
 {
+#ifdef INSTANCED
+	mat4 model = aModel;
+#endif
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;  
     TexCoords = aTexCoords;
@@ -25,7 +25,6 @@ struct DirLight {
 struct Material {
     sampler2D diffuse;
     sampler2D specular;    
-    float shininess;
 }; 
 
 in vec3 FragPos;  
@@ -33,10 +32,20 @@ in vec3 Normal;
 in vec2 TexCoords;
 in vec3 FogFrag;
  
-uniform vec3 viewPos;
-uniform Light light;
-uniform DirLight dirLight;
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform LightData {
+    Light light;
+    DirLight dirLight;
+};
+
 uniform Material material;
+uniform float shininess;
 
 vec3 CalcPointLight(Light light, vec3 norm, vec3 fragPos, vec3 viewDir)
 {
@@ -52,7 +61,7 @@ vec3 CalcPointLight(Light light, vec3 norm, vec3 fragPos, vec3 viewDir)
     // specular
     //vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb; 
     
     // attenuation
@@ -73,7 +82,7 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
     vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     // combine results
     vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
     vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
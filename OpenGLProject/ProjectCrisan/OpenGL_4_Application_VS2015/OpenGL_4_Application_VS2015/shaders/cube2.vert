@@ -8,9 +8,14 @@ out vec3 Normal;
 out vec2 TexCoords;
 out vec3 FogFrag;
 
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main()
 {
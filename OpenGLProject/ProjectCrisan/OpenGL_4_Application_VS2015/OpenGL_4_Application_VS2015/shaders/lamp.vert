@@ -1,11 +1,20 @@
 #version 410 core
 layout (location = 0) in vec3 aPos;
 
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// set by Mesh::Draw, see vertex_format.h
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0f);
+	gl_Position = projection * view * model * vec4(positionOffset + positionScale * aPos, 1.0f);
 }
\ No newline at end of file
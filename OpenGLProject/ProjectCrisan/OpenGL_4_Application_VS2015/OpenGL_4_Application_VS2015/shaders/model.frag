@@ -26,12 +26,21 @@ in vec3 Normal;
 in vec2 TexCoords;
 in vec3 FogFrag;
 
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+layout (std140) uniform LightData {
+    Light light;
+    DirLight dirLight;
+};
+
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
-uniform vec3 viewPos;
-uniform Light light;
 uniform float shininess;
-uniform DirLight dirLight;
 
 vec3 CalcPointLight(Light light, vec3 norm, vec3 fragPos, vec3 viewDir)
 {
@@ -1,24 +1,62 @@
 #version 410 core
 
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 0) in vec3 aPos;		// relative to the mesh bounds in the compact vertex layouts
+layout (location = 1) in vec3 aNormal;		// octahedral encoded in xy in the compact vertex layouts
 layout (location = 2) in vec2 aTexCoords;
+#ifdef INSTANCED
+layout (location = 5) in mat4 aModel;		// one per instance, see Model::SetInstances
+#endif
+#ifdef INDIRECT
+layout (location = 9) in vec3 aPositionOffset;	// one per instance as well, written by shaders/cull.comp
+layout (location = 10) in vec3 aPositionScale;
+#endif
 
 out vec2 TexCoords;
 out vec3 FragPos;
 out vec3 Normal;
 out vec3 FogFrag;
 
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
+
+#ifndef INSTANCED
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
+
+// set by Mesh::Draw, see vertex_format.h
+#ifndef INDIRECT
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#endif
+uniform bool octahedralNormals;
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
 
 void main()
 {
-	FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal; 
+#ifdef INSTANCED
+	mat4 model = aModel;
+#endif
+#ifdef INDIRECT
+	vec3 positionOffset = aPositionOffset;
+	vec3 positionScale = aPositionScale;
+#endif
+	vec3 position = positionOffset + positionScale * aPos;
+	vec3 normal = octahedralNormals ? octahedralDecode(aNormal.xy) : aNormal;
+	FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normal; 
     TexCoords = aTexCoords; 
-	FogFrag = vec3(view * model * vec4(aPos, 1.0));
+	FogFrag = vec3(view * model * vec4(position, 1.0));
 	
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * model * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -3,12 +3,17 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+// written once per frame by FrameUniforms, see frame_uniforms.h
+layout (std140) uniform FrameData {
+    mat4 projection;
+    mat4 view;
+    vec3 viewPos;
+};
 
 void main () 
 {
 	TexCoords = aPos;
-	vec4 pos = projection * view * vec4(aPos, 1.0);
+	// the rotation of the camera only, the sky stays around it
+	vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
 	gl_Position = pos.xyww;
 }
\ No newline at end of file
@@ -0,0 +1,199 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include "glm/glm.hpp"
+
+#include "hlod.h"
+#include "mesh.h"
+#include "model.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "shader_s.h"
+#include "texture_manager.h"
+#include "vertex_format.h"
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+// models with more triangles than this keep their own draws, with their levels of detail and
+// the GPU driven culling; a batch is always drawn at full detail
+const size_t STATIC_BATCH_MAX_TRIANGLES = 1024;
+
+// what StaticBatches::build merged
+struct StaticBatchStats {
+	unsigned int batches;
+	unsigned int nodes;
+	unsigned int meshes;	// mesh placements merged into the batches
+};
+
+// Static batching. At load the meshes of small static nodes are transformed into world space
+// and merged by material: one mesh per material, drawn with one draw and an identity model
+// matrix, culled by the bounds of everything merged into it. Nodes baked into different HLOD
+// cells (see hlod.h) go into different batches, so a cell drawn as its proxy takes its batches
+// along. A batch is split before it needs 32 bit indices. Only nodes whose every mesh shares its
+// material with another placement are merged, a batch of one would only lose the level of detail.
+class StaticBatches
+{
+public:
+	StaticBatches()
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	// gives the textures and the geometry of the batches back to their managers
+	~StaticBatches()
+	{
+		for (size_t i = 0; i < batches.size(); i++)
+		{
+			for (size_t t = 0; t < batches[i].textures.size(); t++)
+				Textures().release(batches[i].textures[t].handle);
+			batches[i].releaseGeometry();
+		}
+	}
+
+	StaticBatches(const StaticBatches&) = delete;
+	StaticBatches& operator=(const StaticBatches&) = delete;
+
+	// merges the nodes set in candidates, by node, from the imported models (by model index of
+	// the scene, before they are moved into their Model); the nodes must not move after this
+	void build(const Scene &scene, const vector<ModelData> &models, const vector<uint8_t> &candidates, const HlodSet &hlod)
+	{
+		// the material of every mesh as a key of its texture types and paths
+		vector<vector<string> > meshKeys(models.size());
+		vector<uint8_t> smallModels(models.size(), 0);
+		for (size_t m = 0; m < models.size(); m++)
+		{
+			size_t triangles = 0;
+			for (unsigned int i = 0; i < models[m].meshCount(); i++)
+			{
+				triangles += models[m].indexCount(i) / 3;
+				meshKeys[m].push_back(MaterialKey(models[m], i));
+			}
+			smallModels[m] = models[m].meshCount() && triangles <= STATIC_BATCH_MAX_TRIANGLES;
+		}
+
+		// placements per material and cell; a node goes in if none of its meshes would be alone
+		map<pair<string, int>, unsigned int> placements;
+		for (unsigned int n = 0; n < scene.nodeCount(); n++)
+		{
+			if (!candidates[n] || !smallModels[scene.models[n]])
+				continue;
+			const vector<string> &keys = meshKeys[scene.models[n]];
+			for (size_t i = 0; i < keys.size(); i++)
+				placements[make_pair(keys[i], hlod.cellOf(n))]++;
+		}
+		batchedNodes.assign(scene.nodeCount(), 0);
+		for (unsigned int n = 0; n < scene.nodeCount(); n++)
+		{
+			if (!candidates[n] || !smallModels[scene.models[n]])
+				continue;
+			const vector<string> &keys = meshKeys[scene.models[n]];
+			bool shared = true;
+			for (size_t i = 0; i < keys.size(); i++)
+				shared = shared && placements[make_pair(keys[i], hlod.cellOf(n))] > 1;
+			batchedNodes[n] = shared;
+		}
+
+		// the world space vertices of every batch, the open one of each material and cell last
+		struct Pending {
+			int model;
+			unsigned int mesh;
+			int cell;
+			vector<Vertex> vertices;
+			vector<unsigned int> indices;
+		};
+		vector<Pending> pending;
+		map<pair<string, int>, size_t> open;
+		for (unsigned int n = 0; n < scene.nodeCount(); n++)
+		{
+			if (!batchedNodes[n])
+				continue;
+			int model = scene.models[n];
+			const ModelData &data = models[model];
+			const glm::mat4 &world = scene.worlds[n];
+			glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+			for (unsigned int i = 0; i < data.meshCount(); i++)
+			{
+				pair<string, int> key(meshKeys[model][i], hlod.cellOf(n));
+				map<pair<string, int>, size_t>::iterator found = open.find(key);
+				if (found == open.end() || pending[found->second].vertices.size() + data.vertexCount(i) > MAX_SHORT_INDEXED_VERTICES)
+				{
+					Pending batch;
+					batch.model = model;
+					batch.mesh = i;
+					batch.cell = key.second;
+					pending.push_back(batch);
+					open[key] = pending.size() - 1;
+				}
+				Pending &batch = pending[open[key]];
+				unsigned int base = (unsigned int)batch.vertices.size();
+				const Vertex *vertices = data.vertices(i);
+				for (size_t v = 0; v < data.vertexCount(i); v++)
+				{
+					Vertex vertex = vertices[v];
+					vertex.Position = glm::vec3(world * glm::vec4(vertex.Position, 1.0f));
+					vertex.Normal = NormalizeOrZero(normalMatrix * vertex.Normal);
+					vertex.Tangent = NormalizeOrZero(glm::mat3(world) * vertex.Tangent);
+					vertex.Bitangent = NormalizeOrZero(glm::mat3(world) * vertex.Bitangent);
+					batch.vertices.push_back(vertex);
+				}
+				const unsigned int *indices = data.indices(i);
+				for (size_t t = 0; t < data.indexCount(i); t++)
+					batch.indices.push_back(base + indices[t]);
+				stats.meshes++;
+			}
+			stats.nodes++;
+		}
+
+		// the textures are acquired once per batch, the same files as the model's meshes acquire
+		batches.reserve(pending.size());
+		for (size_t b = 0; b < pending.size(); b++)
+		{
+			Pending &batch = pending[b];
+			const ModelData &data = models[batch.model];
+			vector<Texture> textures = data.textures(batch.mesh);
+			for (size_t t = 0; t < textures.size(); t++)
+				textures[t].handle = TextureFromFile(textures[t].path.c_str(), data.directory);
+			batches.emplace_back(std::move(batch.vertices), std::move(batch.indices), std::move(textures));
+			batchCells.push_back(batch.cell);
+		}
+		stats.batches = (unsigned int)batches.size();
+		if (stats.batches)
+			cout << "STATIC_BATCH:: " << stats.meshes << " meshes of " << stats.nodes << " nodes merged into " << stats.batches << " batches" << endl;
+	}
+
+	// by node, 1 if it is drawn as part of a batch; leave these nodes out everywhere else
+	const vector<uint8_t>& batched() const { return batchedNodes; }
+
+	// queues the batches, drawn with shader like any model; those of cells hlod draws as their
+	// proxy are left out
+	void Submit(RenderQueue &queue, const Shader &shader, const HlodSet &hlod) const
+	{
+		for (size_t i = 0; i < batches.size(); i++)
+			if (!hlod.isProxied(batchCells[i]))
+				batches[i].Submit(queue, shader, glm::mat4());
+	}
+
+	const StaticBatchStats& lastStats() const { return stats; }
+
+private:
+	vector<Mesh> batches;
+	vector<int> batchCells;			// by batch, the HLOD cell of its nodes or -1
+	vector<uint8_t> batchedNodes;	// by node
+	StaticBatchStats stats;
+
+	// meshes with equal keys acquire the same textures into the same units
+	static string MaterialKey(const ModelData &data, unsigned int i)
+	{
+		vector<Texture> textures = data.textures(i);
+		string key;
+		for (size_t t = 0; t < textures.size(); t++)
+			key += textures[t].type + '\n' + data.directory + '/' + textures[t].path + '\n';
+		return key;
+	}
+};
+#endif
@@ -0,0 +1,412 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include "glad/glad.h"
+#include "stb_image.h"
+
+#include "ktx_texture.h"
+#include "mapped_file.h"
+#include "texture_streamer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// refers to one acquired texture; 0 is never handed out
+typedef unsigned int TextureHandle;
+
+// Process wide owner of every texture. Lookups go through a hash map on the normalized path,
+// so asking for the same file twice is O(1) and returns the same handle. On a miss the file
+// is read and hashed on the worker pool, and files with identical bytes share a single GL
+// texture, whatever their path; a hash match only shares when the dimensions, formats and
+// sizes agree as well. Handles are reference counted; the GL texture goes away
+// with the last handle that uses it. A 2D texture whose cooked <file>.ktx is up to date and
+// in a format the GL supports is loaded from that file instead of the source image.
+class TextureManager
+{
+public:
+	TextureManager() : placeholder2D(0), placeholderCube(0)
+	{
+		sources.push_back(Source()); // slot 0 stays unused so that 0 can mean "no texture"
+	}
+
+	// 2D texture from a file, see TextureStreamer::request for the sampling state
+	TextureHandle acquire(const string &filename)
+	{
+		return acquire(GL_TEXTURE_2D, vector<string>(1, filename));
+	}
+
+	// cubemap from 6 faces in +X, -X, +Y, -Y, +Z, -Z order
+	TextureHandle acquireCubemap(const vector<string> &faces)
+	{
+		return acquire(GL_TEXTURE_CUBE_MAP, faces);
+	}
+
+	void addRef(TextureHandle handle)
+	{
+		if (handle)
+			sources[handle].refs++;
+	}
+
+	// drops one reference, the last one frees the path entry and possibly the GL texture
+	void release(TextureHandle handle)
+	{
+		if (!handle || handle >= sources.size() || --sources[handle].refs > 0)
+			return; // handles outliving shutdown() are ignored
+		Source &source = sources[handle];
+		byPath.erase(source.key);
+		reading.erase(remove(reading.begin(), reading.end(), handle), reading.end());
+		if (source.content >= 0)
+		{
+			Content &content = contents[source.content];
+			if (--content.users == 0)
+			{
+				TextureStream().cancel(content.texture);
+				glDeleteTextures(1, &content.texture);
+				eraseContent(content.hash, source.content);
+				freeContents.push_back(source.content);
+			}
+		}
+		source = Source();
+		freeSources.push_back(handle);
+	}
+
+	// the texture to bind for handle; a shared placeholder until its file has been read
+	unsigned int glName(TextureHandle handle) const
+	{
+		const Source &source = sources[handle];
+		if (source.content >= 0)
+			return contents[source.content].texture;
+		return source.target == GL_TEXTURE_CUBE_MAP ? placeholderCube : placeholder2D;
+	}
+
+	// hands finished reads over to the streamer or to an existing texture with the same
+	// contents; call once per frame on the context thread, before TextureStream().update()
+	void update()
+	{
+		for (unsigned int i = 0; i < reading.size(); )
+		{
+			Source &source = sources[reading[i]];
+			if (source.read.wait_for(chrono::seconds(0)) != future_status::ready)
+			{
+				i++;
+				continue;
+			}
+			resolve(source);
+			reading[i] = reading.back();
+			reading.pop_back();
+		}
+	}
+
+	// number of distinct GL textures and of the paths mapped onto them
+	unsigned int textureCount() const { return (unsigned int)byHash.size(); }
+	unsigned int pathCount() const { return (unsigned int)byPath.size(); }
+
+	// deletes every GL texture; handles must not be drawn with afterwards, releasing them is harmless
+	void shutdown()
+	{
+		for (unsigned int i = 0; i < reading.size(); i++)
+			sources[reading[i]].read.wait();
+		reading.clear();
+		for (unordered_multimap<uint64_t, int>::iterator it = byHash.begin(); it != byHash.end(); ++it)
+		{
+			TextureStream().cancel(contents[it->second].texture);
+			glDeleteTextures(1, &contents[it->second].texture);
+		}
+		byHash.clear();
+		byPath.clear();
+		contents.clear();
+		freeContents.clear();
+		sources.resize(1);
+		freeSources.clear();
+		if (placeholder2D)
+			glDeleteTextures(1, &placeholder2D);
+		if (placeholderCube)
+			glDeleteTextures(1, &placeholderCube);
+		placeholder2D = placeholderCube = 0;
+	}
+
+	// lower case on Windows, forward slashes, no "." or "dir/.." segments
+	static string NormalizePath(const string &path)
+	{
+		string cleaned = path;
+		replace(cleaned.begin(), cleaned.end(), '\\', '/');
+#ifdef _WIN32
+		transform(cleaned.begin(), cleaned.end(), cleaned.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+#endif
+		vector<string> parts;
+		size_t start = 0;
+		while (start <= cleaned.size())
+		{
+			size_t end = cleaned.find('/', start);
+			if (end == string::npos)
+				end = cleaned.size();
+			string part = cleaned.substr(start, end - start);
+			if (part == ".." && !parts.empty() && parts.back() != ".." && !parts.back().empty())
+				parts.pop_back();
+			else if (part != "." && !(part.empty() && !parts.empty()))
+				parts.push_back(part);
+			start = end + 1;
+		}
+		string result;
+		for (unsigned int i = 0; i < parts.size(); i++)
+			result += (i ? "/" : "") + parts[i];
+		return result;
+	}
+
+private:
+	typedef shared_ptr<const vector<unsigned char> > Bytes;
+
+	// what one file holds besides its bytes, compared on a hash match: the dimensions, the
+	// channel count of an image or the internal format of a cooked file, and the data size
+	struct FileShape
+	{
+		int width, height, format;
+		size_t size;
+
+		bool operator==(const FileShape &other) const
+		{
+			return width == other.width && height == other.height && format == other.format && size == other.size;
+		}
+	};
+
+	// the files behind one path entry, read and hashed off the main thread
+	struct FileContents
+	{
+		vector<Bytes> files;
+		vector<FileShape> shapes;
+		uint64_t hash;
+		bool valid;
+	};
+
+	struct Source
+	{
+		string key;
+		GLenum target;
+		vector<string> files;
+		unsigned int refs;
+		int content;	// index into contents, -1 while the files are being read or if they are missing
+		future<FileContents> read;
+
+		Source() : target(GL_TEXTURE_2D), refs(0), content(-1) {}
+	};
+
+	struct Content
+	{
+		uint64_t hash;
+		vector<FileShape> shapes;
+		unsigned int texture;
+		unsigned int users;	// path entries resolved to this texture
+	};
+
+	vector<Source> sources;
+	vector<unsigned int> freeSources;
+	vector<Content> contents;
+	vector<int> freeContents;
+	unordered_map<string, TextureHandle> byPath;
+	unordered_multimap<uint64_t, int> byHash;	// different contents may collide
+	vector<TextureHandle> reading;
+	unsigned int placeholder2D, placeholderCube;
+	vector<GLenum> compressedFormats;	// block formats the context can sample
+
+	TextureHandle acquire(GLenum target, const vector<string> &files)
+	{
+		string key = target == GL_TEXTURE_CUBE_MAP ? "cube:" : "";
+		for (unsigned int i = 0; i < files.size(); i++)
+			key += (i ? "|" : "") + NormalizePath(files[i]);
+
+		unordered_map<string, TextureHandle>::iterator found = byPath.find(key);
+		if (found != byPath.end())
+		{
+			sources[found->second].refs++;
+			return found->second;
+		}
+
+		createPlaceholders();
+		TextureHandle handle;
+		if (!freeSources.empty())
+		{
+			handle = freeSources.back();
+			freeSources.pop_back();
+		}
+		else
+		{
+			handle = (TextureHandle)sources.size();
+			sources.push_back(Source());
+		}
+		Source &source = sources[handle];
+		source.key = key;
+		source.target = target;
+		source.files = files;
+		source.refs = 1;
+		source.content = -1;
+		vector<GLenum> formats = compressedFormats;
+		source.read = WorkerPool().submit([target, files, formats]() { return ReadFiles(target, files, formats); });
+		byPath[key] = handle;
+		reading.push_back(handle);
+		return handle;
+	}
+
+	void resolve(Source &source)
+	{
+		FileContents read = source.read.get();
+		if (!read.valid)
+			return; // keeps the placeholder, ReadFiles already reported the missing file
+
+		pair<unordered_multimap<uint64_t, int>::iterator, unordered_multimap<uint64_t, int>::iterator> same = byHash.equal_range(read.hash);
+		for (unordered_multimap<uint64_t, int>::iterator it = same.first; it != same.second; ++it)
+		{
+			if (contents[it->second].shapes == read.shapes)
+			{
+				source.content = it->second;
+				contents[it->second].users++;
+				return;
+			}
+		}
+
+		Content content;
+		content.hash = read.hash;
+		content.shapes = read.shapes;
+		content.texture = TextureStream().requestEncoded(source.target, read.files, source.files);
+		content.users = 1;
+		if (!freeContents.empty())
+		{
+			source.content = freeContents.back();
+			freeContents.pop_back();
+			contents[source.content] = content;
+		}
+		else
+		{
+			source.content = (int)contents.size();
+			contents.push_back(content);
+		}
+		byHash.insert(make_pair(read.hash, source.content));
+	}
+
+	void eraseContent(uint64_t hash, int content)
+	{
+		pair<unordered_multimap<uint64_t, int>::iterator, unordered_multimap<uint64_t, int>::iterator> same = byHash.equal_range(hash);
+		for (unordered_multimap<uint64_t, int>::iterator it = same.first; it != same.second; ++it)
+		{
+			if (it->second == content)
+			{
+				byHash.erase(it);
+				return;
+			}
+		}
+	}
+
+	// runs on the worker pool: reads every face and hashes them together with the target
+	static FileContents ReadFiles(GLenum target, const vector<string> &files, const vector<GLenum> &formats)
+	{
+		FileContents result;
+		result.valid = true;
+		// FNV-1a, 64 bit
+		uint64_t hash = 14695981039346656037ull;
+		auto mix = [&hash](const unsigned char *data, size_t size)
+		{
+			for (size_t i = 0; i < size; i++)
+				hash = (hash ^ data[i]) * 1099511628211ull;
+		};
+		mix((const unsigned char*)&target, sizeof(target));
+		if (target == GL_TEXTURE_2D)
+		{
+			size_t blocksStart;
+			Bytes cooked = ReadCooked(files[0], formats, blocksStart);
+			if (cooked)
+			{
+				// the key/value data holds the stamp of the source, only the blocks identify the contents
+				mix(cooked->data() + offsetof(KtxHeader, glInternalFormat), sizeof(uint32_t) * 4);
+				mix(cooked->data() + blocksStart, cooked->size() - blocksStart);
+				KtxHeader header;
+				memcpy(&header, cooked->data(), sizeof(header));
+				FileShape shape = { (int)header.pixelWidth, (int)header.pixelHeight, (int)header.glInternalFormat, cooked->size() - blocksStart };
+				result.shapes.push_back(shape);
+				result.files.push_back(cooked);
+				result.hash = hash;
+				return result;
+			}
+		}
+		for (unsigned int i = 0; i < files.size(); i++)
+		{
+			ifstream in(files[i].c_str(), ios::binary | ios::ate);
+			if (!in)
+			{
+				std::cout << "Texture failed to load at path: " << files[i] << std::endl;
+				result.valid = false;
+				return result;
+			}
+			shared_ptr<vector<unsigned char> > bytes = make_shared<vector<unsigned char> >((size_t)in.tellg());
+			in.seekg(0);
+			in.read((char*)bytes->data(), bytes->size());
+			uint64_t size = bytes->size();
+			mix((const unsigned char*)&size, sizeof(size));
+			mix(bytes->data(), bytes->size());
+			// from the image header, without decoding; all zero for files stb_image cannot read
+			FileShape shape = { 0, 0, 0, bytes->size() };
+			if (!stbi_info_from_memory(bytes->data(), (int)bytes->size(), &shape.width, &shape.height, &shape.format))
+				shape.width = shape.height = shape.format = 0;
+			result.shapes.push_back(shape);
+			result.files.push_back(bytes);
+		}
+		result.hash = hash;
+		return result;
+	}
+
+	// the cooked version of filename if it is up to date and its format is in formats
+	static Bytes ReadCooked(const string &filename, const vector<GLenum> &formats, size_t &blocksStart)
+	{
+		FileStamp stamp;
+		if (!GetFileStamp(filename, stamp))
+			return Bytes();
+		MappedFile file;
+		if (!file.open(KtxPath(filename)))
+			return Bytes();
+		KtxHeader header;
+		vector<KtxLevel> levels;
+		string cookedFrom;
+		if (!ParseKtx(file.data(), file.size(), header, levels, &cookedFrom) || cookedFrom != FormatStamp(stamp) ||
+			find(formats.begin(), formats.end(), (GLenum)header.glInternalFormat) == formats.end())
+			return Bytes();
+		blocksStart = sizeof(KtxHeader) + header.bytesOfKeyValueData;
+		return make_shared<const vector<unsigned char> >(file.data(), file.data() + file.size());
+	}
+
+	// the placeholders and the format list are set up on first use, when the context exists
+	void createPlaceholders()
+	{
+		if (placeholder2D)
+			return;
+		compressedFormats = SupportedCompressedFormats();
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		glGenTextures(1, &placeholder2D);
+		glBindTexture(GL_TEXTURE_2D, placeholder2D);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glGenTextures(1, &placeholderCube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderCube);
+		for (unsigned int i = 0; i < 6; i++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	}
+};
+
+// the process wide texture manager
+inline TextureManager& Textures()
+{
+	static TextureManager manager;
+	return manager;
+}
+#endif
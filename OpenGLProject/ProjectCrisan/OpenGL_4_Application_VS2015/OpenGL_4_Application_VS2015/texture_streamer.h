@@ -0,0 +1,513 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include "glad/glad.h"
+#include "stb_image.h"
+
+#include "ktx_texture.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// pixels decoded by stb_image or the block levels of a cooked KTX file, released once the image has been uploaded
+struct ImageData
+{
+	string path;
+	int width, height, components;
+	unique_ptr<unsigned char, void(*)(void*)> pixels;
+	GLenum compressedFormat;					// 0 for stb pixels
+	shared_ptr<const vector<unsigned char> > blocks;	// the KTX file the levels point into
+	vector<KtxLevel> levels;					// finest first
+
+	ImageData() : width(0), height(0), components(0), pixels(NULL, stbi_image_free), compressedFormat(0) {}
+
+	bool valid() const { return pixels != NULL || blocks != NULL; }
+};
+
+inline ImageData DecodeImage(const string &filename)
+{
+	ImageData image;
+	image.path = filename;
+	image.pixels.reset(stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0));
+	return image;
+}
+
+// same as DecodeImage for a file that has already been read into memory; a cooked KTX file
+// is not decoded at all, the image just refers to its block levels
+inline ImageData DecodeImage(const shared_ptr<const vector<unsigned char> > &encoded, const string &name)
+{
+	ImageData image;
+	image.path = name;
+	if (encoded->size() >= sizeof(KTX_IDENTIFIER) && memcmp(encoded->data(), KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) == 0)
+	{
+		KtxHeader header;
+		if (ParseKtx(encoded->data(), encoded->size(), header, image.levels))
+		{
+			image.width = header.pixelWidth;
+			image.height = header.pixelHeight;
+			image.compressedFormat = header.glInternalFormat;
+			image.blocks = encoded;
+		}
+		return image;
+	}
+	image.pixels.reset(stbi_load_from_memory(encoded->data(), (int)encoded->size(), &image.width, &image.height, &image.components, 0));
+	return image;
+}
+
+inline GLenum ImageFormat(int components)
+{
+	if (components == 1)
+		return GL_RED;
+	else if (components == 2)
+		return GL_RG;
+	else if (components == 3)
+		return GL_RGB;
+	return GL_RGBA;
+}
+
+// Hands out texture names immediately and fills them in the background. A requested texture
+// samples a 1x1 placeholder until its image has been decoded on the worker pool and copied in
+// through a small ring of pixel buffer objects, a few megabytes per frame, so even large images
+// never stall a frame. The texture name never changes, callers can keep it from the start.
+class TextureStreamer
+{
+public:
+	static const unsigned int PBO_COUNT = 4;
+	static const unsigned int PBO_SIZE = 4 * 1024 * 1024;
+	// compressed levels up to this size are copied in directly when the upload starts, so a
+	// cooked texture shows a blurry preview right away instead of the grey placeholder
+	static const unsigned int PREVIEW_SIZE = 64;
+
+	// bytes copied to the GL per update(); at least one row is always sent
+	size_t uploadBudget;
+
+	TextureStreamer() : uploadBudget(2 * PBO_SIZE), nextPbo(0), pbosCreated(false)
+	{
+		memset(pbos, 0, sizeof(pbos));
+		memset(fences, 0, sizeof(fences));
+	}
+
+	// 2D texture with repeat wrapping and trilinear filtering, like every model texture
+	unsigned int request(const string &filename)
+	{
+		vector<string> files(1, filename);
+		return requestFiles(GL_TEXTURE_2D, files);
+	}
+
+	// cubemap from 6 faces in +X, -X, +Y, -Y, +Z, -Z order, clamped and without mipmaps
+	unsigned int requestCubemap(const vector<string> &faces)
+	{
+		return requestFiles(GL_TEXTURE_CUBE_MAP, faces);
+	}
+
+	// like request/requestCubemap for files that were already read into memory (one per face),
+	// which may also be cooked KTX files; names are only used for error messages
+	unsigned int requestEncoded(GLenum target, const vector<shared_ptr<const vector<unsigned char> > > &files, const vector<string> &names)
+	{
+		vector<function<ImageData()> > decoders;
+		for (unsigned int i = 0; i < files.size(); i++)
+		{
+			shared_ptr<const vector<unsigned char> > file = files[i];
+			string name = names[i];
+			decoders.push_back([file, name]() { return DecodeImage(file, name); });
+		}
+		return queue(target, decoders);
+	}
+
+	// moves finished decodes to the GL; call once per frame on the context thread
+	void update()
+	{
+		if (jobs.empty())
+			return;
+		createPbos();
+
+		size_t sent = 0;
+		while (sent < uploadBudget)
+		{
+			list<Job>::iterator job = activeJob();
+			if (job == jobs.end())
+				break;
+			if (!uploadChunk(*job, sent))
+				break; // the ring is still busy with earlier frames
+			if (job->face == job->images.size())
+			{
+				finish(*job);
+				jobs.erase(job);
+			}
+		}
+	}
+
+	// drops any pending work for texture, call before deleting it
+	void cancel(unsigned int texture)
+	{
+		for (list<Job>::iterator job = jobs.begin(); job != jobs.end(); ++job)
+		{
+			if (job->texture == texture)
+			{
+				jobs.erase(job);
+				return;
+			}
+		}
+	}
+
+	// true once every requested texture has its final contents
+	bool idle() const { return jobs.empty(); }
+
+	unsigned int pending() const { return (unsigned int)jobs.size(); }
+
+	// releases the GL objects of the streamer, must run before the context goes away
+	void shutdown()
+	{
+		for (list<Job>::iterator job = jobs.begin(); job != jobs.end(); ++job)
+			for (unsigned int i = 0; i < job->decodes.size(); i++)
+				if (job->decodes[i].valid())
+					job->decodes[i].wait();
+		jobs.clear();
+		for (unsigned int i = 0; i < PBO_COUNT; i++)
+		{
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		if (pbosCreated)
+			glDeleteBuffers(PBO_COUNT, pbos);
+		pbosCreated = false;
+	}
+
+private:
+	struct Job
+	{
+		GLenum target;
+		unsigned int texture;
+		vector<future<ImageData> > decodes;
+		vector<ImageData> images;	// filled once every decode is done
+		unsigned int face;			// face being uploaded
+		int row;					// next row of that face, in 4x4 blocks for compressed images
+		int level;					// compressed level being uploaded, coarsest to finest
+		bool started;
+	};
+
+	list<Job> jobs;
+	unsigned int pbos[PBO_COUNT];
+	GLsync fences[PBO_COUNT];
+	unsigned int nextPbo;
+	bool pbosCreated;
+
+	unsigned int requestFiles(GLenum target, const vector<string> &files)
+	{
+		vector<function<ImageData()> > decoders;
+		for (unsigned int i = 0; i < files.size(); i++)
+		{
+			string filename = files[i];
+			decoders.push_back([filename]() { return DecodeImage(filename); });
+		}
+		return queue(target, decoders);
+	}
+
+	unsigned int queue(GLenum target, const vector<function<ImageData()> > &decoders)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(target, textureID);
+		setPlaceholder(target, 0);
+		if (target == GL_TEXTURE_CUBE_MAP)
+		{
+			glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		}
+		else
+		{
+			glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		}
+
+		jobs.push_back(Job());
+		Job &job = jobs.back();
+		job.target = target;
+		job.texture = textureID;
+		job.face = 0;
+		job.row = 0;
+		job.level = 0;
+		job.started = false;
+		for (unsigned int i = 0; i < decoders.size(); i++)
+			job.decodes.push_back(WorkerPool().submit(decoders[i]));
+		return textureID;
+	}
+
+	// a single mid grey texel at the given level of every face, shown while the image is pending
+	static void setPlaceholder(GLenum target, int level)
+	{
+		const unsigned char grey[4] = { 128, 128, 128, 255 };
+		unsigned int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+		for (unsigned int i = 0; i < faces; i++)
+		{
+			GLenum face = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : target;
+			glTexImage2D(face, level, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+		}
+		glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, level);
+		glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, level);
+	}
+
+	void createPbos()
+	{
+		if (pbosCreated)
+			return;
+		glGenBuffers(PBO_COUNT, pbos);
+		for (unsigned int i = 0; i < PBO_COUNT; i++)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, PBO_SIZE, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		pbosCreated = true;
+	}
+
+	// the job currently being uploaded, or the first one whose decodes have all finished
+	list<Job>::iterator activeJob()
+	{
+		for (list<Job>::iterator job = jobs.begin(); job != jobs.end(); ++job)
+		{
+			if (job->started)
+				return job;
+		}
+		for (list<Job>::iterator job = jobs.begin(); job != jobs.end(); ++job)
+		{
+			bool ready = true;
+			for (unsigned int i = 0; i < job->decodes.size() && ready; i++)
+				ready = job->decodes[i].wait_for(chrono::seconds(0)) == future_status::ready;
+			if (ready)
+			{
+				start(*job);
+				return job;
+			}
+		}
+		return jobs.end();
+	}
+
+	// allocates the full mip chain; the placeholder moves to the 1x1 level at the end of the
+	// chain and stays the only visible level until every row of level 0 has arrived
+	void start(Job &job)
+	{
+		job.started = true;
+		for (unsigned int i = 0; i < job.decodes.size(); i++)
+			job.images.push_back(job.decodes[i].get());
+		job.decodes.clear();
+
+		const ImageData &first = job.images[0];
+		bool valid = first.valid() && (!first.compressedFormat || job.target == GL_TEXTURE_2D);
+		for (unsigned int i = 1; i < job.images.size() && valid; i++)
+			valid = job.images[i].valid() && job.images[i].width == first.width && job.images[i].height == first.height &&
+				job.images[i].components == first.components && job.images[i].compressedFormat == first.compressedFormat;
+		if (!valid)
+		{
+			for (unsigned int i = 0; i < job.images.size(); i++)
+				if (!job.images[i].valid())
+					std::cout << "Texture failed to load at path: " << job.images[i].path << std::endl;
+			job.images.clear(); // keeps the placeholder
+			job.face = 0;
+			return;
+		}
+
+		if (first.compressedFormat)
+		{
+			startCompressed(job);
+			return;
+		}
+
+		GLenum format = ImageFormat(first.components);
+		int levels = 1;
+		for (int size = max(first.width, first.height); size > 1; size /= 2)
+			levels++;
+
+		glBindTexture(job.target, job.texture);
+		for (unsigned int i = 0; i < job.images.size(); i++)
+		{
+			GLenum face = job.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : job.target;
+			int width = first.width, height = first.height;
+			for (int level = 0; level < levels - 1; level++)
+			{
+				glTexImage2D(face, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+				width = max(1, width / 2);
+				height = max(1, height / 2);
+			}
+		}
+		setPlaceholder(job.target, levels - 1);
+	}
+
+	// allocates every level of a cooked texture and copies the small ones in directly; the
+	// larger levels follow through the PBO ring, coarsest first, each one becoming visible as
+	// soon as it is complete
+	void startCompressed(Job &job)
+	{
+		const ImageData &image = job.images[0];
+		glBindTexture(job.target, job.texture);
+		int last = (int)image.levels.size() - 1;
+		job.level = last;
+		for (int level = 0; level <= last; level++)
+		{
+			const KtxLevel &data = image.levels[level];
+			bool preview = data.width <= PREVIEW_SIZE && data.height <= PREVIEW_SIZE;
+			glCompressedTexImage2D(job.target, level, image.compressedFormat, data.width, data.height, 0, (GLsizei)data.size,
+				preview ? image.blocks->data() + data.offset : NULL);
+			if (preview && level <= job.level)
+				job.level = level - 1;
+		}
+		glTexParameteri(job.target, GL_TEXTURE_BASE_LEVEL, min(job.level + 1, last));
+		glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, last);
+		if (job.level < 0)
+			job.face = 1; // everything fitted into the preview
+	}
+
+	// false if the next PBO of the ring is still being read by the GL, never waits
+	bool pboReady()
+	{
+		if (fences[nextPbo])
+		{
+			if (glClientWaitSync(fences[nextPbo], 0, 0) == GL_TIMEOUT_EXPIRED)
+				return false;
+			glDeleteSync(fences[nextPbo]);
+			fences[nextPbo] = 0;
+		}
+		return true;
+	}
+
+	// copies bytes into the next PBO and leaves it bound; returns what to pass as the pixel
+	// pointer, which is src itself if the PBO could not be mapped
+	const unsigned char* stage(const unsigned char *src, size_t bytes, bool &staged)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[nextPbo]);
+		void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		staged = dst != NULL;
+		if (!staged)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // mapping failed, fall back to a plain client memory copy
+			return src;
+		}
+		memcpy(dst, src, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		return NULL; // the data is now read from offset 0 of the bound PBO
+	}
+
+	// fences the PBO used by the last stage() and moves on to the next one
+	void unstage(bool staged)
+	{
+		if (staged)
+			fences[nextPbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		nextPbo = (nextPbo + 1) % PBO_COUNT;
+	}
+
+	// copies as many rows of the active face as fit in one PBO, returns false if no PBO is free
+	bool uploadChunk(Job &job, size_t &sent)
+	{
+		if (job.face == job.images.size())
+			return true; // failed to load, or everything was sent by start()
+
+		if (!pboReady())
+			return false;
+
+		const ImageData &image = job.images[job.face];
+		if (image.compressedFormat)
+		{
+			uploadBlocks(job, sent);
+			return true;
+		}
+
+		size_t rowBytes = (size_t)image.width * image.components;
+		int rows = (int)min((size_t)(image.height - job.row), max((size_t)1, (size_t)PBO_SIZE / rowBytes));
+
+		bool staged;
+		const unsigned char *src = stage(image.pixels.get() + job.row * rowBytes, rows * rowBytes, staged);
+
+		// stb rows are tightly packed, which breaks the default 4 byte alignment for RGB images
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(job.target, job.texture);
+		GLenum face = job.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + job.face : job.target;
+		glTexSubImage2D(face, 0, 0, job.row, image.width, rows, ImageFormat(image.components), GL_UNSIGNED_BYTE, src);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		unstage(staged);
+
+		sent += rows * rowBytes;
+		job.row += rows;
+		if (job.row == image.height)
+		{
+			job.row = 0;
+			job.face++;
+		}
+		return true;
+	}
+
+	// same as uploadChunk for the active level of a compressed image, in whole rows of 4x4 blocks
+	void uploadBlocks(Job &job, size_t &sent)
+	{
+		const ImageData &image = job.images[job.face];
+		const KtxLevel &level = image.levels[job.level];
+		int blockRows = (int)(level.height + 3) / 4;
+		size_t rowBytes = level.size / blockRows;
+		int rows = (int)min((size_t)(blockRows - job.row), max((size_t)1, (size_t)PBO_SIZE / rowBytes));
+
+		bool staged;
+		const unsigned char *src = stage(image.blocks->data() + level.offset + job.row * rowBytes, rows * rowBytes, staged);
+		glBindTexture(job.target, job.texture);
+		int y = job.row * 4;
+		glCompressedTexSubImage2D(job.target, job.level, 0, y, level.width, min((int)level.height - y, rows * 4),
+			image.compressedFormat, (GLsizei)(rows * rowBytes), src);
+		unstage(staged);
+
+		sent += rows * rowBytes;
+		job.row += rows;
+		if (job.row == blockRows)
+		{
+			// the level is complete, sample from it from now on
+			glTexParameteri(job.target, GL_TEXTURE_BASE_LEVEL, job.level);
+			job.row = 0;
+			if (--job.level < 0)
+				job.face++;
+		}
+	}
+
+	// level 0 is complete: switch the texture over to it and build the rest of the chain
+	void finish(Job &job)
+	{
+		if (job.images.empty())
+			return;
+		glBindTexture(job.target, job.texture);
+		glTexParameteri(job.target, GL_TEXTURE_BASE_LEVEL, 0);
+		if (job.images[0].compressedFormat)
+		{
+			// the cooked chain is already complete
+		}
+		else if (job.target == GL_TEXTURE_CUBE_MAP)
+		{
+			glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, 0);
+		}
+		else
+		{
+			glTexParameteri(job.target, GL_TEXTURE_MAX_LEVEL, 1000);
+			glGenerateMipmap(job.target);
+		}
+		job.images.clear();
+	}
+};
+
+// the process wide streamer; its update() is driven by the render loop
+inline TextureStreamer& TextureStream()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
+#endif
@@ -0,0 +1,117 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from a shared queue. A job that splits its work
+// into more jobs has to wait for them through wait(), never on the futures directly: with
+// every worker blocked like that nobody would be left to run the queued parts.
+class ThreadPool
+{
+public:
+	// threadCount 0 means one worker per hardware thread
+	explicit ThreadPool(unsigned int threadCount = 0) : stopping(false)
+	{
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0)
+			threadCount = 1;
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	// finishes the jobs that are already queued, then joins the workers
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	unsigned int size() const { return (unsigned int)workers.size(); }
+
+	// queues job and returns a future for its result; exceptions are forwarded through the future
+	template <typename F>
+	std::future<typename std::result_of<F()>::type> submit(F job)
+	{
+		typedef typename std::result_of<F()>::type Result;
+		std::shared_ptr<std::packaged_task<Result()> > task = std::make_shared<std::packaged_task<Result()> >(std::move(job));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back([task]() { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+	// blocks until result is ready, running queued jobs on the calling thread in the meantime
+	template <typename T>
+	void wait(const std::future<T> &result)
+	{
+		while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			std::function<void()> job;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!jobs.empty())
+				{
+					job = std::move(jobs.front());
+					jobs.pop_front();
+				}
+			}
+			if (job)
+				job();
+			else
+				result.wait_for(std::chrono::milliseconds(1)); // the job is running elsewhere
+		}
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+// the process wide pool used for asset loading and other background work
+inline ThreadPool& WorkerPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+#endif
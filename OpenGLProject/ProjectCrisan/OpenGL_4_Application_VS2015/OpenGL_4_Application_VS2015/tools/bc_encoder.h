@@ -0,0 +1,376 @@
+#ifndef BC_ENCODER_H
+#define BC_ENCODER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Block compressors for the texture cook. Every encoder takes one 4x4 block of RGBA8 texels
+// in row major order. Endpoints come from the principal axis of the block and are refined
+// once by least squares; that is far from the best an offline encoder can do, but it is
+// simple and already well above what the eye notices on our diffuse and specular maps.
+
+typedef unsigned char BlockTexels[16][4];
+
+namespace bc_detail
+{
+	// principal axis of the first channels of the block through power iteration
+	inline void PrincipalAxis(const BlockTexels texels, int channels, float mean[4], float axis[4])
+	{
+		for (int c = 0; c < 4; c++)
+			mean[c] = axis[c] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < channels; c++)
+				mean[c] += texels[i][c] / 16.0f;
+
+		float cov[4][4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int a = 0; a < channels; a++)
+				for (int b = 0; b < channels; b++)
+					cov[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+
+		// start from the diagonal of the largest variance, which is never orthogonal to the answer
+		int largest = 0;
+		for (int c = 1; c < channels; c++)
+			if (cov[c][c] > cov[largest][largest])
+				largest = c;
+		for (int c = 0; c < channels; c++)
+			axis[c] = cov[largest][c];
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++)
+					next[a] += cov[a][b] * axis[b];
+				length = std::max(length, std::fabs(next[a]));
+			}
+			if (length == 0.0f)
+				break;
+			for (int c = 0; c < channels; c++)
+				axis[c] = next[c] / length;
+		}
+	}
+
+	// endpoints at the extreme projections of the block onto its principal axis
+	inline void AxisEndpoints(const BlockTexels texels, int channels, float lo[4], float hi[4])
+	{
+		float mean[4], axis[4];
+		PrincipalAxis(texels, channels, mean, axis);
+		float minT = 0.0f, maxT = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; c++)
+				t += (texels[i][c] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		float lengthSq = 0.0f;
+		for (int c = 0; c < channels; c++)
+			lengthSq += axis[c] * axis[c];
+		if (lengthSq > 0.0f)
+		{
+			minT /= lengthSq;
+			maxT /= lengthSq;
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			lo[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + minT * axis[c])) : 255.0f;
+			hi[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + maxT * axis[c])) : 255.0f;
+		}
+	}
+
+	// least squares endpoints for fixed indices, given as weights of hi in [0, 1]
+	inline bool RefineEndpoints(const BlockTexels texels, int channels, const float weights[16], float lo[4], float hi[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float b = weights[i], a = 1.0f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; c++)
+			{
+				ax[c] += a * texels[i][c];
+				bx[c] += b * texels[i][c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+		for (int c = 0; c < channels; c++)
+		{
+			lo[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / det));
+			hi[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / det));
+		}
+		return true;
+	}
+
+	inline uint16_t Pack565(const float color[4])
+	{
+		int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+		int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+		int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	inline void Unpack565(uint16_t packed, int color[3])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// picks the 4 colour mode indices for the two endpoints and returns the squared error
+	inline int BC1Indices(const BlockTexels texels, uint16_t c0, uint16_t c1, uint32_t &indices)
+	{
+		int palette[4][3];
+		Unpack565(c0, palette[0]);
+		Unpack565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		indices = 0;
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 1 << 30;
+			for (int p = 0; p < 4; p++)
+			{
+				int e = 0;
+				for (int c = 0; c < 3; c++)
+					e += (texels[i][c] - palette[p][c]) * (texels[i][c] - palette[p][c]);
+				if (e < bestError)
+				{
+					best = p;
+					bestError = e;
+				}
+			}
+			indices |= (uint32_t)best << (2 * i);
+			error += bestError;
+		}
+		return error;
+	}
+
+	// writes 128 bit blocks from least significant bit up
+	struct BitWriter
+	{
+		unsigned char *out;
+		int position;
+
+		explicit BitWriter(unsigned char *out) : out(out), position(0) { memset(out, 0, 16); }
+
+		void write(uint32_t value, int bits)
+		{
+			for (int i = 0; i < bits; i++, position++)
+				if (value & (1u << i))
+					out[position / 8] |= (unsigned char)(1u << (position % 8));
+		}
+	};
+}
+
+// BC1 / DXT1: RGB in 8 bytes, always in 4 colour mode
+inline void EncodeBC1(const BlockTexels texels, unsigned char out[8])
+{
+	using namespace bc_detail;
+	float lo[4], hi[4];
+	AxisEndpoints(texels, 3, lo, hi);
+	uint16_t c0 = Pack565(hi), c1 = Pack565(lo);
+	uint32_t indices;
+	int error = BC1Indices(texels, c0, c1, indices);
+
+	// one least squares pass on the chosen indices
+	static const float weight[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = 1.0f - weight[(indices >> (2 * i)) & 3];
+	if (RefineEndpoints(texels, 3, weights, lo, hi))
+	{
+		uint16_t r0 = Pack565(hi), r1 = Pack565(lo);
+		uint32_t refined;
+		int refinedError = BC1Indices(texels, r0, r1, refined);
+		if (refinedError < error)
+		{
+			c0 = r0;
+			c1 = r1;
+			indices = refined;
+		}
+	}
+
+	// c0 > c1 selects the 4 colour mode; swapping the endpoints mirrors the indices
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		indices ^= 0x55555555u;
+	}
+	else if (c0 == c1)
+	{
+		indices = 0;
+	}
+	memcpy(out, &c0, 2);
+	memcpy(out + 2, &c1, 2);
+	memcpy(out + 4, &indices, 4);
+}
+
+// BC4 / RGTC1: one channel in 8 bytes, always in 8 value mode
+inline void EncodeBC4(const BlockTexels texels, int channel, unsigned char out[8])
+{
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		lo = std::min(lo, (int)texels[i][channel]);
+		hi = std::max(hi, (int)texels[i][channel]);
+	}
+	memset(out, 0, 8);
+	out[0] = (unsigned char)hi;
+	out[1] = (unsigned char)lo;
+	if (hi == lo)
+		return;
+
+	// palette index order is hi, lo, then the 6 interpolated values from hi towards lo
+	int palette[8] = { hi, lo };
+	for (int p = 1; p < 7; p++)
+		palette[p + 1] = ((7 - p) * hi + p * lo) / 7;
+	uint64_t indices = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0;
+		for (int p = 1; p < 8; p++)
+			if (std::abs(texels[i][channel] - palette[p]) < std::abs(texels[i][channel] - palette[best]))
+				best = p;
+		indices |= (uint64_t)best << (3 * i);
+	}
+	for (int b = 0; b < 6; b++)
+		out[2 + b] = (unsigned char)(indices >> (8 * b));
+}
+
+// BC3 / DXT5: BC4 alpha followed by a BC1 colour block
+inline void EncodeBC3(const BlockTexels texels, unsigned char out[16])
+{
+	EncodeBC4(texels, 3, out);
+	EncodeBC1(texels, out + 8);
+}
+
+// BC5 / RGTC2: two independent BC4 channels, red then green
+inline void EncodeBC5(const BlockTexels texels, unsigned char out[16])
+{
+	EncodeBC4(texels, 0, out);
+	EncodeBC4(texels, 1, out + 8);
+}
+
+// BC7 restricted to mode 6: a single RGBA line with 7 bit endpoints plus a p-bit each and 16 weights
+inline void EncodeBC7(const BlockTexels texels, unsigned char out[16])
+{
+	using namespace bc_detail;
+	static const int weights16[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// quantizes an endpoint to 7 bits per channel, picking the p-bit that fits it best
+	auto quantize = [](const float value[4], int q[4], int &pbit)
+	{
+		int bestError = 1 << 30;
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4], error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = std::min(127, std::max(0, (int)((value[c] - p) / 2.0f + 0.5f)));
+				int expanded = (candidate[c] << 1) | p;
+				error += (int)((expanded - value[c]) * (expanded - value[c]));
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pbit = p;
+				memcpy(q, candidate, sizeof(candidate));
+			}
+		}
+	};
+	auto encode = [&texels](const int q0[4], int p0, const int q1[4], int p1, int indices[16]) -> int
+	{
+		int e0[4], e1[4], palette[16][4];
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = (q0[c] << 1) | p0;
+			e1[c] = (q1[c] << 1) | p1;
+		}
+		for (int w = 0; w < 16; w++)
+			for (int c = 0; c < 4; c++)
+				palette[w][c] = ((64 - weights16[w]) * e0[c] + weights16[w] * e1[c] + 32) >> 6;
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int best = 0, bestError = 1 << 30;
+			for (int w = 0; w < 16; w++)
+			{
+				int e = 0;
+				for (int c = 0; c < 4; c++)
+					e += (texels[i][c] - palette[w][c]) * (texels[i][c] - palette[w][c]);
+				if (e < bestError)
+				{
+					best = w;
+					bestError = e;
+				}
+			}
+			indices[i] = best;
+			error += bestError;
+		}
+		return error;
+	};
+
+	float lo[4], hi[4];
+	AxisEndpoints(texels, 4, lo, hi);
+	int q0[4], q1[4], p0 = 0, p1 = 0, indices[16];
+	quantize(lo, q0, p0);
+	quantize(hi, q1, p1);
+	int error = encode(q0, p0, q1, p1, indices);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = weights16[indices[i]] / 64.0f;
+	if (RefineEndpoints(texels, 4, weights, lo, hi))
+	{
+		int r0[4], r1[4], rp0 = 0, rp1 = 0, refined[16];
+		quantize(lo, r0, rp0);
+		quantize(hi, r1, rp1);
+		if (encode(r0, rp0, r1, rp1, refined) < error)
+		{
+			memcpy(q0, r0, sizeof(q0));
+			memcpy(q1, r1, sizeof(q1));
+			p0 = rp0;
+			p1 = rp1;
+			memcpy(indices, refined, sizeof(indices));
+		}
+	}
+
+	// the first index is stored without its top bit, so it has to be below 8
+	if (indices[0] >= 8)
+	{
+		for (int c = 0; c < 4; c++)
+			std::swap(q0[c], q1[c]);
+		std::swap(p0, p1);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	BitWriter bits(out);
+	bits.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		bits.write(q0[c], 7);
+		bits.write(q1[c], 7);
+	}
+	bits.write(p0, 1);
+	bits.write(p1, 1);
+	bits.write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.write(indices[i], 4);
+}
+#endif
@@ -0,0 +1,473 @@
+// hlod_build: bakes the hierarchical level of detail proxies of a scene (see hlod.h). The
+// static model nodes are sorted into the cells of a square grid on the ground plane by the
+// center of their bounds, and every cell becomes one mesh in world space:
+//
+//   - each mesh of each node is simplified on its own (see mesh_simplify.h), as far as an
+//     error of about a pixel at the switch distance allows, and all of them are merged
+//   - the diffuse textures of the cell are scaled into the tiles of one atlas, and the texture
+//     coordinates are moved into the tiles. Triangles whose coordinates repeat the texture
+//     cannot be moved into a tile and take the texture's mean colour instead.
+//
+//   hlod_build [--cell <size>] [--distance <units>] [--tile <pixels>] <scene>
+//
+// Writes <scene>.hlod and one BC1 atlas per cell, <scene>.hlod<cell>.ktx. Run it from the
+// program's directory, the model paths of the scene are relative to it. Nodes that are
+// dynamic, drawn in wireframe or with another shader than the model shader keep being drawn
+// as they are.
+
+#include "../glad/glad.h"
+#include "../hlod.h"
+#include "../mapped_file.h"
+#include "../mesh_simplify.h"
+#include "../model.h"
+#include "../scene.h"
+#include "../stb_image.h"
+#include "../thread_pool.h"
+#include "../vertex_format.h"
+#include "texture_levels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+using namespace std;
+
+// pixels a unit covers at distance 1 in the program's window: 1080 lines over a 45 degree field of view
+const float HLOD_PROJECTION_SCALE = 1303.6f;
+// how far the proxy may stray from the nodes at the switch distance, in pixels
+const float HLOD_PIXEL_ERROR = 1.0f;
+
+struct BuildOptions
+{
+	float cellSize;
+	float switchDistance;
+	int tileSize;
+};
+
+// one imported model with its model space bounds
+struct SourceModel
+{
+	ModelData data;
+	bool valid;
+	glm::vec3 boundsMin, boundsMax;
+};
+
+struct CellResult
+{
+	HlodProxy proxy;
+	string message;
+	size_t trianglesBefore;
+	bool failed;
+};
+
+// where in the atlas a texture went
+struct AtlasTile
+{
+	int slotX, slotY;	// top left texel of the tile
+};
+
+// The atlas of a cell: a grid of square tiles, one per diffuse texture. The texture fills the
+// upper part of its tile with a gutter of repeated edge texels around it, so filtering and
+// the smaller mip levels do not bleed between tiles; a strip of its mean colour fills the rest.
+class Atlas
+{
+public:
+	Atlas(int tileSize, size_t tileCount) : tileSize(tileSize)
+	{
+		gutter = max(1, tileSize / 32);
+		strip = max(4, tileSize / 8);
+		columns = max(1, (int)ceil(sqrt((double)tileCount)));
+		rows = max(1, (int)((tileCount + columns - 1) / columns));
+		width = columns * tileSize;
+		height = rows * tileSize;
+		pixels.assign((size_t)width * height * 4, 0);
+		for (size_t i = 3; i < pixels.size(); i += 4)
+			pixels[i] = 255;
+	}
+
+	int width, height;
+	vector<unsigned char> pixels;
+
+	// scales the image at path into tile; a missing image leaves the tile black, as the
+	// program draws a mesh without a diffuse map
+	bool bake(int tile, const string &path)
+	{
+		AtlasTile slot = tileSlot(tile);
+		if (path.empty())
+			return true;
+		int imageWidth, imageHeight, components;
+		unsigned char *loaded = stbi_load(path.c_str(), &imageWidth, &imageHeight, &components, 4);
+		if (!loaded)
+			return false;
+		vector<unsigned char> image(loaded, loaded + (size_t)imageWidth * imageHeight * 4);
+		stbi_image_free(loaded);
+
+		// halve the image until bilinear sampling no longer skips texels
+		int innerWidth = tileSize - 2 * gutter, innerHeight = tileSize - strip - 2 * gutter;
+		while (imageWidth >= 2 * innerWidth && imageHeight >= 2 * innerHeight)
+		{
+			image = Downsample(image, imageWidth, imageHeight, false);
+			imageWidth = max(1, imageWidth / 2);
+			imageHeight = max(1, imageHeight / 2);
+		}
+		for (int y = 0; y < tileSize - strip; y++)
+		{
+			for (int x = 0; x < tileSize; x++)
+			{
+				float u = glm::clamp((x + 0.5f - gutter) / innerWidth, 0.0f, 1.0f);
+				float v = glm::clamp((y + 0.5f - gutter) / innerHeight, 0.0f, 1.0f);
+				Sample(image, imageWidth, imageHeight, u, v, &pixels[((size_t)(slot.slotY + y) * width + slot.slotX + x) * 4]);
+			}
+		}
+
+		vector<unsigned char> mean = image;
+		while (imageWidth > 1 || imageHeight > 1)
+		{
+			mean = Downsample(mean, imageWidth, imageHeight, false);
+			imageWidth = max(1, imageWidth / 2);
+			imageHeight = max(1, imageHeight / 2);
+		}
+		for (int y = tileSize - strip; y < tileSize; y++)
+			for (int x = 0; x < tileSize; x++)
+				memcpy(&pixels[((size_t)(slot.slotY + y) * width + slot.slotX + x) * 4], mean.data(), 4);
+		return true;
+	}
+
+	// the atlas coordinates of texture coordinates uv, in [0, 1], of the texture in tile
+	glm::vec2 map(int tile, const glm::vec2 &uv) const
+	{
+		AtlasTile slot = tileSlot(tile);
+		float x = slot.slotX + gutter + uv.x * (tileSize - 2 * gutter);
+		float y = slot.slotY + gutter + uv.y * (tileSize - strip - 2 * gutter);
+		return glm::vec2(x / width, y / height);
+	}
+
+	// the atlas coordinates of the mean colour of tile
+	glm::vec2 mean(int tile) const
+	{
+		AtlasTile slot = tileSlot(tile);
+		return glm::vec2((slot.slotX + tileSize * 0.5f) / width, (slot.slotY + tileSize - strip * 0.5f) / height);
+	}
+
+	// BC1 with the full mip chain
+	bool write(const string &path, const string &stamp) const
+	{
+		vector<vector<unsigned char> > levels;
+		vector<unsigned char> level = pixels;
+		int w = width, h = height;
+		for (;;)
+		{
+			levels.push_back(CompressLevel(level, w, h, GL_COMPRESSED_RGB_S3TC_DXT1_EXT));
+			if (w == 1 && h == 1)
+				break;
+			level = Downsample(level, w, h, false);
+			w = max(1, w / 2);
+			h = max(1, h / 2);
+		}
+		return WriteKtx(path, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, width, height, levels, stamp);
+	}
+
+private:
+	int tileSize, gutter, strip;
+	int columns, rows;
+
+	AtlasTile tileSlot(int tile) const
+	{
+		AtlasTile slot;
+		slot.slotX = tile % columns * tileSize;
+		slot.slotY = tile / columns * tileSize;
+		return slot;
+	}
+
+	// bilinear, clamped to the edges
+	static void Sample(const vector<unsigned char> &image, int width, int height, float u, float v, unsigned char *out)
+	{
+		float x = u * width - 0.5f, y = v * height - 0.5f;
+		int x0 = (int)floor(x), y0 = (int)floor(y);
+		float fx = x - x0, fy = y - y0;
+		int xs[2] = { glm::clamp(x0, 0, width - 1), glm::clamp(x0 + 1, 0, width - 1) };
+		int ys[2] = { glm::clamp(y0, 0, height - 1), glm::clamp(y0 + 1, 0, height - 1) };
+		for (int c = 0; c < 3; c++)
+		{
+			float top = image[((size_t)ys[0] * width + xs[0]) * 4 + c] * (1.0f - fx) + image[((size_t)ys[0] * width + xs[1]) * 4 + c] * fx;
+			float bottom = image[((size_t)ys[1] * width + xs[0]) * 4 + c] * (1.0f - fx) + image[((size_t)ys[1] * width + xs[1]) * 4 + c] * fx;
+			out[c] = (unsigned char)min(255.0f, top * (1.0f - fy) + bottom * fy + 0.5f);
+		}
+		out[3] = 255;
+	}
+};
+
+// the nodes a proxy may stand in for
+static bool Proxyable(const Scene &scene, unsigned int node)
+{
+	return scene.models[node] >= 0 && !(scene.flags[node] & (SCENE_NODE_DYNAMIC | SCENE_NODE_WIREFRAME)) &&
+		scene.shaderNames[scene.shaders[node]] == "model";
+}
+
+// the path of the first diffuse map of mesh i of a model, empty for none
+static string DiffusePath(const ModelData &data, unsigned int i)
+{
+	vector<Texture> textures = data.textures(i);
+	for (size_t t = 0; t < textures.size(); t++)
+		if (textures[t].type == MaterialTextureTypeName(MATERIAL_TEXTURE_DIFFUSE))
+			return data.directory + '/' + textures[t].path;
+	return string();
+}
+
+static CellResult BuildCell(const Scene &scene, const vector<SourceModel> &models, const vector<int> &nodes, unsigned int cell,
+	const string &scenePath, const string &stamp, const BuildOptions &options)
+{
+	CellResult result;
+	result.trianglesBefore = 0;
+	result.failed = false;
+	HlodProxy &proxy = result.proxy;
+	proxy.switchDistance = options.switchDistance;
+	proxy.atlas = HlodAtlasPath(scenePath, cell);
+	float maxError = options.switchDistance * HLOD_PIXEL_ERROR / HLOD_PROJECTION_SCALE;
+
+	// every mesh in world space, simplified on its own so no triangle ends up with the
+	// texture coordinates of another mesh
+	struct Piece {
+		vector<Vertex> vertices;
+		vector<unsigned int> indices;
+		int tile;
+	};
+	vector<Piece> pieces;
+	map<string, int> tiles;
+	vector<string> tilePaths;
+	for (size_t n = 0; n < nodes.size(); n++)
+	{
+		const SourceModel &model = models[scene.models[nodes[n]]];
+		if (!model.valid)
+			continue;
+		proxy.nodes.push_back(scene.names[nodes[n]]);
+		const glm::mat4 &world = scene.worlds[nodes[n]];
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(world)));
+		for (unsigned int i = 0; i < model.data.meshCount(); i++)
+		{
+			Piece piece;
+			const Vertex *vertices = model.data.vertices(i);
+			const unsigned int *indices = model.data.indices(i);
+			size_t vertexCount = model.data.vertexCount(i), indexCount = model.data.indexCount(i);
+			piece.vertices.assign(vertices, vertices + vertexCount);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				Vertex &vertex = piece.vertices[v];
+				vertex.Position = glm::vec3(world * glm::vec4(vertex.Position, 1.0f));
+				vertex.Normal = NormalizeOrZero(normalMatrix * vertex.Normal);
+				vertex.Tangent = NormalizeOrZero(glm::mat3(world) * vertex.Tangent);
+				vertex.Bitangent = NormalizeOrZero(glm::mat3(world) * vertex.Bitangent);
+			}
+			MeshSimplifier simplifier(piece.vertices, vector<unsigned int>(indices, indices + indexCount));
+			simplifier.simplify(0, maxError);
+			simplifier.indices(piece.indices);
+			result.trianglesBefore += indexCount / 3;
+
+			string path = DiffusePath(model.data, i);
+			map<string, int>::iterator found = tiles.find(path);
+			if (found == tiles.end())
+			{
+				found = tiles.insert(make_pair(path, (int)tilePaths.size())).first;
+				tilePaths.push_back(path);
+			}
+			piece.tile = found->second;
+			pieces.push_back(std::move(piece));
+		}
+	}
+
+	Atlas atlas(options.tileSize, tilePaths.size());
+	for (size_t t = 0; t < tilePaths.size(); t++)
+		if (!atlas.bake((int)t, tilePaths[t]))
+			cout << "WARNING::HLOD:: cannot read " << tilePaths[t] << ", its tile stays black" << endl;
+
+	// merge the pieces, moving their texture coordinates into the atlas. A triangle whose
+	// coordinates fit one repetition of the texture is shifted into [0, 1] and mapped into the
+	// tile; the corners shared by triangles shifted the same way stay shared.
+	const float repeatSlack = 1e-3f;
+	for (size_t p = 0; p < pieces.size(); p++)
+	{
+		const Piece &piece = pieces[p];
+		map<tuple<unsigned int, int, int>, unsigned int> emitted;
+		for (size_t t = 0; t + 2 < piece.indices.size(); t += 3)
+		{
+			const unsigned int *corners = &piece.indices[t];
+			glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+			for (int k = 0; k < 3; k++)
+			{
+				low = glm::min(low, piece.vertices[corners[k]].TexCoords);
+				high = glm::max(high, piece.vertices[corners[k]].TexCoords);
+			}
+			glm::vec2 shift = glm::floor(low + repeatSlack);
+			bool fits = high.x - shift.x <= 1.0f + repeatSlack && high.y - shift.y <= 1.0f + repeatSlack;
+			// the mean colour is keyed by a shift no texture coordinate can produce
+			int keyX = fits ? (int)shift.x : INT_MIN, keyY = fits ? (int)shift.y : INT_MIN;
+			for (int k = 0; k < 3; k++)
+			{
+				tuple<unsigned int, int, int> key(corners[k], keyX, keyY);
+				map<tuple<unsigned int, int, int>, unsigned int>::iterator found = emitted.find(key);
+				if (found == emitted.end())
+				{
+					Vertex vertex = piece.vertices[corners[k]];
+					if (fits)
+						vertex.TexCoords = atlas.map(piece.tile, glm::clamp(vertex.TexCoords - shift, 0.0f, 1.0f));
+					else
+						vertex.TexCoords = atlas.mean(piece.tile);
+					found = emitted.insert(make_pair(key, (unsigned int)proxy.vertices.size())).first;
+					proxy.vertices.push_back(vertex);
+				}
+				proxy.indices.push_back(found->second);
+			}
+		}
+	}
+	if (proxy.vertices.empty())
+	{
+		result.failed = true;
+		result.message = "no geometry";
+		return result;
+	}
+	OptimizeVertexCache(proxy.indices, proxy.vertices.size());
+	proxy.boundsMin = proxy.boundsMax = proxy.vertices[0].Position;
+	for (size_t v = 1; v < proxy.vertices.size(); v++)
+	{
+		proxy.boundsMin = glm::min(proxy.boundsMin, proxy.vertices[v].Position);
+		proxy.boundsMax = glm::max(proxy.boundsMax, proxy.vertices[v].Position);
+	}
+
+	if (!atlas.write(proxy.atlas, stamp))
+	{
+		result.failed = true;
+		result.message = "cannot write " + proxy.atlas;
+		return result;
+	}
+	char message[256];
+	snprintf(message, sizeof(message), "%u nodes, %u meshes, %u triangles -> %u, %u vertices, atlas %dx%d with %u tiles",
+		(unsigned int)proxy.nodes.size(), (unsigned int)pieces.size(), (unsigned int)result.trianglesBefore, (unsigned int)(proxy.indices.size() / 3),
+		(unsigned int)proxy.vertices.size(), atlas.width, atlas.height, (unsigned int)tilePaths.size());
+	result.message = message;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	BuildOptions options = { 16.0f, 30.0f, 128 };
+	string scenePath;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--cell" && i + 1 < argc)
+			options.cellSize = (float)atof(argv[++i]);
+		else if (arg == "--distance" && i + 1 < argc)
+			options.switchDistance = (float)atof(argv[++i]);
+		else if (arg == "--tile" && i + 1 < argc)
+			options.tileSize = atoi(argv[++i]);
+		else
+			scenePath = arg;
+	}
+	// tiles a power of two, so every mip level still ends on a tile boundary
+	bool powerOfTwo = options.tileSize >= 32 && (options.tileSize & (options.tileSize - 1)) == 0;
+	if (scenePath.empty() || options.cellSize <= 0.0f || options.switchDistance <= 0.0f || !powerOfTwo)
+	{
+		cout << "usage: hlod_build [--cell <size>] [--distance <units>] [--tile <pixels, a power of two from 32>] <scene>" << endl;
+		return 1;
+	}
+
+	Scene scene;
+	FileStamp sceneStamp;
+	if (!GetFileStamp(scenePath, sceneStamp) || !scene.Load(scenePath))
+		return 1;
+
+	// the cells by grid coordinates, and the models they need
+	map<pair<int, int>, vector<int> > cells;
+	vector<uint8_t> needed(scene.modelPaths.size(), 0);
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+		if (Proxyable(scene, i))
+			needed[scene.models[i]] = 1;
+	vector<future<ModelData> > imports(scene.modelPaths.size());
+	for (unsigned int m = 0; m < scene.modelPaths.size(); m++)
+		if (needed[m])
+			imports[m] = Model::LoadAsync(scene.modelPaths[m]);
+	vector<SourceModel> models(scene.modelPaths.size());
+	vector<pair<string, FileStamp> > sources;
+	for (unsigned int m = 0; m < scene.modelPaths.size(); m++)
+	{
+		SourceModel &model = models[m];
+		model.valid = false;
+		if (!needed[m])
+			continue;
+		model.data = imports[m].get();
+		FileStamp stamp;
+		if (!model.data.meshCount() || !GetFileStamp(scene.modelPaths[m], stamp))
+		{
+			cout << "WARNING::HLOD:: cannot import " << scene.modelPaths[m] << ", its nodes are left out" << endl;
+			continue;
+		}
+		model.valid = true;
+		sources.push_back(make_pair(scene.modelPaths[m], stamp));
+		model.boundsMin = glm::vec3(FLT_MAX);
+		model.boundsMax = glm::vec3(-FLT_MAX);
+		for (unsigned int i = 0; i < model.data.meshCount(); i++)
+		{
+			const Vertex *vertices = model.data.vertices(i);
+			for (size_t v = 0; v < model.data.vertexCount(i); v++)
+			{
+				model.boundsMin = glm::min(model.boundsMin, vertices[v].Position);
+				model.boundsMax = glm::max(model.boundsMax, vertices[v].Position);
+			}
+		}
+	}
+	for (unsigned int i = 0; i < scene.nodeCount(); i++)
+	{
+		if (!Proxyable(scene, i) || !models[scene.models[i]].valid)
+			continue;
+		const SourceModel &model = models[scene.models[i]];
+		Bounds bounds = TransformBounds(scene.worlds[i], model.boundsMin, model.boundsMax, glm::length(model.boundsMax - model.boundsMin) * 0.5f);
+		pair<int, int> key((int)floor(bounds.center.x / options.cellSize), (int)floor(bounds.center.z / options.cellSize));
+		cells[key].push_back(i);
+	}
+
+	string stamp = FormatStamp(sceneStamp);
+	vector<future<CellResult> > builds;
+	vector<pair<int, int> > keys;
+	for (map<pair<int, int>, vector<int> >::iterator it = cells.begin(); it != cells.end(); ++it)
+	{
+		unsigned int cell = (unsigned int)keys.size();
+		const vector<int> *nodes = &it->second;
+		keys.push_back(it->first);
+		builds.push_back(WorkerPool().submit([&scene, &models, nodes, cell, &scenePath, &stamp, &options]()
+		{
+			return BuildCell(scene, models, *nodes, cell, scenePath, stamp, options);
+		}));
+	}
+
+	vector<HlodProxy> proxies;
+	size_t nodesBefore = 0;
+	int failures = 0;
+	for (size_t i = 0; i < builds.size(); i++)
+	{
+		CellResult result = builds[i].get();
+		cout << "cell (" << keys[i].first << ", " << keys[i].second << "): " << result.message << endl;
+		if (result.failed)
+		{
+			failures++;
+			continue;
+		}
+		nodesBefore += result.proxy.nodes.size();
+		proxies.push_back(std::move(result.proxy));
+	}
+	// the atlases are named by build order, a failed cell leaves a gap the file does not refer to
+	if (!WriteHlod(HlodPath(scenePath), sceneStamp, sources, proxies))
+	{
+		cout << "ERROR::HLOD:: cannot write " << HlodPath(scenePath) << endl;
+		return 1;
+	}
+	cout << HlodPath(scenePath) << ": " << proxies.size() << " proxies for " << nodesBefore << " nodes" << endl;
+	return failures ? 1 : 0;
+}
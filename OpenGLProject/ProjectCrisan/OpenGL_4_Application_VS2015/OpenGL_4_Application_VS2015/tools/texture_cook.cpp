@@ -0,0 +1,260 @@
+// texture_cook: converts the project's images into block compressed KTX files with their
+// full mip chain. Every <image> becomes <image>.ktx next to it, which the texture manager
+// picks up instead of decoding and uploading the raw pixels.
+//
+//   texture_cook [--bc7] [--force] <file or directory>...
+//
+// Directories are searched recursively for .png, .jpg, .jpeg, .tga and .bmp files. Colour maps
+// become BC1, or BC3 when they have a real alpha channel; normal maps (*_ddn, *_nrm, *_normal)
+// and two channel images become BC5 and single channel images BC4. --bc7 uses BC7 for all
+// colour maps instead, which looks better at twice the size of BC1. Images whose cooked file
+// is up to date are skipped unless --force is given.
+
+#include "../ktx_texture.h"
+#include "../mapped_file.h"
+#include "../stb_image.h"
+#include "../thread_pool.h"
+#include "bc_encoder.h"
+#include "texture_levels.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct CookOptions
+{
+	bool bc7;
+	bool force;
+};
+
+struct CookResult
+{
+	string path;
+	string message;
+	size_t sourceBytes;	// uncompressed size of the full chain
+	size_t cookedBytes;
+	bool failed;
+};
+
+static string Lower(string text)
+{
+	transform(text.begin(), text.end(), text.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	return text;
+}
+
+static bool IsImage(const string &path)
+{
+	string lower = Lower(path);
+	const char *extensions[] = { ".png", ".jpg", ".jpeg", ".tga", ".bmp" };
+	for (unsigned int i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+	{
+		size_t length = strlen(extensions[i]);
+		if (lower.size() > length && lower.compare(lower.size() - length, length, extensions[i]) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool IsNormalMap(const string &path)
+{
+	string name = Lower(path.substr(path.find_last_of("/\\") + 1));
+	return name.find("_ddn") != string::npos || name.find("_nrm") != string::npos || name.find("_normal") != string::npos;
+}
+
+// adds the images below path (or path itself) to files
+static void CollectImages(const string &path, vector<string> &files)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((path + "/*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		if (IsImage(path))
+			files.push_back(path);
+		return;
+	}
+	do
+	{
+		string name = entry.cFileName;
+		if (name == "." || name == "..")
+			continue;
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			CollectImages(path + "/" + name, files);
+		else if (IsImage(name))
+			files.push_back(path + "/" + name);
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR *dir = opendir(path.c_str());
+	if (!dir)
+	{
+		if (IsImage(path))
+			files.push_back(path);
+		return;
+	}
+	while (dirent *entry = readdir(dir))
+	{
+		string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		string child = path + "/" + name;
+		DIR *sub = opendir(child.c_str());
+		if (sub)
+		{
+			closedir(sub);
+			CollectImages(child, files);
+		}
+		else if (IsImage(name))
+			files.push_back(child);
+	}
+	closedir(dir);
+#endif
+}
+
+static const char* FormatName(GLenum format)
+{
+	switch (format)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+	case GL_COMPRESSED_RED_RGTC1: return "BC4";
+	case GL_COMPRESSED_RG_RGTC2: return "BC5";
+	}
+	return "BC7";
+}
+
+static CookResult Cook(const string &path, const CookOptions &options)
+{
+	CookResult result;
+	result.path = path;
+	result.sourceBytes = result.cookedBytes = 0;
+	result.failed = false;
+
+	FileStamp stamp;
+	if (!GetFileStamp(path, stamp))
+	{
+		result.failed = true;
+		result.message = "cannot stat";
+		return result;
+	}
+	if (!options.force)
+	{
+		MappedFile existing;
+		KtxHeader header;
+		vector<KtxLevel> levels;
+		string cookedFrom;
+		if (existing.open(KtxPath(path)) && ParseKtx(existing.data(), existing.size(), header, levels, &cookedFrom) && cookedFrom == FormatStamp(stamp))
+		{
+			result.message = "up to date";
+			return result;
+		}
+	}
+
+	int width, height, components;
+	unsigned char *pixels = stbi_load(path.c_str(), &width, &height, &components, 4);
+	if (!pixels)
+	{
+		result.failed = true;
+		result.message = string("cannot decode: ") + stbi_failure_reason();
+		return result;
+	}
+	vector<unsigned char> rgba(pixels, pixels + (size_t)width * height * 4);
+	stbi_image_free(pixels);
+
+	bool opaque = true;
+	for (size_t i = 3; i < rgba.size() && opaque; i += 4)
+		opaque = rgba[i] == 255;
+	bool normalMap = IsNormalMap(path);
+	if (components == 2)
+		for (size_t i = 0; i < rgba.size(); i += 4)
+			rgba[i + 1] = rgba[i + 3]; // stb expands grey/alpha to RGBA, the runtime samples it as RG
+	GLenum format;
+	if (components == 1)
+		format = GL_COMPRESSED_RED_RGTC1;
+	else if (components == 2 || normalMap)
+		format = GL_COMPRESSED_RG_RGTC2;
+	else if (options.bc7)
+		format = GL_COMPRESSED_RGBA_BPTC_UNORM;
+	else
+		format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+	vector<vector<unsigned char> > levels;
+	int w = width, h = height;
+	for (;;)
+	{
+		levels.push_back(CompressLevel(rgba, w, h, format));
+		result.sourceBytes += (size_t)w * h * components;
+		result.cookedBytes += levels.back().size();
+		if (w == 1 && h == 1)
+			break;
+		rgba = Downsample(rgba, w, h, normalMap);
+		w = max(1, w / 2);
+		h = max(1, h / 2);
+	}
+
+	if (!WriteKtx(KtxPath(path), format, width, height, levels, FormatStamp(stamp)))
+	{
+		result.failed = true;
+		result.message = "cannot write " + KtxPath(path);
+		return result;
+	}
+	char message[128];
+	snprintf(message, sizeof(message), "%s %dx%d, %u levels, %.1f KB -> %.1f KB", FormatName(format), width, height,
+		(unsigned int)levels.size(), result.sourceBytes / 1024.0, result.cookedBytes / 1024.0);
+	result.message = message;
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	CookOptions options = { false, false };
+	vector<string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--bc7")
+			options.bc7 = true;
+		else if (arg == "--force")
+			options.force = true;
+		else
+			CollectImages(arg, files);
+	}
+	if (files.empty())
+	{
+		cout << "usage: texture_cook [--bc7] [--force] <file or directory>..." << endl;
+		return 1;
+	}
+
+	vector<future<CookResult> > cooks;
+	for (unsigned int i = 0; i < files.size(); i++)
+	{
+		string path = files[i];
+		cooks.push_back(WorkerPool().submit([path, options]() { return Cook(path, options); }));
+	}
+
+	size_t sourceBytes = 0, cookedBytes = 0;
+	int failures = 0;
+	for (unsigned int i = 0; i < cooks.size(); i++)
+	{
+		CookResult result = cooks[i].get();
+		cout << result.path << ": " << result.message << endl;
+		sourceBytes += result.sourceBytes;
+		cookedBytes += result.cookedBytes;
+		failures += result.failed ? 1 : 0;
+	}
+	if (cookedBytes)
+		cout << "texture memory " << sourceBytes / 1024 << " KB -> " << cookedBytes / 1024 << " KB" << endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+#ifndef TEXTURE_LEVELS_H
+#define TEXTURE_LEVELS_H
+
+#include "../ktx_texture.h"
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Mip chain and block compression of RGBA8 images, shared by the tools that write KTX files.
+
+// next mip level by averaging 2x2 texels; normal maps are renormalized afterwards
+inline vector<unsigned char> Downsample(const vector<unsigned char> &rgba, int width, int height, bool normalMap)
+{
+	int w = max(1, width / 2), h = max(1, height / 2);
+	vector<unsigned char> result((size_t)w * h * 4);
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+			int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+			float sum[4];
+			for (int c = 0; c < 4; c++)
+				sum[c] = (rgba[((size_t)y0 * width + x0) * 4 + c] + rgba[((size_t)y0 * width + x1) * 4 + c] +
+					rgba[((size_t)y1 * width + x0) * 4 + c] + rgba[((size_t)y1 * width + x1) * 4 + c]) / 4.0f;
+			if (normalMap)
+			{
+				float n[3], length = 0.0f;
+				for (int c = 0; c < 3; c++)
+				{
+					n[c] = sum[c] / 127.5f - 1.0f;
+					length += n[c] * n[c];
+				}
+				length = sqrt(length);
+				if (length > 0.0f)
+					for (int c = 0; c < 3; c++)
+						sum[c] = (n[c] / length + 1.0f) * 127.5f;
+			}
+			for (int c = 0; c < 4; c++)
+				result[((size_t)y * w + x) * 4 + c] = (unsigned char)min(255.0f, sum[c] + 0.5f);
+		}
+	}
+	return result;
+}
+
+// compresses one level, blocks past the edge repeat the last row/column
+inline vector<unsigned char> CompressLevel(const vector<unsigned char> &rgba, int width, int height, GLenum format)
+{
+	vector<unsigned char> blocks(CompressedSize(format, width, height));
+	unsigned int blockBytes = BlockBytes(format);
+	size_t offset = 0;
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			BlockTexels texels;
+			for (int i = 0; i < 16; i++)
+			{
+				int x = min(bx + i % 4, width - 1), y = min(by + i / 4, height - 1);
+				memcpy(texels[i], &rgba[((size_t)y * width + x) * 4], 4);
+			}
+			unsigned char *out = &blocks[offset];
+			if (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+				EncodeBC1(texels, out);
+			else if (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+				EncodeBC3(texels, out);
+			else if (format == GL_COMPRESSED_RED_RGTC1)
+				EncodeBC4(texels, 0, out);
+			else if (format == GL_COMPRESSED_RG_RGTC2)
+				EncodeBC5(texels, out);
+			else
+				EncodeBC7(texels, out);
+			offset += blockBytes;
+		}
+	}
+	return blocks;
+}
+#endif
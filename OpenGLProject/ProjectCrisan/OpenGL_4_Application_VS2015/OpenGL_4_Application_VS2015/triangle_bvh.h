@@ -0,0 +1,571 @@
+#ifndef TRIANGLE_BVH_H
+#define TRIANGLE_BVH_H
+
+#include "glm/glm.hpp"
+
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// A node of the flattened tree, 32 bytes so two share a cache line. The nodes are stored depth
+// first: the first child of an inner node is the node right after it, so only the second one
+// needs an index.
+struct TriangleBvhNode {
+	glm::vec3 boundsMin;
+	uint32_t first;		// leaf: first triangle; inner node: index of the second child
+	glm::vec3 boundsMax;
+	uint32_t count;		// triangles of a leaf, 0 for inner nodes
+};
+
+static_assert(sizeof(TriangleBvhNode) == 32, "TriangleBvhNode should be 32 bytes");
+
+struct BvhTriangle {
+	glm::vec3 v0, v1, v2;
+};
+
+// the first contact of a ray or a sweep
+struct TriangleHit {
+	float t;			// how far along the ray or motion, in units of its direction vector
+	glm::vec3 normal;	// unit length, pointing from the contact towards the ray origin or the sphere
+	uint32_t triangle;	// index in TriangleBvh::triangles()
+};
+
+// Bounding volume hierarchy over the triangles of a model, in model space. It is built once
+// with binned surface area heuristic splits; the triangles are copied into leaf order, so a
+// leaf's triangles are contiguous in memory next to each other.
+class TriangleBvh
+{
+public:
+	// collects the triangles of an indexed mesh; call build() once everything has been added
+	void addMesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount)
+	{
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount)
+				continue;
+			addTriangle(vertices[indices[i]].Position, vertices[indices[i + 1]].Position, vertices[indices[i + 2]].Position);
+		}
+	}
+
+	void addTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+	{
+		BvhTriangle triangle = { v0, v1, v2 };
+		tris.push_back(triangle);
+	}
+
+	// builds the tree over the triangles added so far
+	void build()
+	{
+		nodes.clear();
+		size_t count = tris.size();
+		if (!count)
+			return;
+		vector<uint32_t> order(count);
+		vector<glm::vec3> centroids(count), triangleMin(count), triangleMax(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			order[i] = (uint32_t)i;
+			triangleMin[i] = glm::min(tris[i].v0, glm::min(tris[i].v1, tris[i].v2));
+			triangleMax[i] = glm::max(tris[i].v0, glm::max(tris[i].v1, tris[i].v2));
+			centroids[i] = (triangleMin[i] + triangleMax[i]) * 0.5f;
+		}
+		nodes.reserve(count / 2 + 1);
+		BuildContext context = { order, centroids, triangleMin, triangleMax };
+		buildNode(context, 0, (uint32_t)count, 0);
+
+		vector<BvhTriangle> sorted(count);
+		for (size_t i = 0; i < count; i++)
+			sorted[i] = tris[order[i]];
+		tris.swap(sorted);
+	}
+
+	bool empty() const { return nodes.empty(); }
+	const vector<BvhTriangle>& triangles() const { return tris; }
+	const vector<TriangleBvhNode>& tree() const { return nodes; }
+	glm::vec3 boundsMin() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMin; }
+	glm::vec3 boundsMax() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].boundsMax; }
+
+	// the first triangle along origin + t * direction with t in [0, maxT], from either side
+	bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, TriangleHit &hit) const
+	{
+		hit.t = maxT;
+		bool found = false;
+		traverseSegment(origin, direction, 0.0f, hit.t, [&](uint32_t i) {
+			float t;
+			if (RayTriangle(origin, direction, tris[i], hit.t, t))
+			{
+				glm::vec3 normal = glm::normalize(glm::cross(tris[i].v1 - tris[i].v0, tris[i].v2 - tris[i].v0));
+				hit.t = t;
+				hit.normal = glm::dot(normal, direction) > 0.0f ? -normal : normal;
+				hit.triangle = i;
+				found = true;
+			}
+		});
+		return found;
+	}
+
+	// the first triangle on the segment from start to end; hit.t is the fraction of the way
+	bool segment(const glm::vec3 &start, const glm::vec3 &end, TriangleHit &hit) const
+	{
+		return raycast(start, end - start, 1.0f, hit);
+	}
+
+	// the first contact of a sphere moving from center to center + motion; hit.t is the fraction
+	// of the motion. Triangles the sphere already overlaps only count if it moves further into them.
+	bool sweepSphere(const glm::vec3 &center, float radius, const glm::vec3 &motion, TriangleHit &hit) const
+	{
+		hit.t = 1.0f;
+		bool found = false;
+		traverseSegment(center, motion, radius, hit.t, [&](uint32_t i) {
+			float t;
+			glm::vec3 normal;
+			if (SweepSphereTriangle(center, radius, motion, tris[i], hit.t, t, normal))
+			{
+				hit.t = t;
+				hit.normal = normal;
+				hit.triangle = i;
+				found = true;
+			}
+		});
+		return found;
+	}
+
+	// calls visit(triangle index) for the triangles whose bounds overlap the box
+	template <typename Visitor>
+	void forEachTriangle(const glm::vec3 &boxMin, const glm::vec3 &boxMax, const Visitor &visit) const
+	{
+		if (nodes.empty())
+			return;
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while (top)
+		{
+			uint32_t index = stack[--top];
+			const TriangleBvhNode &node = nodes[index];
+			if (glm::any(glm::greaterThan(node.boundsMin, boxMax)) || glm::any(glm::lessThan(node.boundsMax, boxMin)))
+				continue;
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					glm::vec3 triangleMin = glm::min(tris[i].v0, glm::min(tris[i].v1, tris[i].v2));
+					glm::vec3 triangleMax = glm::max(tris[i].v0, glm::max(tris[i].v1, tris[i].v2));
+					if (!glm::any(glm::greaterThan(triangleMin, boxMax)) && !glm::any(glm::lessThan(triangleMax, boxMin)))
+						visit(i);
+				}
+			}
+			else
+			{
+				stack[top++] = node.first;
+				stack[top++] = index + 1;
+			}
+		}
+	}
+
+	// true if any triangle intersects the box
+	bool overlapsBox(const glm::vec3 &boxMin, const glm::vec3 &boxMax) const
+	{
+		bool overlap = false;
+		glm::vec3 center = (boxMin + boxMax) * 0.5f, extents = (boxMax - boxMin) * 0.5f;
+		forEachTriangle(boxMin, boxMax, [&](uint32_t i) {
+			overlap = overlap || TriangleOverlapsBox(tris[i], center, extents);
+		});
+		return overlap;
+	}
+
+	// separating axis test of a triangle against the box around center (Akenine-Moller)
+	static bool TriangleOverlapsBox(const BvhTriangle &triangle, const glm::vec3 &center, const glm::vec3 &extents)
+	{
+		glm::vec3 v[3] = { triangle.v0 - center, triangle.v1 - center, triangle.v2 - center };
+		glm::vec3 edges[3] = { v[1] - v[0], v[2] - v[1], v[0] - v[2] };
+		glm::vec3 axes[13];
+		int axisCount = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			glm::vec3 boxAxis(0.0f);
+			boxAxis[i] = 1.0f;
+			axes[axisCount++] = boxAxis;
+			for (int j = 0; j < 3; j++)
+				axes[axisCount++] = glm::cross(boxAxis, edges[j]);
+		}
+		axes[axisCount++] = glm::cross(edges[0], edges[1]);
+		for (int i = 0; i < axisCount; i++)
+		{
+			float p0 = glm::dot(v[0], axes[i]), p1 = glm::dot(v[1], axes[i]), p2 = glm::dot(v[2], axes[i]);
+			float reach = glm::dot(extents, glm::abs(axes[i]));
+			if (min(p0, min(p1, p2)) > reach || max(p0, max(p1, p2)) < -reach)
+				return false;
+		}
+		return true;
+	}
+
+	// closest point of the triangle to point (Ericson, Real-Time Collision Detection 5.1.5)
+	static glm::vec3 ClosestPointOnTriangle(const glm::vec3 &point, const BvhTriangle &triangle)
+	{
+		const glm::vec3 &a = triangle.v0, &b = triangle.v1, &c = triangle.v2;
+		glm::vec3 ab = b - a, ac = c - a, ap = point - a;
+		float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+		glm::vec3 bp = point - b;
+		float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3)
+			return b;
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+		glm::vec3 cp = point - c;
+		float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6)
+			return c;
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+			return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		float denominator = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denominator) + ac * (vc * denominator);
+	}
+
+private:
+	vector<BvhTriangle> tris;		// in leaf order once built
+	vector<TriangleBvhNode> nodes;
+
+	static const int SAH_BINS = 12;
+	static const uint32_t MAX_LEAF_TRIANGLES = 8;
+	static const uint32_t MAX_DEPTH = 60;	// the traversal stacks hold 64 entries
+
+	struct BuildContext {
+		vector<uint32_t> &order;
+		const vector<glm::vec3> &centroids, &triangleMin, &triangleMax;
+	};
+
+	static float HalfArea(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+	{
+		glm::vec3 size = boundsMax - boundsMin;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	// builds the node over order[begin, end) and everything below it, returns its index
+	uint32_t buildNode(BuildContext &context, uint32_t begin, uint32_t end, uint32_t depth)
+	{
+		uint32_t index = (uint32_t)nodes.size();
+		nodes.push_back(TriangleBvhNode());
+		glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX), centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint32_t triangle = context.order[i];
+			boundsMin = glm::min(boundsMin, context.triangleMin[triangle]);
+			boundsMax = glm::max(boundsMax, context.triangleMax[triangle]);
+			centroidMin = glm::min(centroidMin, context.centroids[triangle]);
+			centroidMax = glm::max(centroidMax, context.centroids[triangle]);
+		}
+		nodes[index].boundsMin = boundsMin;
+		nodes[index].boundsMax = boundsMax;
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+
+		uint32_t count = end - begin;
+		if (count <= 2 || depth == MAX_DEPTH)
+			return index;
+
+		// the cheapest split between bins of the centroids along any axis; a leaf costs one
+		// intersection per triangle, a split one traversal step plus its children weighted by area
+		int bestAxis = -1, bestSplit = 0;
+		float bestCost = (float)count;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f)
+				continue;
+			uint32_t binCount[SAH_BINS] = { 0 };
+			glm::vec3 binMin[SAH_BINS], binMax[SAH_BINS];
+			for (int b = 0; b < SAH_BINS; b++)
+			{
+				binMin[b] = glm::vec3(FLT_MAX);
+				binMax[b] = glm::vec3(-FLT_MAX);
+			}
+			float scale = SAH_BINS / extent;
+			for (uint32_t i = begin; i < end; i++)
+			{
+				uint32_t triangle = context.order[i];
+				int b = min(SAH_BINS - 1, (int)((context.centroids[triangle][axis] - centroidMin[axis]) * scale));
+				binCount[b]++;
+				binMin[b] = glm::min(binMin[b], context.triangleMin[triangle]);
+				binMax[b] = glm::max(binMax[b], context.triangleMax[triangle]);
+			}
+			// areas and counts left of every split, then sweep from the right
+			float leftArea[SAH_BINS];
+			uint32_t leftCount[SAH_BINS];
+			glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+			uint32_t sweepCount = 0;
+			for (int b = 0; b < SAH_BINS - 1; b++)
+			{
+				sweepCount += binCount[b];
+				sweepMin = glm::min(sweepMin, binMin[b]);
+				sweepMax = glm::max(sweepMax, binMax[b]);
+				leftCount[b] = sweepCount;
+				leftArea[b] = sweepCount ? HalfArea(sweepMin, sweepMax) : 0.0f;
+			}
+			sweepMin = glm::vec3(FLT_MAX);
+			sweepMax = glm::vec3(-FLT_MAX);
+			sweepCount = 0;
+			float parentArea = HalfArea(boundsMin, boundsMax);
+			for (int b = SAH_BINS - 1; b > 0; b--)
+			{
+				sweepCount += binCount[b];
+				sweepMin = glm::min(sweepMin, binMin[b]);
+				sweepMax = glm::max(sweepMax, binMax[b]);
+				if (!sweepCount || !leftCount[b - 1])
+					continue;
+				float cost = 1.0f + (leftArea[b - 1] * leftCount[b - 1] + HalfArea(sweepMin, sweepMax) * sweepCount) / parentArea;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		uint32_t middle;
+		if (bestAxis >= 0)
+		{
+			float scale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+			middle = (uint32_t)(std::partition(context.order.begin() + begin, context.order.begin() + end, [&](uint32_t triangle) {
+				return min(SAH_BINS - 1, (int)((context.centroids[triangle][bestAxis] - centroidMin[bestAxis]) * scale)) < bestSplit;
+			}) - context.order.begin());
+		}
+		else if (count > MAX_LEAF_TRIANGLES)
+		{
+			// splitting does not pay, but the leaf would be too long: halve along the longest axis
+			glm::vec3 size = centroidMax - centroidMin;
+			int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+			middle = begin + count / 2;
+			std::nth_element(context.order.begin() + begin, context.order.begin() + middle, context.order.begin() + end, [&](uint32_t a, uint32_t b) {
+				return context.centroids[a][axis] < context.centroids[b][axis];
+			});
+		}
+		else
+			return index;
+
+		buildNode(context, begin, middle, depth + 1);
+		uint32_t second = buildNode(context, middle, end, depth + 1);
+		nodes[index].first = second;
+		nodes[index].count = 0;
+		return index;
+	}
+
+	// entry distance of origin + t * direction into the box, grown by margin; false if it misses within [0, maxT]
+	static bool SegmentBox(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float margin, const TriangleBvhNode &node, float maxT, float &entry)
+	{
+		glm::vec3 t0 = (node.boundsMin - margin - origin) * inverseDirection;
+		glm::vec3 t1 = (node.boundsMax + margin - origin) * inverseDirection;
+		glm::vec3 nearT = glm::min(t0, t1), farT = glm::max(t0, t1);
+		entry = max(max(nearT.x, nearT.y), max(nearT.z, 0.0f));
+		float exit = min(min(farT.x, farT.y), min(farT.z, maxT));
+		return entry <= exit;
+	}
+
+	// visits the leaves the segment passes, grown by margin, nearest first; maxT may shrink while visiting
+	template <typename Visitor>
+	void traverseSegment(const glm::vec3 &origin, const glm::vec3 &direction, float margin, float &maxT, const Visitor &visit) const
+	{
+		if (nodes.empty())
+			return;
+		// a zero component gives an infinite slab, which only rejects if the origin is outside it
+		glm::vec3 inverseDirection;
+		for (int i = 0; i < 3; i++)
+			inverseDirection[i] = direction[i] != 0.0f ? 1.0f / direction[i] : FLT_MAX;
+		uint32_t stack[64];
+		float stackEntry[64];
+		int top = 0;
+		float entry;
+		if (!SegmentBox(origin, inverseDirection, margin, nodes[0], maxT, entry))
+			return;
+		stack[top] = 0;
+		stackEntry[top++] = entry;
+		while (top)
+		{
+			top--;
+			if (stackEntry[top] > maxT)
+				continue;
+			uint32_t index = stack[top];
+			const TriangleBvhNode &node = nodes[index];
+			if (node.count)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					visit(i);
+				continue;
+			}
+			uint32_t first = index + 1, second = node.first;
+			float firstEntry, secondEntry;
+			bool hitFirst = SegmentBox(origin, inverseDirection, margin, nodes[first], maxT, firstEntry);
+			bool hitSecond = SegmentBox(origin, inverseDirection, margin, nodes[second], maxT, secondEntry);
+			// push the farther child first so the nearer one is visited first
+			if (hitFirst && hitSecond && firstEntry < secondEntry)
+			{
+				swap(first, second);
+				swap(firstEntry, secondEntry);
+				swap(hitFirst, hitSecond);
+			}
+			if (hitFirst)
+			{
+				stack[top] = first;
+				stackEntry[top++] = firstEntry;
+			}
+			if (hitSecond)
+			{
+				stack[top] = second;
+				stackEntry[top++] = secondEntry;
+			}
+		}
+	}
+
+	// Moller-Trumbore, both sides
+	static bool RayTriangle(const glm::vec3 &origin, const glm::vec3 &direction, const BvhTriangle &triangle, float maxT, float &t)
+	{
+		glm::vec3 e1 = triangle.v1 - triangle.v0, e2 = triangle.v2 - triangle.v0;
+		glm::vec3 p = glm::cross(direction, e2);
+		float determinant = glm::dot(e1, p);
+		if (fabs(determinant) < 1e-12f)
+			return false;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = origin - triangle.v0;
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		t = glm::dot(e2, q) * inverse;
+		return t >= 0.0f && t <= maxT;
+	}
+
+	// smallest root of a t^2 + b t + c = 0 in [0, maxT]
+	static bool LowestRoot(float a, float b, float c, float maxT, float &root)
+	{
+		if (fabs(a) < 1e-12f)
+			return false;
+		float discriminant = b * b - 4.0f * a * c;
+		if (discriminant < 0.0f)
+			return false;
+		float s = sqrt(discriminant);
+		float r1 = (-b - s) / (2.0f * a), r2 = (-b + s) / (2.0f * a);
+		if (r1 > r2)
+			swap(r1, r2);
+		if (r1 >= 0.0f && r1 <= maxT)
+		{
+			root = r1;
+			return true;
+		}
+		if (r2 >= 0.0f && r2 <= maxT)
+		{
+			root = r2;
+			return true;
+		}
+		return false;
+	}
+
+	// first contact of the sphere moving along motion with the triangle: its face, then its
+	// edges as cylinders and its corners as spheres (Fauerby, Improved Collision detection and Response)
+	static bool SweepSphereTriangle(const glm::vec3 &center, float radius, const glm::vec3 &motion, const BvhTriangle &triangle, float maxT, float &t, glm::vec3 &normal)
+	{
+		glm::vec3 normalDirection = glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0);
+		float length = glm::length(normalDirection);
+		if (length <= 0.0f)
+			return false;
+		glm::vec3 faceNormal = normalDirection / length;
+
+		// already touching: a contact only while moving further in
+		glm::vec3 away = center - ClosestPointOnTriangle(center, triangle);
+		float distanceSquared = glm::dot(away, away);
+		if (distanceSquared < radius * radius)
+		{
+			if (distanceSquared <= 0.0f)
+				away = glm::dot(motion, faceNormal) > 0.0f ? -faceNormal : faceNormal;
+			if (glm::dot(motion, away) >= 0.0f)
+				return false;
+			t = 0.0f;
+			normal = glm::normalize(away);
+			return true;
+		}
+
+		// the face, from the side the sphere starts on
+		float distance = glm::dot(center - triangle.v0, faceNormal);
+		if (distance < 0.0f)
+		{
+			faceNormal = -faceNormal;
+			distance = -distance;
+		}
+		float speed = glm::dot(motion, faceNormal);
+		if (speed < 0.0f)
+		{
+			float faceT = (radius - distance) / speed;
+			if (faceT >= 0.0f && faceT <= maxT)
+			{
+				glm::vec3 contact = center + motion * faceT - faceNormal * radius;
+				glm::vec3 c0 = glm::cross(triangle.v1 - triangle.v0, contact - triangle.v0);
+				glm::vec3 c1 = glm::cross(triangle.v2 - triangle.v1, contact - triangle.v1);
+				glm::vec3 c2 = glm::cross(triangle.v0 - triangle.v2, contact - triangle.v2);
+				float s0 = glm::dot(c0, faceNormal), s1 = glm::dot(c1, faceNormal), s2 = glm::dot(c2, faceNormal);
+				if ((s0 >= 0.0f && s1 >= 0.0f && s2 >= 0.0f) || (s0 <= 0.0f && s1 <= 0.0f && s2 <= 0.0f))
+				{
+					// touching the inside of the face comes before any edge or corner
+					t = faceT;
+					normal = faceNormal;
+					return true;
+				}
+			}
+		}
+
+		bool found = false;
+		float best = maxT;
+		float speedSquared = glm::dot(motion, motion);
+		const glm::vec3 *corners[3] = { &triangle.v0, &triangle.v1, &triangle.v2 };
+		for (int i = 0; i < 3; i++)
+		{
+			glm::vec3 toCenter = center - *corners[i];
+			float root;
+			if (LowestRoot(speedSquared, 2.0f * glm::dot(motion, toCenter), glm::dot(toCenter, toCenter) - radius * radius, best, root))
+			{
+				best = root;
+				normal = glm::normalize(center + motion * root - *corners[i]);
+				found = true;
+			}
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec3 &from = *corners[i], &to = *corners[(i + 1) % 3];
+			glm::vec3 edge = to - from, baseToVertex = from - center;
+			float edgeSquared = glm::dot(edge, edge);
+			float edgeDotMotion = glm::dot(edge, motion);
+			float edgeDotBase = glm::dot(edge, baseToVertex);
+			float a = edgeSquared * -speedSquared + edgeDotMotion * edgeDotMotion;
+			float b = edgeSquared * (2.0f * glm::dot(motion, baseToVertex)) - 2.0f * edgeDotMotion * edgeDotBase;
+			float c = edgeSquared * (radius * radius - glm::dot(baseToVertex, baseToVertex)) + edgeDotBase * edgeDotBase;
+			float root;
+			if (LowestRoot(a, b, c, best, root))
+			{
+				float along = (edgeDotMotion * root - edgeDotBase) / edgeSquared;
+				if (along >= 0.0f && along <= 1.0f)
+				{
+					best = root;
+					normal = glm::normalize(center + motion * root - (from + edge * along));
+					found = true;
+				}
+			}
+		}
+		t = best;
+		return found;
+	}
+};
+#endif
@@ -0,0 +1,249 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include "glad/glad.h"
+
+#include "glm/glm.hpp"
+#include "glm/gtc/packing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// full precision vertex the importers, the optimizer and the mesh cache work with
+struct Vertex {
+	// position
+	glm::vec3 Position;
+	// normal
+	glm::vec3 Normal;
+	// texCoords
+	glm::vec2 TexCoords;
+	// tangent
+	glm::vec3 Tangent;
+	// bitangent
+	glm::vec3 Bitangent;
+};
+
+// What a mesh's vertex buffer holds on the GPU. The compact layouts are packed from Vertex
+// when the mesh is uploaded:
+//
+//   position   4 x uint16, normalized    xyz relative to the mesh bounds, w = bitangent sign (0 = -1, 1 = +1)
+//   normal     2 x int16, normalized     octahedral encoding
+//   texCoords  2 x half                  2 x float for meshes whose coordinates leave [-2, 2]
+//   tangent    2 x int16, normalized     octahedral encoding, VERTEX_LAYOUT_COMPACT_TANGENT only
+//
+// That is 16 bytes (20 with tangents) instead of the 56 of Vertex. The vertex shaders undo
+// the packing with the positionOffset, positionScale and octahedralNormals uniforms that
+// Mesh::Draw sets from the mesh's VertexFormat.
+enum VertexLayout {
+	VERTEX_LAYOUT_FLOAT,			// Vertex as is
+	VERTEX_LAYOUT_COMPACT,			// no tangent space, none of our shaders reads it
+	VERTEX_LAYOUT_COMPACT_TANGENT
+};
+
+// attribute locations shared by every layout and every vertex shader
+enum VertexAttribute {
+	VERTEX_ATTRIBUTE_POSITION = 0,
+	VERTEX_ATTRIBUTE_NORMAL = 1,
+	VERTEX_ATTRIBUTE_TEXCOORDS = 2,
+	VERTEX_ATTRIBUTE_TANGENT = 3,
+	VERTEX_ATTRIBUTE_BITANGENT = 4,
+	VERTEX_ATTRIBUTE_INSTANCE_MODEL = 5,	// mat4 per instance, takes locations 5 to 8
+	VERTEX_ATTRIBUTE_INSTANCE_POSITION_OFFSET = 9,	// per instance positionOffset and positionScale of
+	VERTEX_ATTRIBUTE_INSTANCE_POSITION_SCALE = 10	// the indirect draws, see gpu_driven.h
+};
+
+// half floats are at least 1/1024 precise in this range, about a texel of a 1024 texture
+const float HALF_TEXCOORD_LIMIT = 2.0f;
+
+struct VertexFormat {
+	VertexLayout layout;
+	unsigned int stride;
+	unsigned int texCoordOffset;
+	unsigned int tangentOffset;
+	bool halfTexCoords;
+	// model space position = positionOffset + positionScale * stored position
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+};
+
+// meshes up to this many vertices are drawn with 16 bit indices; importers split bigger ones (see SplitMesh)
+const size_t MAX_SHORT_INDEXED_VERTICES = 65536;
+
+// smallest index type able to address vertexCount vertices. 8 bit indices are left out on
+// purpose: many GPUs convert them on the fly, which costs more than the bytes they save
+inline GLenum ChooseIndexType(size_t vertexCount)
+{
+	return vertexCount <= MAX_SHORT_INDEXED_VERTICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline unsigned int IndexSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_BYTE ? 1 : indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// v scaled to unit length; zero stays zero instead of turning into NaN, which vertices without
+// tangents (no texture coordinates) rely on
+inline glm::vec3 NormalizeOrZero(const glm::vec3 &v)
+{
+	float length = glm::length(v);
+	return length > 0.0f ? v / length : glm::vec3(0.0f);
+}
+
+// unit vector onto the [-1, 1] square, see "A Survey of Efficient Representations for Independent Unit Vectors"
+inline glm::vec2 OctahedralEncode(const glm::vec3 &n)
+{
+	float sum = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if (sum == 0.0f)
+		return glm::vec2(0.0f);
+	glm::vec2 p = glm::vec2(n.x, n.y) / sum;
+	if (n.z < 0.0f)
+		p = glm::vec2((1.0f - fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+	return p;
+}
+
+inline glm::vec3 OctahedralDecode(const glm::vec2 &e)
+{
+	glm::vec3 n(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+inline int16_t PackSnorm16(float value)
+{
+	return (int16_t)floor(min(max(value, -1.0f), 1.0f) * 32767.0f + 0.5f);
+}
+
+inline uint16_t PackUnorm16(float value)
+{
+	return (uint16_t)floor(min(max(value, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+// the layout of vertices for layout, with the bounds the positions are quantized against
+inline VertexFormat ChooseVertexFormat(const Vertex *vertices, size_t count, VertexLayout layout)
+{
+	VertexFormat format;
+	format.layout = layout;
+	format.positionOffset = glm::vec3(0.0f);
+	format.positionScale = glm::vec3(1.0f);
+	if (layout == VERTEX_LAYOUT_FLOAT)
+	{
+		format.stride = sizeof(Vertex);
+		format.texCoordOffset = offsetof(Vertex, TexCoords);
+		format.tangentOffset = offsetof(Vertex, Tangent);
+		format.halfTexCoords = false;
+		return format;
+	}
+
+	glm::vec3 lower(0.0f), upper(0.0f);
+	float texCoordRange = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		lower = i ? glm::min(lower, vertices[i].Position) : vertices[i].Position;
+		upper = i ? glm::max(upper, vertices[i].Position) : vertices[i].Position;
+		texCoordRange = max(texCoordRange, max(fabs(vertices[i].TexCoords.x), fabs(vertices[i].TexCoords.y)));
+	}
+	format.positionOffset = lower;
+	format.positionScale = upper - lower;
+	format.halfTexCoords = texCoordRange <= HALF_TEXCOORD_LIMIT;
+	format.texCoordOffset = 12;
+	format.tangentOffset = format.texCoordOffset + (format.halfTexCoords ? 4 : 8);
+	format.stride = format.tangentOffset + (layout == VERTEX_LAYOUT_COMPACT_TANGENT ? 4 : 0);
+	return format;
+}
+
+// converts vertices into the bytes of format's vertex buffer
+inline void PackVertices(const Vertex *vertices, size_t count, const VertexFormat &format, vector<unsigned char> &out)
+{
+	if (format.layout == VERTEX_LAYOUT_FLOAT)
+	{
+		out.assign((const unsigned char*)vertices, (const unsigned char*)(vertices + count));
+		return;
+	}
+	out.assign(count * format.stride, 0);
+	glm::vec3 inverseScale;
+	for (int c = 0; c < 3; c++)
+		inverseScale[c] = format.positionScale[c] > 0.0f ? 1.0f / format.positionScale[c] : 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		const Vertex &vertex = vertices[i];
+		unsigned char *packed = &out[i * format.stride];
+
+		uint16_t position[4];
+		glm::vec3 relative = (vertex.Position - format.positionOffset) * inverseScale;
+		for (int c = 0; c < 3; c++)
+			position[c] = PackUnorm16(relative[c]);
+		// handedness of the tangent frame, so the bitangent can be rebuilt as sign * cross(N, T)
+		position[3] = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? 0 : 65535;
+		memcpy(packed, position, 8);
+
+		glm::vec2 octahedral = OctahedralEncode(vertex.Normal);
+		int16_t normal[2] = { PackSnorm16(octahedral.x), PackSnorm16(octahedral.y) };
+		memcpy(packed + 8, normal, 4);
+
+		if (format.halfTexCoords)
+		{
+			uint16_t texCoords[2] = { glm::packHalf1x16(vertex.TexCoords.x), glm::packHalf1x16(vertex.TexCoords.y) };
+			memcpy(packed + format.texCoordOffset, texCoords, 4);
+		}
+		else
+			memcpy(packed + format.texCoordOffset, &vertex.TexCoords, 8);
+
+		if (format.layout == VERTEX_LAYOUT_COMPACT_TANGENT)
+		{
+			octahedral = OctahedralEncode(vertex.Tangent);
+			int16_t tangent[2] = { PackSnorm16(octahedral.x), PackSnorm16(octahedral.y) };
+			memcpy(packed + format.tangentOffset, tangent, 4);
+		}
+	}
+}
+
+// points the attributes of the bound VAO at the bound array buffer, which holds format's layout
+inline void SetVertexAttributes(const VertexFormat &format)
+{
+	GLsizei stride = (GLsizei)format.stride;
+	glEnableVertexAttribArray(VERTEX_ATTRIBUTE_POSITION);
+	glEnableVertexAttribArray(VERTEX_ATTRIBUTE_NORMAL);
+	glEnableVertexAttribArray(VERTEX_ATTRIBUTE_TEXCOORDS);
+	if (format.layout == VERTEX_LAYOUT_FLOAT)
+	{
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Position));
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_NORMAL, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_TEXCOORDS, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+		glEnableVertexAttribArray(VERTEX_ATTRIBUTE_TANGENT);
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_TANGENT, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+		glEnableVertexAttribArray(VERTEX_ATTRIBUTE_BITANGENT);
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_BITANGENT, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+		return;
+	}
+	// the integer attributes are normalized: [0, 65535] becomes [0, 1] and [-32767, 32767] becomes [-1, 1]
+	glVertexAttribPointer(VERTEX_ATTRIBUTE_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+	glVertexAttribPointer(VERTEX_ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, stride, (void*)8);
+	glVertexAttribPointer(VERTEX_ATTRIBUTE_TEXCOORDS, 2, format.halfTexCoords ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride, (void*)(size_t)format.texCoordOffset);
+	if (format.layout == VERTEX_LAYOUT_COMPACT_TANGENT)
+	{
+		glEnableVertexAttribArray(VERTEX_ATTRIBUTE_TANGENT);
+		glVertexAttribPointer(VERTEX_ATTRIBUTE_TANGENT, 2, GL_SHORT, GL_TRUE, stride, (void*)(size_t)format.tangentOffset);
+	}
+}
+
+// points the instance attributes of the bound VAO at buffer, an array of glm::mat4 model
+// matrices that advances once per instance
+inline void SetInstanceAttributes(GLuint buffer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (unsigned int column = 0; column < 4; column++)
+	{
+		GLuint location = VERTEX_ATTRIBUTE_INSTANCE_MODEL + column;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(location, 1);
+	}
+}
+#endif